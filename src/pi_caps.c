@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#include <errno.h>
+#include "rtpi.h"
+#include "pi_futex.h"
+
+__u32 futex_caps;
+
+/*
+ * Each probe issues the operation in a way that fails immediately: with
+ * ENOSYS if the kernel lacks it, with another error otherwise.
+ */
+
+/* Lock a PI futex the caller already owns: EDEADLK without blocking */
+static bool probe_lock_pi(int op)
+{
+	__u32 futex = futex_tid();
+
+	return sys_futex(&futex, op | FUTEX_PRIVATE_FLAG, 0, NULL, NULL, 0) &&
+	       errno == EDEADLK;
+}
+
+/* Requeue a futex onto itself: EINVAL */
+static bool probe_requeue_pi(void)
+{
+	__u32 futex = 0;
+
+	return sys_futex(&futex, FUTEX_CMP_REQUEUE_PI | FUTEX_PRIVATE_FLAG,
+			 1, (void *)1L, &futex, 0) &&
+	       errno == EINVAL;
+}
+
+/* Wait on an empty vector: EINVAL */
+static bool probe_futex_waitv(void)
+{
+	return syscall(SYS_futex_waitv, NULL, 0, 0, NULL, 0) &&
+	       errno == EINVAL;
+}
+
+/**
+ * futex_probe() - probe the futex operations of the running kernel
+ *
+ * Concurrent callers compute and store the same bitmap. Returns the
+ * capabilities, with FUTEX_CAPS_PROBED set.
+ */
+__u32 futex_probe(void)
+{
+	__u32 caps = FUTEX_CAPS_PROBED;
+	int err = errno;
+
+	if (probe_lock_pi(FUTEX_LOCK_PI))
+		caps |= RTPI_CAP_LOCK_PI;
+	if (probe_lock_pi(FUTEX_LOCK_PI2))
+		caps |= RTPI_CAP_LOCK_PI2;
+	if (probe_requeue_pi())
+		caps |= RTPI_CAP_REQUEUE_PI;
+	if (probe_futex_waitv())
+		caps |= RTPI_CAP_FUTEX_WAITV;
+
+	errno = err;
+	__atomic_store_n(&futex_caps, caps, __ATOMIC_RELAXED);
+	return caps;
+}
+
+uint32_t pi_get_capabilities(void)
+{
+	__u32 caps = __atomic_load_n(&futex_caps, __ATOMIC_RELAXED);
+
+	if (!caps)
+		caps = futex_probe();
+	return caps & ~FUTEX_CAPS_PROBED;
+}
+
+__attribute__((constructor)) static void caps_init(void)
+{
+	futex_probe();
+}
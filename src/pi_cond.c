@@ -1,44 +1,79 @@
 // SPDX-License-Identifier: LGPL-2.1-only
 // Copyright © 2018 VMware, Inc. All Rights Reserved.
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
 #include "rtpi.h"
+#include "pi_cond.h"
 #include "pi_futex.h"
+#include "pi_protect.h"
+#include "pi_slab.h"
+#include "pi_stats.h"
 
 /*
- * This wrapper for early library validation only.
- * TODO: Replace with pthread_cond_t wrapper with a new cond implementation.
- *       Base this on the older version of the condvar, with the patch from
- *       Dinakar and Darren to enable priority fifo wakeup order.
+ * The condvar bookkeeping lives in cond->state and is only ever updated with
+ * CAS, so no internal lock is needed. The only syscalls are the
+ * FUTEX_WAIT_REQUEUE_PI in the waiter and the FUTEX_CMP_REQUEUE_PI in the
+ * waker; the kernel picks the highest priority waiter for the requeue, which
+ * preserves priority ordered wakeup.
+ *
+ * A waiter samples cond->cond before registering in cond->state, and a waker
+ * only bumps cond->cond after granting a wakeup to a registered waiter. A
+ * waiter that has not reached the kernel by the time of the requeue is then
+ * guaranteed to see EAGAIN from FUTEX_WAIT_REQUEUE_PI, and it takes its
+ * wakeup from cond->state instead.
+ *
+ * The algorithm works on struct pi_cond_words and struct pi_cond_lock, never
+ * on pi_cond_t or pi_mutex_t themselves: it touches no other words than
+ * those, so librtpi-pthread can run it on the storage of pthread_cond_t and
+ * on a pi_mutex_compact_t. Anything more a condvar needs must be added to
+ * those structures, not read from pi_cond_t.
  */
+#define COND_WAITER		(1ULL << 32)
+#define COND_DESTROYING		(1ULL << 63)
+#define COND_WAITERS(s)		((__u32)((s) >> 32) & 0x7fffffff)
+#define COND_WAKES(s)		((__u32)(s))
+
+/*
+ * A condvar may be destroyed as soon as the waiters are granted their
+ * wakeups, but they still unregister from the state afterwards. The
+ * destroyer sets COND_DESTROYING and sleeps on the upper half of the state,
+ * the word holding the waiter count, until the last of them wakes it.
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define COND_UPPER		1
+#else
+#define COND_UPPER		0
+#endif
 
 pi_cond_t *pi_cond_alloc(void)
 {
-	return malloc(sizeof(pi_cond_t));
+	return pi_slab_alloc(&pi_slab_128);
+}
+
+int pi_cond_alloc_bulk(pi_cond_t **conds, size_t n)
+{
+	return pi_slab_alloc_bulk(&pi_slab_128, (void **)conds, n);
 }
 
 void pi_cond_free(pi_cond_t *cond)
 {
-	free(cond);
+	pi_slab_free(&pi_slab_128, cond);
 }
 
 int pi_cond_init(pi_cond_t *cond, uint32_t flags)
 {
-	struct timespec ts = { 0, 0 };
 	int ret;
 
-	if (flags & ~(RTPI_COND_PSHARED)) {
+	if (flags & ~(RTPI_COND_PSHARED | RTPI_COND_CLOCK_REALTIME |
+		      RTPI_COND_SPIN)) {
 		ret = EINVAL;
 		goto out;
 	}
 	memset(cond, 0, sizeof(*cond));
-	if (flags & RTPI_COND_PSHARED) {
-		cond->flags = RTPI_COND_PSHARED;
-	}
-
-	pi_mutex_init(&cond->priv_mut, cond->flags & RTPI_COND_PSHARED);
+	cond->flags = flags;
 
 	ret = 0;
 out:
@@ -51,150 +86,375 @@ int pi_cond_destroy(pi_cond_t *cond)
 	return 0;
 }
 
-int pi_cond_timedwait(pi_cond_t *cond, pi_mutex_t *mutex,
-		      const struct timespec *abstime)
+/**
+ * cond_left() - let a destroyer know if the last waiter has unregistered
+ * @cw: condition variable the caller unregistered from
+ * @state: value the caller left in cw->state
+ *
+ * Once this returns, the caller must not touch cw again. The wakeup itself
+ * only passes the address to the kernel, which is fine after it is freed.
+ */
+static inline void cond_left(const struct pi_cond_words *cw, __u64 state)
+{
+	if ((state >> 32) == (COND_DESTROYING >> 32))
+		futex_wake((__u32 *)cw->state + COND_UPPER, INT_MAX, cw->flags);
+}
+
+/**
+ * cond_take_wake() - consume a pending wakeup and unregister the waiter
+ * @cw: condition variable the caller is registered on
+ *
+ * Returns true if a wakeup was consumed, false if none was pending, in which
+ * case the caller stays registered.
+ */
+static bool cond_take_wake(const struct pi_cond_words *cw)
+{
+	__u64 state;
+
+	state = __atomic_load_n(cw->state, __ATOMIC_SEQ_CST);
+	do {
+		if (!COND_WAKES(state))
+			return false;
+	} while (!__atomic_compare_exchange_n(cw->state, &state,
+					      state - COND_WAITER - 1, true,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_SEQ_CST));
+	cond_left(cw, state - COND_WAITER - 1);
+	return true;
+}
+
+/**
+ * cond_leave() - unregister the waiter, consuming a wakeup if one is pending
+ * @cw: condition variable the caller is registered on
+ *
+ * Returns true if a wakeup was consumed.
+ */
+static bool cond_leave(const struct pi_cond_words *cw)
+{
+	__u64 state, next;
+
+	state = __atomic_load_n(cw->state, __ATOMIC_SEQ_CST);
+	do {
+		next = state - COND_WAITER;
+		if (COND_WAKES(state))
+			next--;
+	} while (!__atomic_compare_exchange_n(cw->state, &state, next, true,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_SEQ_CST));
+	cond_left(cw, next);
+	return COND_WAKES(state) != 0;
+}
+
+/*
+ * Upper bound on the spin of an RTPI_COND_SPIN waiter before it sleeps, in
+ * iterations of the spin loop.
+ */
+#define COND_MAX_SPIN		1000
+
+/**
+ * cond_spin() - watch for a wakeup before sleeping in the kernel
+ * @cw: condition variable the caller is registered on
+ * @futex_id: cond sequence sampled before registering
+ *
+ * A waker bumps cw->cond only after granting a wakeup, so the sequence
+ * changing is the cue to try and take one from cw->state. A wakeup taken
+ * here is no longer pending, and cond_wake() leaves it out of the requeue.
+ *
+ * Returns true if a wakeup was consumed, false if the caller should sleep.
+ */
+static bool cond_spin(const struct pi_cond_words *cw, __u32 futex_id)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < COND_MAX_SPIN; cnt++) {
+		cpu_relax();
+		if (__atomic_load_n(cw->cond, __ATOMIC_RELAXED) != futex_id)
+			return cond_take_wake(cw);
+	}
+	return false;
+}
+
+/**
+ * cond_wait() - common path of the condvar waits
+ * @cw: condition variable to wait on
+ * @lk: mutex associated with the condvar, held by the caller
+ * @abstime: absolute timeout, or NULL to wait forever
+ * @realtime: whether abstime is against CLOCK_REALTIME
+ */
+static inline int cond_wait(const struct pi_cond_words *cw,
+			    const struct pi_cond_lock *lk,
+			    const struct timespec *abstime, bool realtime)
 {
 	int ret;
-	__u32 wait_id;
 	__u32 futex_id;
 
-	ret = pi_mutex_lock(&cond->priv_mut);
-	if (ret)
-		return ret;
+	futex_id = __atomic_load_n(cw->cond, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(cw->state, COND_WAITER, __ATOMIC_SEQ_CST);
 
-	ret = pi_mutex_unlock(mutex);
+	ret = lk->unlock(lk->mutex);
 	if (ret) {
-		pi_mutex_unlock(&cond->priv_mut);
+		cond_leave(cw);
 		return ret;
 	}
-	cond->pending_wait++;
-	cond->cond++;
-	wait_id = cond->cond;
-	do {
 
-		futex_id = cond->cond;
-		pi_mutex_unlock(&cond->priv_mut);
-
-		ret = futex_wait_requeue_pi(cond, futex_id, abstime, mutex);
-
-		pi_mutex_lock(&cond->priv_mut);
-		if (ret < 0) {
-			if (errno == EAGAIN) {
-				/* futex VAL changed between unlock & wait */
-				if (cond->wake_id >= wait_id && cond->pending_wake) {
-					/* There is one wakeup pending for us */
-					cond->pending_wake--;
-					cond->pending_wait--;
-					pi_mutex_unlock(&cond->priv_mut);
-					pi_mutex_lock(mutex);
-					ret = 0;
-					break;
-				}
-				/* Reload VAL and try again */
-				continue;
-			} else {
-				/* Error, abort */
-				cond->pending_wait--;
-				pi_mutex_unlock(&cond->priv_mut);
-				pi_mutex_lock(mutex);
-				ret = errno;
-				break;
-			}
+	if ((cw->flags & RTPI_COND_SPIN) && cond_spin(cw, futex_id)) {
+		lk->lock(lk->mutex);
+		return 0;
+	}
+
+	do {
+		ret = futex_wait_requeue_pi(cw->cond, cw->flags, futex_id,
+					    abstime, realtime, lk->futex);
+		if (!ret) {
+			/* All good. Proper wakeup + we own the lock */
+			cond_leave(cw);
+			if (lk->handover)
+				lk->handover(lk->mutex);
+			return 0;
 		}
-		/* All good. Proper wakeup + we own the lock */
-		if (cond->pending_wake) {
-			cond->pending_wait--;
-			cond->pending_wake--;
-			pi_mutex_unlock(&cond->priv_mut);
-			ret = 0;
+		if (errno != EAGAIN)
 			break;
+
+		/* futex VAL changed before we slept, the wakeup may be ours */
+		futex_id = __atomic_load_n(cw->cond, __ATOMIC_SEQ_CST);
+		if (cond_take_wake(cw)) {
+			lk->lock(lk->mutex);
+			return 0;
 		}
-		/* No wakeup for us, try again… */
+		/* No wakeup for us, try again with the new VAL */
 	} while (1);
+
+	/* Timeout or error, abort. A wakeup granted meanwhile is ours. */
+	ret = errno;
+	if (cond_leave(cw))
+		ret = 0;
+	lk->lock(lk->mutex);
 	return ret;
 }
 
-int pi_cond_wait(pi_cond_t *cond, pi_mutex_t *mutex)
+int pi_cond_words_wait(const struct pi_cond_words *cw,
+		       const struct pi_cond_lock *lk,
+		       const struct timespec *abstime, bool realtime)
 {
-	return pi_cond_timedwait(cond, mutex, NULL);
+	return cond_wait(cw, lk, abstime, realtime);
 }
 
-int pi_cond_signal(pi_cond_t *cond, pi_mutex_t *mutex)
+static inline struct pi_cond_words cond_words(pi_cond_t *cond)
+{
+	return (struct pi_cond_words){ &cond->cond, &cond->state, cond->flags };
+}
+
+static int cond_mutex_lock(void *mutex)
+{
+	return pi_mutex_lock(mutex);
+}
+
+static int cond_mutex_unlock(void *mutex)
+{
+	return pi_mutex_unlock(mutex);
+}
+
+static void cond_mutex_handover(void *mutex)
+{
+	protect_handover(mutex);
+	stats_handover(mutex);
+}
+
+static inline struct pi_cond_lock cond_lock(pi_mutex_t *mutex)
+{
+	return (struct pi_cond_lock){
+		.futex = &mutex->futex,
+		.mutex = mutex,
+		.lock = cond_mutex_lock,
+		.unlock = cond_mutex_unlock,
+		.handover = cond_mutex_handover,
+	};
+}
+
+static int pi_cond_do_wait(pi_cond_t *cond, pi_mutex_t *mutex,
+			   const struct timespec *abstime, bool realtime)
 {
+	struct pi_cond_words cw = cond_words(cond);
+	struct pi_cond_lock lk = cond_lock(mutex);
+
+	return cond_wait(&cw, &lk, abstime, realtime);
+}
+
+int pi_cond_timedwait(pi_cond_t *cond, pi_mutex_t *mutex,
+		      const struct timespec *abstime)
+{
+	return pi_cond_do_wait(cond, mutex, abstime,
+			       cond->flags & RTPI_COND_CLOCK_REALTIME);
+}
+
+int pi_cond_clockwait(pi_cond_t *cond, pi_mutex_t *mutex, int clock,
+		      const struct timespec *abstime)
+{
+	if (clock != CLOCK_MONOTONIC && clock != CLOCK_REALTIME)
+		return EINVAL;
+	return pi_cond_do_wait(cond, mutex, abstime, clock == CLOCK_REALTIME);
+}
+
+int pi_cond_reltimedwait(pi_cond_t *cond, pi_mutex_t *mutex,
+			 const struct timespec *reltime)
+{
+	struct timespec abstime;
 	int ret;
-	__u32 id;
 
-	pi_mutex_lock(&cond->priv_mut);
+	/* One deadline for the whole wait, including the EAGAIN retries */
+	ret = futex_deadline(reltime, &abstime);
+	if (ret)
+		return ret;
+	return pi_cond_do_wait(cond, mutex, &abstime, false);
+}
 
-	if (!cond->pending_wait) {
-		/* No waiters pending */
-		pi_mutex_unlock(&cond->priv_mut);
-		return 0;
-	}
-	cond->cond++;
-	id = cond->cond;
-	cond->wake_id = id;
-	cond->pending_wake++;
-	pi_mutex_unlock(&cond->priv_mut);
+int pi_cond_wait(pi_cond_t *cond, pi_mutex_t *mutex)
+{
+	return pi_cond_do_wait(cond, mutex, NULL, false);
+}
+
+/**
+ * cond_requeue() - requeue the waiters granted a wakeup onto the mutex
+ * @cw: condition variable to requeue from
+ * @id: cond sequence after granting the wakeups
+ * @nr_requeue: number of waiters to requeue beyond the first
+ * @futex: PI futex of the mutex to requeue to
+ */
+static int cond_requeue(const struct pi_cond_words *cw, __u32 id,
+			__u32 nr_requeue, __u32 *futex)
+{
+	int ret;
 
 	do {
-		ret = futex_cmp_requeue_pi(cond, id, 0, mutex);
-		if (ret > 0) {
-			/* Wakeup performed */
-			break;
-		} else if (ret == 0) {
-			/* nothing woke up */
-			pi_mutex_lock(&cond->priv_mut);
-			cond->pending_wake--;
-			pi_mutex_unlock(&cond->priv_mut);
-		} else if (errno == EAGAIN) {
-			/* id changed */
-			pi_mutex_lock(&cond->priv_mut);
-			cond->cond++;
-			id = cond->cond;
-			cond->wake_id = id;
-			pi_mutex_unlock(&cond->priv_mut);
-		} else {
+		ret = futex_cmp_requeue_pi(cw->cond, cw->flags, id, nr_requeue,
+					   futex);
+		if (ret >= 0) {
+			/*
+			 * Wakeup performed, or the waiters have yet to reach
+			 * the kernel and will find the wakeup on EAGAIN.
+			 */
+			return 0;
+		} else if (errno != EAGAIN) {
 			return errno;
 		}
+		/* id changed by a concurrent signal, reload and retry */
+		id = __atomic_load_n(cw->cond, __ATOMIC_SEQ_CST);
 	} while (1);
-	return 0;
 }
 
-int pi_cond_broadcast(pi_cond_t *cond, pi_mutex_t *mutex)
+/**
+ * cond_idle() - check for waiters still pending a wakeup
+ * @cw: condition variable to check
+ * @state: returns the sampled cw->state
+ *
+ * Waiters register in cw->state before they release the mutex, and the
+ * caller must hold the mutex to signal, so a plain acquire load is enough to
+ * observe them. This keeps a notify with nobody waiting down to one load,
+ * without a CAS or a syscall.
+ */
+static inline bool cond_idle(const struct pi_cond_words *cw, __u64 *state)
 {
-	int ret;
-	__u32 id;
+	*state = __atomic_load_n(cw->state, __ATOMIC_ACQUIRE);
+	return COND_WAKES(*state) >= COND_WAITERS(*state);
+}
 
-	pi_mutex_lock(&cond->priv_mut);
+/**
+ * cond_wake() - grant up to n wakeups and requeue the woken waiters
+ * @cw: condition variable to signal
+ * @futex: PI futex of the mutex associated with the condvar, held by the
+ *	   caller
+ * @n: maximum number of waiters to wake
+ *
+ * The wakeups are granted with one CAS on cw->state, and the kernel wakes
+ * or requeues the highest priority waiters onto the mutex in one
+ * FUTEX_CMP_REQUEUE_PI.
+ */
+static inline int cond_wake(const struct pi_cond_words *cw, __u32 *futex,
+			    __u32 n)
+{
+	__u64 state;
+	__u32 id, nr;
 
-	if (!cond->pending_wait) {
-		/* No waiters pending */
-		pi_mutex_unlock(&cond->priv_mut);
+	if (cond_idle(cw, &state))
 		return 0;
+	do {
+		if (COND_WAKES(state) >= COND_WAITERS(state)) {
+			/* No waiters pending */
+			return 0;
+		}
+		nr = COND_WAITERS(state) - COND_WAKES(state);
+		if (nr > n)
+			nr = n;
+	} while (!__atomic_compare_exchange_n(cw->state, &state, state + nr,
+					      true, __ATOMIC_SEQ_CST,
+					      __ATOMIC_SEQ_CST));
+
+	id = __atomic_add_fetch(cw->cond, 1, __ATOMIC_SEQ_CST);
+
+	/*
+	 * Spinning waiters may have taken the wakeups already. Those still
+	 * pending bound the number of waiters left to wake in the kernel.
+	 */
+	if (cw->flags & RTPI_COND_SPIN) {
+		state = __atomic_load_n(cw->state, __ATOMIC_SEQ_CST);
+		if (!COND_WAKES(state))
+			return 0;
+		if (COND_WAKES(state) < nr)
+			nr = COND_WAKES(state);
 	}
-	cond->cond++;
-	id = cond->cond;
-	cond->wake_id = id;
-	cond->pending_wake = cond->pending_wait;
-	pi_mutex_unlock(&cond->priv_mut);
+	return cond_requeue(cw, id, nr - 1, futex);
+}
+
+int pi_cond_words_wake(const struct pi_cond_words *cw, __u32 *futex, __u32 n)
+{
+	if (!n)
+		return 0;
+	return cond_wake(cw, futex, n);
+}
 
+int pi_cond_words_destroy(const struct pi_cond_words *cw)
+{
+	__u64 state;
+
+	state = __atomic_load_n(cw->state, __ATOMIC_SEQ_CST);
 	do {
-		ret = futex_cmp_requeue_pi(cond, id, INT_MAX, mutex);
-		if (ret >= 0) {
-			/* Wakeup performed */
-			break;
-		} else if (errno == EAGAIN) {
-			/* id changed */
-			pi_mutex_lock(&cond->priv_mut);
-			cond->cond++;
-			id = cond->cond;
-			cond->wake_id = id;
-			cond->pending_wake = cond->pending_wait;
-			pi_mutex_unlock(&cond->priv_mut);
-		} else {
-			return errno;
-		}
-	} while (1);
+		/* Waiters still blocked without a wakeup */
+		if (COND_WAKES(state) < COND_WAITERS(state))
+			return EBUSY;
+	} while (!__atomic_compare_exchange_n(cw->state, &state,
+					      state | COND_DESTROYING, true,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_SEQ_CST));
+
+	/* Wait for the woken waiters to unregister */
+	state |= COND_DESTROYING;
+	while (COND_WAITERS(state)) {
+		futex_wait((__u32 *)cw->state + COND_UPPER,
+			   (__u32)(state >> 32), NULL, cw->flags);
+		state = __atomic_load_n(cw->state, __ATOMIC_SEQ_CST);
+	}
 	return 0;
 }
+
+int pi_cond_signal(pi_cond_t *cond, pi_mutex_t *mutex)
+{
+	struct pi_cond_words cw = cond_words(cond);
+
+	return cond_wake(&cw, &mutex->futex, 1);
+}
+
+int pi_cond_signal_n(pi_cond_t *cond, pi_mutex_t *mutex, unsigned int n)
+{
+	struct pi_cond_words cw = cond_words(cond);
+
+	if (!n)
+		return 0;
+	return cond_wake(&cw, &mutex->futex, n);
+}
+
+int pi_cond_broadcast(pi_cond_t *cond, pi_mutex_t *mutex)
+{
+	struct pi_cond_words cw = cond_words(cond);
+
+	return cond_wake(&cw, &mutex->futex, UINT_MAX);
+}
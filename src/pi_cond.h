@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef PI_COND_H
+#define PI_COND_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "rtpi.h"
+
+/*
+ * The condvar algorithm only needs the words below, so it is run on them
+ * rather than on pi_cond_t and pi_mutex_t. librtpi-pthread keeps the words in
+ * the storage of pthread_cond_t and pthread_mutex_t, which have neither the
+ * size nor the alignment of the librtpi types, and calls the entry points
+ * below directly. They are exported for it, but are not part of the API.
+ */
+
+/**
+ * struct pi_cond_words - the words of a condition variable
+ * @cond: sequence the waiters sleep on, bumped for every wakeup
+ * @state: waiter count in the high half, granted wakeups in the low half
+ * @flags: RTPI_COND_* flags
+ */
+struct pi_cond_words {
+	__u32	*cond;
+	__u64	*state;
+	__u32	flags;
+};
+
+/**
+ * struct pi_cond_lock - the mutex a condvar waiter releases and reacquires
+ * @futex: PI futex word the waiters are requeued to
+ * @mutex: argument of the callbacks
+ * @lock: reacquire the mutex after a wakeup not handed over by the kernel
+ * @unlock: release the mutex before sleeping
+ * @handover: account the mutex acquired by requeue, may be NULL
+ */
+struct pi_cond_lock {
+	__u32	*futex;
+	void	*mutex;
+	int	(*lock)(void *mutex);
+	int	(*unlock)(void *mutex);
+	void	(*handover)(void *mutex);
+};
+
+/**
+ * pi_cond_words_wait() - wait on a condition variable
+ * @cw: condition variable words
+ * @lk: mutex held by the caller
+ * @abstime: absolute timeout, or NULL to wait forever
+ * @realtime: whether abstime is against CLOCK_REALTIME
+ */
+int pi_cond_words_wait(const struct pi_cond_words *cw,
+		       const struct pi_cond_lock *lk,
+		       const struct timespec *abstime, bool realtime);
+
+/**
+ * pi_cond_words_wake() - wake up to n waiters of a condition variable
+ * @cw: condition variable words
+ * @futex: PI futex word of the mutex, held by the caller
+ * @n: maximum number of waiters to wake
+ */
+int pi_cond_words_wake(const struct pi_cond_words *cw, __u32 *futex, __u32 n);
+
+/**
+ * pi_cond_words_destroy() - prepare a condition variable for destruction
+ * @cw: condition variable words
+ *
+ * Returns EBUSY if waiters are blocked without a wakeup. Otherwise waits
+ * until the waiters granted one no longer touch the words, which requires
+ * that the mutex they reacquire is not held by the caller.
+ */
+int pi_cond_words_destroy(const struct pi_cond_words *cw);
+
+#endif // PI_COND_H
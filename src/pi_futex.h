@@ -1,11 +1,72 @@
 #ifndef PI_FUTEX_H
 #define PI_FUTEX_H
 
+#include <stdbool.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <linux/futex.h>
 
+#ifndef FUTEX_LOCK_PI2
+#define FUTEX_LOCK_PI2		13
+#endif
+
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv		449
+#endif
+
+/* Capabilities of the running kernel, RTPI_CAP_* plus FUTEX_CAPS_PROBED */
+#define FUTEX_CAPS_PROBED	(1U << 31)
+
+extern __u32 futex_caps __attribute__ ((visibility("hidden")));
+
+__u32 futex_probe(void) __attribute__ ((visibility("hidden")));
+
+/* TID of the calling thread once looked up, cleared in the child of fork() */
+extern __thread pid_t futex_tid_cache
+	__attribute__ ((visibility("hidden"), tls_model("initial-exec")));
+
+/**
+ * futex_tid() - TID of the calling thread, as stored in an owned PI futex
+ *
+ * The library's own paths use this rather than the exported pi_gettid().
+ */
+static inline pid_t futex_tid(void)
+{
+	if (__builtin_expect(!futex_tid_cache, 0))
+		futex_tid_cache = syscall(SYS_gettid);
+	return futex_tid_cache;
+}
+
+/**
+ * futex_has() - check for a capability of the running kernel
+ * @cap: RTPI_CAP_* bit
+ *
+ * Probes the kernel if called before the library constructor has run.
+ */
+static inline bool futex_has(__u32 cap)
+{
+	__u32 caps = __atomic_load_n(&futex_caps, __ATOMIC_RELAXED);
+
+	if (__builtin_expect(!caps, 0))
+		caps = futex_probe();
+	return caps & cap;
+}
+
+/**
+ * cpu_relax() - pause briefly inside a spin loop
+ */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
 static inline __u32 get_op(__u32 op, __u32 mod)
 {
 	if (!(mod & RTPI_MUTEX_PSHARED))
@@ -30,27 +91,84 @@ static inline int sys_futex(__u32 *uaddr, int op, __u32 val,
 }
 
 /**
- * futex_lock_pi() - block on a PI mutex
- * @mutex: PI mutex to block on
+ * futex_wait() - block while a plain futex word holds the expected value
+ * @uaddr: futex word
+ * @val: expected value of uaddr
+ * @utime: absolute CLOCK_MONOTONIC timeout, or NULL to block indefinitely
+ * @flags: RTPI_*_PSHARED flags of the owning object
  */
-static inline int futex_lock_pi(pi_mutex_t *mutex)
+static inline int futex_wait(__u32 *uaddr, __u32 val,
+			     const struct timespec *utime, __u32 flags)
 {
-	return sys_futex(&mutex->futex,
-			 get_op(FUTEX_LOCK_PI, mutex->flags),
+	return sys_futex(uaddr,
+			 get_op(FUTEX_WAIT_BITSET, flags),
+			 val,
+			 utime,
+			 NULL,                     /* uaddr2 unused */
+			 FUTEX_BITSET_MATCH_ANY);
+}
+
+/**
+ * futex_wake() - wake waiters blocked in futex_wait()
+ * @uaddr: futex word
+ * @nr_wake: number of waiters to wake
+ * @flags: RTPI_*_PSHARED flags of the owning object
+ */
+static inline int futex_wake(__u32 *uaddr, int nr_wake, __u32 flags)
+{
+	return sys_futex(uaddr,
+			 get_op(FUTEX_WAKE, flags),
+			 nr_wake,
+			 NULL, /* timeout unused */
+			 NULL, /* uaddr2 unused */
+			 0);   /* val3 unused */
+}
+
+/**
+ * futex_lock_pi() - block on a PI futex
+ * @uaddr: PI futex word of the mutex
+ * @flags: RTPI_MUTEX_* flags of the mutex
+ * @utime: absolute CLOCK_REALTIME timeout, or NULL to block indefinitely
+ */
+static inline int futex_lock_pi(__u32 *uaddr, __u32 flags,
+				const struct timespec *utime)
+{
+	return sys_futex(uaddr,
+			 get_op(FUTEX_LOCK_PI, flags),
+			 0,    /* deadlock detection (no) */
+			 utime,
+			 NULL, /* uaddr2 unused */
+			 0);   /* val3 unused */
+}
+
+/**
+ * futex_lock_pi2() - block on a PI futex with a CLOCK_MONOTONIC timeout
+ * @uaddr: PI futex word of the mutex
+ * @flags: RTPI_MUTEX_* flags of the mutex
+ * @utime: absolute CLOCK_MONOTONIC timeout, or NULL to block indefinitely
+ *
+ * Available since Linux 5.14, fails with ENOSYS on older kernels.
+ */
+static inline int futex_lock_pi2(__u32 *uaddr, __u32 flags,
+				 const struct timespec *utime)
+{
+	return sys_futex(uaddr,
+			 get_op(FUTEX_LOCK_PI2, flags),
 			 0,    /* deadlock detection (no) */
-			 NULL, /* timeout (none) */
+			 utime,
 			 NULL, /* uaddr2 unused */
 			 0);   /* val3 unused */
 }
 
 /**
- * futex_unlock_pi() - release PI mutex, wake the top waiter
- * @mutex: PI mutex to release
+ * futex_unlock_pi() - release PI futex, wake the top waiter
+ * @uaddr: PI futex word of the mutex
+ * @flags: RTPI_MUTEX_* flags of the mutex
  */
-static inline int futex_unlock_pi(pi_mutex_t *mutex)
+static inline int futex_unlock_pi(__u32 *uaddr, __u32 flags)
 {
-	return sys_futex(&mutex->futex,
-			 get_op(FUTEX_UNLOCK_PI, mutex->flags),
+	return sys_futex(uaddr,
+			 get_op(FUTEX_UNLOCK_PI, flags),
 			 0,    /* deadlock detection unused */
 			 NULL, /* timeout unused */
 			 NULL, /* uaddr2 unused */
@@ -59,39 +177,73 @@ static inline int futex_unlock_pi(pi_mutex_t *mutex)
 
 /**
  * futex_wait_requeue_pi() - wait on a condition variable, setup for requeue PI
- * @cond: condition variable to wait on (containing non-PI futex)
+ * @cond: condition variable futex to wait on (non-PI)
+ * @flags: condition variable flags
  * @val: expected value of condition variable futex
  * @utime: absolute timeout
- * @mutex: PI mutex containing PI futex target
+ * @realtime: utime is against CLOCK_REALTIME rather than CLOCK_MONOTONIC
+ * @mutex: PI futex of the mutex to requeue to
  */
-static inline int futex_wait_requeue_pi(pi_cond_t *cond, __u32 val,
+static inline int futex_wait_requeue_pi(__u32 *cond, __u32 flags, __u32 val,
 					const struct timespec *utime,
-					pi_mutex_t *mutex)
+					bool realtime, __u32 *mutex)
 {
-	return sys_futex(&cond->cond,
-			 get_op(FUTEX_WAIT_REQUEUE_PI, cond->flags),
+	__u32 op = get_op(FUTEX_WAIT_REQUEUE_PI, flags);
+
+	if (realtime)
+		op |= FUTEX_CLOCK_REALTIME;
+	return sys_futex(cond,
+			 op,
 			 val,
 			 utime,
-			 &mutex->futex,
+			 mutex,
 			 0);            /* val3 unused */
 }
 
 /**
  * futex_cmp_requeue_pi() - requeue from condition variable to PI mutex
- * @cond: condition variable to requeue from (containing non-PI futex)
+ * @cond: condition variable futex to requeue from (non-PI)
+ * @flags: condition variable flags
  * @val: expected value of cond futex (ignored, assumed to be 1, forcing syscall)
  * @nr_requeue: number of waiters to requeue
- * @mutex: PI mutex to requeue to (containing PI futex)
+ * @mutex: PI futex of the mutex to requeue to
  */
-static inline int futex_cmp_requeue_pi(pi_cond_t *cond, __u32 val,
-				       __u32 nr_requeue, pi_mutex_t *mutex)
+static inline int futex_cmp_requeue_pi(__u32 *cond, __u32 flags, __u32 val,
+				       __u32 nr_requeue, __u32 *mutex)
 {
-	return sys_futex(&cond->cond,
-			 get_op(FUTEX_CMP_REQUEUE_PI, cond->flags),
+	return sys_futex(cond,
+			 get_op(FUTEX_CMP_REQUEUE_PI, flags),
 			 1,                        /* nr_wake */
 			 (void *)(long)nr_requeue,
-			 &mutex->futex,
+			 mutex,
 			 val);
 }
 
+/**
+ * futex_deadline() - turn a relative timeout into a CLOCK_MONOTONIC deadline
+ * @reltime: relative timeout, negative values are taken as zero
+ * @abstime: returns the absolute deadline
+ *
+ * The futex PI operations only take absolute timeouts. Callers compute the
+ * deadline once, so that retries do not extend the timeout. Returns 0 or
+ * EINVAL.
+ */
+static inline int futex_deadline(const struct timespec *reltime,
+				 struct timespec *abstime)
+{
+	if (reltime->tv_nsec < 0 || reltime->tv_nsec >= 1000000000)
+		return EINVAL;
+
+	clock_gettime(CLOCK_MONOTONIC, abstime);
+	if (reltime->tv_sec < 0)
+		return 0;
+	abstime->tv_sec += reltime->tv_sec;
+	abstime->tv_nsec += reltime->tv_nsec;
+	if (abstime->tv_nsec >= 1000000000) {
+		abstime->tv_sec++;
+		abstime->tv_nsec -= 1000000000;
+	}
+	return 0;
+}
+
 #endif
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#include <string.h>
+#include <sys/mman.h>
+#include "rtpi.h"
+
+/*
+ * pi_lock_table_alloc() maps the table header and its stripes together:
+ * the header takes the first cache line, the stripes follow it.
+ */
+#define TABLE_HEADER	sizeof(pi_mutex_t)
+
+static size_t table_size(size_t nr_stripes)
+{
+	return TABLE_HEADER + nr_stripes * sizeof(pi_mutex_t);
+}
+
+int pi_lock_table_init(pi_lock_table_t *table, pi_mutex_t *stripes,
+		       size_t nr_stripes, uint32_t flags)
+{
+	size_t i;
+	int ret;
+
+	/* Check for unknown options and a power of two stripe count */
+	if (flags & ~RTPI_MUTEX_PSHARED)
+		return EINVAL;
+	if (!nr_stripes || (nr_stripes & (nr_stripes - 1)) ||
+	    nr_stripes > 1UL << 31)
+		return EINVAL;
+
+	for (i = 0; i < nr_stripes; i++) {
+		ret = pi_mutex_init(&stripes[i], flags);
+		if (ret)
+			return ret;
+	}
+	table->stripes = stripes;
+	table->bits = __builtin_ctzl(nr_stripes);
+	table->flags = flags;
+	return 0;
+}
+
+int pi_lock_table_destroy(pi_lock_table_t *table)
+{
+	size_t i;
+
+	for (i = 0; i < 1UL << table->bits; i++)
+		pi_mutex_destroy(&table->stripes[i]);
+	memset(table, 0, sizeof(*table));
+	return 0;
+}
+
+pi_lock_table_t *pi_lock_table_alloc(size_t nr_stripes, uint32_t flags)
+{
+	pi_lock_table_t *table;
+	char *mem;
+	int ret;
+
+	if (!nr_stripes || nr_stripes > 1UL << 31) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	mem = mmap(NULL, table_size(nr_stripes), PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	table = (pi_lock_table_t *)mem;
+	ret = pi_lock_table_init(table, (pi_mutex_t *)(mem + TABLE_HEADER),
+				 nr_stripes, flags);
+	if (ret) {
+		munmap(mem, table_size(nr_stripes));
+		errno = ret;
+		return NULL;
+	}
+	return table;
+}
+
+void pi_lock_table_free(pi_lock_table_t *table)
+{
+	size_t nr_stripes;
+
+	if (!table)
+		return;
+	nr_stripes = 1UL << table->bits;
+	pi_lock_table_destroy(table);
+	munmap(table, table_size(nr_stripes));
+}
+
+int pi_lock_table_lock(pi_lock_table_t *table, uintptr_t key)
+{
+	return pi_mutex_lock(pi_lock_table_mutex(table, key));
+}
+
+int pi_lock_table_trylock(pi_lock_table_t *table, uintptr_t key)
+{
+	return pi_mutex_trylock(pi_lock_table_mutex(table, key));
+}
+
+int pi_lock_table_unlock(pi_lock_table_t *table, uintptr_t key)
+{
+	return pi_mutex_unlock(pi_lock_table_mutex(table, key));
+}
+
+/**
+ * table_stripes() - sorted, deduplicated stripe indices of a set of keys
+ * @table: lock table
+ * @keys: keys to look up
+ * @n: number of keys, at most RTPI_LOCK_TABLE_MAX_KEYS
+ * @idx: returns the stripe indices in ascending order
+ *
+ * Locking stripes in ascending index order is the canonical order that
+ * keeps concurrent multi-key lockers from deadlocking. Returns the number of
+ * distinct stripes.
+ */
+static size_t table_stripes(const pi_lock_table_t *table, const uintptr_t *keys,
+			    size_t n, size_t *idx)
+{
+	size_t i, j, nr = 0, v;
+
+	for (i = 0; i < n; i++) {
+		v = pi_lock_table_index(table, keys[i]);
+		for (j = 0; j < nr && idx[j] < v; j++)
+			;
+		if (j < nr && idx[j] == v)
+			continue;
+		memmove(&idx[j + 1], &idx[j], (nr - j) * sizeof(*idx));
+		idx[j] = v;
+		nr++;
+	}
+	return nr;
+}
+
+int pi_lock_table_lock_n(pi_lock_table_t *table, const uintptr_t *keys,
+			 size_t n)
+{
+	size_t idx[RTPI_LOCK_TABLE_MAX_KEYS];
+	size_t i, nr;
+	int ret;
+
+	if (n > RTPI_LOCK_TABLE_MAX_KEYS)
+		return EINVAL;
+
+	nr = table_stripes(table, keys, n, idx);
+	for (i = 0; i < nr; i++) {
+		ret = pi_mutex_lock(&table->stripes[idx[i]]);
+		if (ret) {
+			while (i--)
+				pi_mutex_unlock(&table->stripes[idx[i]]);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int pi_lock_table_unlock_n(pi_lock_table_t *table, const uintptr_t *keys,
+			   size_t n)
+{
+	size_t idx[RTPI_LOCK_TABLE_MAX_KEYS];
+	size_t nr;
+	int ret, err = 0;
+
+	if (n > RTPI_LOCK_TABLE_MAX_KEYS)
+		return EINVAL;
+
+	nr = table_stripes(table, keys, n, idx);
+	while (nr--) {
+		ret = pi_mutex_unlock(&table->stripes[idx[nr]]);
+		if (ret && !err)
+			err = ret;
+	}
+	return err;
+}
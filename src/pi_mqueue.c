@@ -0,0 +1,387 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "rtpi.h"
+
+/*
+ * All bookkeeping is done under mq->lock, which stays uncontended unless
+ * senders or receivers collide, so a message costs two lock round trips on
+ * each side and no copy. Slots are either on the free stack, reserved by a
+ * sender, on the list of their priority, or acquired by a receiver; the next
+ * links of the stack and of the lists share one array. prio_map has a bit
+ * per non-empty list, so the highest priority message is found with one
+ * count of leading zeros.
+ *
+ * Receivers sleep on not_empty and senders on not_full. pi_cond_signal()
+ * hands the wakeup to the highest priority sleeper, and it does not enter
+ * the kernel when nobody sleeps.
+ */
+#define MQ_NIL			UINT32_MAX
+#define MQ_ALIGN		64
+
+_Static_assert(sizeof(((pi_mqueue_t *)0)->queue) ==
+	       RTPI_MQUEUE_PRIO_MAX * sizeof(struct pi_mqueue_list),
+	       "one list per message priority");
+
+static inline __u32 *mq_next(pi_mqueue_t *mq)
+{
+	return (__u32 *)(mq + 1);
+}
+
+static inline char *mq_slot(pi_mqueue_t *mq, __u32 idx)
+{
+	return (char *)mq + mq->data_off + (size_t)idx * mq->stride;
+}
+
+static size_t mq_data_off(size_t nr)
+{
+	return (sizeof(pi_mqueue_t) + nr * sizeof(__u32) + MQ_ALIGN - 1) &
+	       ~(size_t)(MQ_ALIGN - 1);
+}
+
+static size_t mq_stride(size_t msg_size)
+{
+	return (msg_size + MQ_ALIGN - 1) & ~(size_t)(MQ_ALIGN - 1);
+}
+
+static bool mq_geometry_valid(size_t nr, size_t msg_size)
+{
+	if (!nr || nr >= MQ_NIL || !msg_size || msg_size > UINT32_MAX / 2)
+		return false;
+	/* data_off is kept in 32 bits */
+	if (nr > (UINT32_MAX - sizeof(pi_mqueue_t) - MQ_ALIGN) / sizeof(__u32))
+		return false;
+	return nr <= (SIZE_MAX - mq_data_off(nr)) / mq_stride(msg_size);
+}
+
+size_t pi_mqueue_size(size_t nr, size_t msg_size)
+{
+	if (!mq_geometry_valid(nr, msg_size))
+		return 0;
+	return mq_data_off(nr) + nr * mq_stride(msg_size);
+}
+
+int pi_mqueue_init(pi_mqueue_t *mq, size_t nr, size_t msg_size,
+		   uint32_t flags)
+{
+	__u32 i, *next;
+	int ret;
+
+	/* Check for unknown options */
+	if (flags & ~RTPI_MQUEUE_PSHARED)
+		return EINVAL;
+	if (!mq_geometry_valid(nr, msg_size))
+		return EINVAL;
+
+	memset(mq, 0, sizeof(*mq));
+	ret = pi_mutex_init(&mq->lock, flags);
+	if (ret)
+		return ret;
+	ret = pi_cond_init(&mq->not_empty, flags);
+	if (ret)
+		return ret;
+	ret = pi_cond_init(&mq->not_full, flags);
+	if (ret)
+		return ret;
+	mq->nr = nr;
+	mq->msg_size = msg_size;
+	mq->stride = mq_stride(msg_size);
+	mq->flags = flags;
+	mq->data_off = mq_data_off(nr);
+
+	/* Hand out low slots first, they are the ones most likely cached */
+	next = mq_next(mq);
+	for (i = 0; i < nr; i++)
+		next[i] = i + 1 < nr ? i + 1 : MQ_NIL;
+	mq->free = 0;
+	for (i = 0; i < RTPI_MQUEUE_PRIO_MAX; i++)
+		mq->queue[i].head = mq->queue[i].tail = MQ_NIL;
+	return 0;
+}
+
+int pi_mqueue_destroy(pi_mqueue_t *mq)
+{
+	pi_cond_destroy(&mq->not_full);
+	pi_cond_destroy(&mq->not_empty);
+	pi_mutex_destroy(&mq->lock);
+	memset(mq, 0, sizeof(*mq));
+	return 0;
+}
+
+pi_mqueue_t *pi_mqueue_alloc(size_t nr, size_t msg_size, uint32_t flags)
+{
+	size_t size = pi_mqueue_size(nr, msg_size);
+	pi_mqueue_t *mq;
+	int ret;
+
+	if (!size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	mq = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (mq == MAP_FAILED)
+		return NULL;
+
+	ret = pi_mqueue_init(mq, nr, msg_size, flags);
+	if (ret) {
+		munmap(mq, size);
+		errno = ret;
+		return NULL;
+	}
+	return mq;
+}
+
+void pi_mqueue_free(pi_mqueue_t *mq)
+{
+	size_t size;
+
+	if (!mq)
+		return;
+	size = mq->data_off + (size_t)mq->nr * mq->stride;
+	pi_mqueue_destroy(mq);
+	munmap(mq, size);
+}
+
+/**
+ * mq_index() - find the slot of a message buffer
+ * @mq: message queue
+ * @msg: buffer returned by pi_mqueue_reserve() or pi_mqueue_acquire()
+ *
+ * Returns the slot index, or MQ_NIL if msg is not the start of a slot.
+ */
+static __u32 mq_index(pi_mqueue_t *mq, void *msg)
+{
+	size_t off = (char *)msg - mq_slot(mq, 0);
+
+	if ((char *)msg < mq_slot(mq, 0) || off % mq->stride ||
+	    off / mq->stride >= mq->nr)
+		return MQ_NIL;
+	return off / mq->stride;
+}
+
+/* Called with mq->lock held */
+static __u32 mq_pop_free(pi_mqueue_t *mq)
+{
+	__u32 idx = mq->free;
+
+	if (idx != MQ_NIL)
+		mq->free = mq_next(mq)[idx];
+	return idx;
+}
+
+/* Called with mq->lock held */
+static void mq_push_free(pi_mqueue_t *mq, __u32 idx)
+{
+	mq_next(mq)[idx] = mq->free;
+	mq->free = idx;
+}
+
+/* Called with mq->lock held, returns MQ_NIL if the queue is empty */
+static __u32 mq_dequeue(pi_mqueue_t *mq, unsigned int *prio)
+{
+	struct pi_mqueue_list *list;
+	unsigned int p;
+	__u32 idx;
+
+	if (!mq->prio_map)
+		return MQ_NIL;
+	p = 31 - __builtin_clz(mq->prio_map);
+	list = &mq->queue[p];
+	idx = list->head;
+	list->head = mq_next(mq)[idx];
+	if (list->head == MQ_NIL) {
+		list->tail = MQ_NIL;
+		mq->prio_map &= ~(1U << p);
+	}
+	if (prio)
+		*prio = p;
+	return idx;
+}
+
+/**
+ * mq_reserve() - take a free slot for a new message
+ * @mq: message queue
+ * @wait: sleep while no slot is free, rather than fail with EAGAIN
+ */
+static void *mq_reserve(pi_mqueue_t *mq, bool wait)
+{
+	__u32 idx;
+	int ret;
+
+	ret = pi_mutex_lock(&mq->lock);
+	if (ret)
+		goto err;
+	while ((idx = mq_pop_free(mq)) == MQ_NIL) {
+		ret = wait ? pi_cond_wait(&mq->not_full, &mq->lock) : EAGAIN;
+		if (ret) {
+			pi_mutex_unlock(&mq->lock);
+			goto err;
+		}
+	}
+	pi_mutex_unlock(&mq->lock);
+	return mq_slot(mq, idx);
+err:
+	errno = ret;
+	return NULL;
+}
+
+void *pi_mqueue_reserve(pi_mqueue_t *mq)
+{
+	return mq_reserve(mq, true);
+}
+
+void *pi_mqueue_tryreserve(pi_mqueue_t *mq)
+{
+	return mq_reserve(mq, false);
+}
+
+int pi_mqueue_commit(pi_mqueue_t *mq, void *msg, unsigned int prio)
+{
+	__u32 idx = mq_index(mq, msg);
+	struct pi_mqueue_list *list;
+	int ret;
+
+	if (idx == MQ_NIL || prio >= RTPI_MQUEUE_PRIO_MAX)
+		return EINVAL;
+
+	ret = pi_mutex_lock(&mq->lock);
+	if (ret)
+		return ret;
+	list = &mq->queue[prio];
+	mq_next(mq)[idx] = MQ_NIL;
+	if (list->tail == MQ_NIL)
+		list->head = idx;
+	else
+		mq_next(mq)[list->tail] = idx;
+	list->tail = idx;
+	mq->prio_map |= 1U << prio;
+	ret = pi_cond_signal(&mq->not_empty, &mq->lock);
+	pi_mutex_unlock(&mq->lock);
+	return ret;
+}
+
+/**
+ * mq_acquire() - take up to nr messages, highest priority first
+ * @mq: message queue
+ * @msgs: receives the message buffers
+ * @prios: receives the message priorities, may be NULL
+ * @nr: in: room in msgs and prios, at least 1; out: messages taken
+ * @wait: sleep while the queue is empty, rather than fail with EAGAIN
+ */
+static int mq_acquire(pi_mqueue_t *mq, void **msgs, unsigned int *prios,
+		      unsigned int *nr, bool wait)
+{
+	unsigned int n;
+	__u32 idx;
+	int ret;
+
+	ret = pi_mutex_lock(&mq->lock);
+	if (ret)
+		return ret;
+	while (!mq->prio_map) {
+		ret = wait ? pi_cond_wait(&mq->not_empty, &mq->lock) : EAGAIN;
+		if (ret) {
+			pi_mutex_unlock(&mq->lock);
+			return ret;
+		}
+	}
+	for (n = 0; n < *nr; n++) {
+		idx = mq_dequeue(mq, prios ? &prios[n] : NULL);
+		if (idx == MQ_NIL)
+			break;
+		msgs[n] = mq_slot(mq, idx);
+	}
+	pi_mutex_unlock(&mq->lock);
+	*nr = n;
+	return 0;
+}
+
+void *pi_mqueue_acquire(pi_mqueue_t *mq, unsigned int *prio)
+{
+	unsigned int nr = 1;
+	void *msg;
+	int ret;
+
+	ret = mq_acquire(mq, &msg, prio, &nr, true);
+	if (ret) {
+		errno = ret;
+		return NULL;
+	}
+	return msg;
+}
+
+void *pi_mqueue_tryacquire(pi_mqueue_t *mq, unsigned int *prio)
+{
+	unsigned int nr = 1;
+	void *msg;
+	int ret;
+
+	ret = mq_acquire(mq, &msg, prio, &nr, false);
+	if (ret) {
+		errno = ret;
+		return NULL;
+	}
+	return msg;
+}
+
+int pi_mqueue_acquire_batch(pi_mqueue_t *mq, void **msgs,
+			    unsigned int *prios, unsigned int *nr)
+{
+	if (!*nr)
+		return EINVAL;
+	return mq_acquire(mq, msgs, prios, nr, true);
+}
+
+int pi_mqueue_release_batch(pi_mqueue_t *mq, void **msgs, unsigned int nr)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nr; i++) {
+		if (mq_index(mq, msgs[i]) == MQ_NIL)
+			return EINVAL;
+	}
+
+	ret = pi_mutex_lock(&mq->lock);
+	if (ret)
+		return ret;
+	for (i = 0; i < nr; i++)
+		mq_push_free(mq, mq_index(mq, msgs[i]));
+	ret = pi_cond_signal_n(&mq->not_full, &mq->lock, nr);
+	pi_mutex_unlock(&mq->lock);
+	return ret;
+}
+
+int pi_mqueue_release(pi_mqueue_t *mq, void *msg)
+{
+	return pi_mqueue_release_batch(mq, &msg, 1);
+}
+
+int pi_mqueue_send(pi_mqueue_t *mq, const void *msg, unsigned int prio)
+{
+	void *slot;
+
+	if (prio >= RTPI_MQUEUE_PRIO_MAX)
+		return EINVAL;
+	slot = pi_mqueue_reserve(mq);
+	if (!slot)
+		return errno;
+	memcpy(slot, msg, mq->msg_size);
+	return pi_mqueue_commit(mq, slot, prio);
+}
+
+int pi_mqueue_receive(pi_mqueue_t *mq, void *msg, unsigned int *prio)
+{
+	void *slot;
+
+	slot = pi_mqueue_acquire(mq, prio);
+	if (!slot)
+		return errno;
+	memcpy(msg, slot, mq->msg_size);
+	return pi_mqueue_release(mq, slot);
+}
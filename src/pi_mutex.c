@@ -3,28 +3,57 @@
 
 #include "rtpi.h"
 #include "pi_futex.h"
+#include "pi_protect.h"
+#include "pi_slab.h"
+#include "pi_stats.h"
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <string.h>
 
-static pid_t gettid(void)
+__thread pid_t futex_tid_cache __attribute__ ((tls_model("initial-exec")));
+
+/*
+ * The child of fork() inherits the TLS of the forking thread, including its
+ * cached TID, and would take its parent's locks for its own.
+ */
+static void tid_atfork_child(void)
 {
-	static __thread pid_t tid_this_thread;
+	futex_tid_cache = 0;
+}
 
-	if (tid_this_thread)
-		return tid_this_thread;
+__attribute__((constructor)) static void tid_init(void)
+{
+	pthread_atfork(NULL, NULL, tid_atfork_child);
+}
 
-	tid_this_thread = syscall(SYS_gettid);
-	return tid_this_thread;
+pid_t pi_gettid(void)
+{
+	return futex_tid();
 }
 
 pi_mutex_t *pi_mutex_alloc(void)
 {
-	return malloc(sizeof(pi_mutex_t));
+	return pi_slab_alloc(&pi_slab_64);
+}
+
+int pi_mutex_alloc_bulk(pi_mutex_t **mutexes, size_t n)
+{
+	return pi_slab_alloc_bulk(&pi_slab_64, (void **)mutexes, n);
 }
 
 void pi_mutex_free(pi_mutex_t *mutex)
 {
-	free(mutex);
+	pi_slab_free(&pi_slab_64, mutex);
+}
+
+static bool mutex_ceiling_valid(uint32_t flags)
+{
+	int ceiling = (flags & RTPI_MUTEX_CEILING_MASK) >>
+		      RTPI_MUTEX_CEILING_SHIFT;
+
+	return ceiling >= sched_get_priority_min(SCHED_FIFO) &&
+	       ceiling <= sched_get_priority_max(SCHED_FIFO);
 }
 
 int pi_mutex_init(pi_mutex_t *mutex, uint32_t flags)
@@ -35,13 +64,22 @@ int pi_mutex_init(pi_mutex_t *mutex, uint32_t flags)
 	memset(mutex, 0, sizeof(*mutex));
 
 	/* Check for unknown options */
-	if (flags & ~(RTPI_MUTEX_PSHARED)) {
+	if (flags & ~(RTPI_MUTEX_PSHARED | RTPI_MUTEX_ADAPTIVE |
+		      RTPI_MUTEX_STATS | RTPI_MUTEX_HYBRID |
+		      RTPI_MUTEX_PROTECT | RTPI_MUTEX_CEILING_MASK)) {
 		ret = EINVAL;
 		goto out;
 	}
 
-	if (flags & RTPI_MUTEX_PSHARED)
-		mutex->flags = RTPI_MUTEX_PSHARED;
+	/* A ceiling is a SCHED_FIFO priority, and only goes with PROTECT */
+	if ((flags & RTPI_MUTEX_PROTECT) ?
+		    !mutex_ceiling_valid(flags) :
+		    (flags & RTPI_MUTEX_CEILING_MASK) != 0) {
+		ret = EINVAL;
+		goto out;
+	}
+
+	mutex->flags = flags;
 	ret = 0;
 out:
 	return ret;
@@ -53,46 +91,424 @@ int pi_mutex_destroy(pi_mutex_t *mutex)
 	return 0;
 }
 
-int pi_mutex_lock(pi_mutex_t *mutex)
+/*
+ * Upper bound on the spin budget of an RTPI_MUTEX_ADAPTIVE mutex, in
+ * iterations of the spin loop.
+ */
+#define MAX_ADAPTIVE_COUNT	100
+
+/**
+ * mutex_spin() - spin for an adaptive mutex before blocking in the kernel
+ * @mutex: PI mutex to acquire
+ *
+ * Spins for up to twice the learned budget in mutex->spins, then folds the
+ * iterations actually needed back into it, as glibc does for
+ * PTHREAD_MUTEX_ADAPTIVE_NP. Spinning stops early once the mutex has kernel
+ * waiters, as FUTEX_UNLOCK_PI then hands it to the top waiter directly.
+ *
+ * Returns 0 if the mutex was acquired, EBUSY otherwise.
+ */
+static int mutex_spin(pi_mutex_t *mutex)
 {
-	int ret;
+	__u32 spins, max, cnt = 0;
+	__u32 futex, pid;
+	int ret = EBUSY;
 
-	ret = pi_mutex_trylock(mutex);
-	if (!ret || ret == EDEADLOCK)
-		return ret;
-	return (futex_lock_pi(mutex)) ? errno : 0;
+	spins = __atomic_load_n(&mutex->spins, __ATOMIC_RELAXED);
+	max = spins * 2 + 10;
+	if (max > MAX_ADAPTIVE_COUNT)
+		max = MAX_ADAPTIVE_COUNT;
+
+	pid = futex_tid();
+	while (++cnt < max) {
+		cpu_relax();
+		futex = __atomic_load_n(&mutex->futex, __ATOMIC_RELAXED);
+		if (futex & FUTEX_WAITERS)
+			break;
+		if (!futex &&
+		    __atomic_compare_exchange_n(&mutex->futex, &futex, pid,
+						false, __ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED)) {
+			ret = 0;
+			break;
+		}
+	}
+
+	__atomic_store_n(&mutex->spins, spins + ((int)(cnt - spins)) / 8,
+			 __ATOMIC_RELAXED);
+	return ret;
+}
+
+/*
+ * The helpers below operate on the bare futex word and flags, so that
+ * pi_mutex_t and pi_mutex_compact_t share them.
+ */
+
+/**
+ * word_block() - block in the kernel until the PI futex is acquired
+ * @futex: PI futex word of the mutex
+ * @flags: RTPI_MUTEX_* flags of the mutex
+ * @abstime: CLOCK_MONOTONIC deadline, or NULL to wait forever
+ */
+static int word_block(__u32 *futex, __u32 flags,
+		      const struct timespec *abstime)
+{
+	struct timespec mono, real, ts;
+
+	if (!abstime)
+		return (futex_lock_pi(futex, flags, NULL)) ? errno : 0;
+
+	if (futex_has(RTPI_CAP_LOCK_PI2)) {
+		if (!futex_lock_pi2(futex, flags, abstime))
+			return 0;
+		if (errno != ENOSYS)
+			return errno;
+		/* Filtered out after the probe, e.g. by seccomp */
+		__atomic_and_fetch(&futex_caps, ~RTPI_CAP_LOCK_PI2,
+				   __ATOMIC_RELAXED);
+	}
+
+	/*
+	 * FUTEX_LOCK_PI only takes a CLOCK_REALTIME deadline. Translate the
+	 * remaining monotonic time onto it; a wall clock step while blocked
+	 * shifts the timeout accordingly.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	ts.tv_sec = real.tv_sec + abstime->tv_sec - mono.tv_sec;
+	ts.tv_nsec = real.tv_nsec + abstime->tv_nsec - mono.tv_nsec;
+	if (ts.tv_nsec < 0) {
+		ts.tv_sec--;
+		ts.tv_nsec += 1000000000;
+	} else if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return (futex_lock_pi(futex, flags, &ts)) ? errno : 0;
 }
 
 #define FUTEX_TID_MASK          0x3fffffff
 
-int pi_mutex_trylock(pi_mutex_t *mutex)
+static int word_trylock(__u32 *futex)
 {
 	pid_t pid;
+	__u32 unlocked = 0;
 	bool ret;
 
-	pid = gettid();
-	if (pid == (mutex->futex & FUTEX_TID_MASK))
+	pid = futex_tid();
+	if (pid == (*futex & FUTEX_TID_MASK))
 		return EDEADLOCK;
 
-	ret = __sync_bool_compare_and_swap(&mutex->futex,
-					   0, pid);
+	ret = __atomic_compare_exchange_n(futex, &unlocked, pid, false,
+					  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
 	if (!ret)
 		return EBUSY;
 	return 0;
 }
 
-int pi_mutex_unlock(pi_mutex_t *mutex)
+static int word_check_owner(__u32 *futex)
 {
-	pid_t pid;
-	bool ret;
-
-	pid = gettid();
-	if (pid != (mutex->futex & FUTEX_TID_MASK))
+	if (futex_tid() != (*futex & FUTEX_TID_MASK))
 		return EPERM;
+	return 0;
+}
+
+static int word_unlock(__u32 *futex, __u32 flags)
+{
+	__u32 locked = futex_tid();
+	bool ret;
 
-	ret = __sync_bool_compare_and_swap(&mutex->futex,
-					   pid, 0);
+	ret = __atomic_compare_exchange_n(futex, &locked, 0, false,
+					  __ATOMIC_RELEASE, __ATOMIC_RELAXED);
 	if (ret == true)
 		return 0;
-	return (futex_unlock_pi(mutex)) ? errno : 0;
+	return (futex_unlock_pi(futex, flags)) ? errno : 0;
+}
+
+/*
+ * An RTPI_MUTEX_HYBRID mutex keeps the owner TID protocol of the PI futex
+ * word, but SCHED_OTHER contenders sleep with FUTEX_WAIT on mutex->hwait
+ * rather than in FUTEX_LOCK_PI, sparing the kernel its rt_mutex and pi_state
+ * when priority inheritance buys nothing. The kernel refuses to mix PI and
+ * non-PI waiters on one futex word, hence the second word: its low 16 bits
+ * count the sleepers and its upper 16 bits are a sequence bumped by every
+ * wakeup. A real-time contender blocks in FUTEX_LOCK_PI as usual, which
+ * boosts the owner however it took the mutex and has FUTEX_UNLOCK_PI hand
+ * the mutex over to it ahead of the sleepers.
+ */
+#define HYBRID_SLEEPER		0x1
+#define HYBRID_SLEEPERS		0xffff
+#define HYBRID_SEQ		0x10000
+
+/**
+ * hybrid_wake() - wake a SCHED_OTHER sleeper of a hybrid mutex, if any
+ * @mutex: RTPI_MUTEX_HYBRID mutex the caller just released
+ *
+ * The release and the load of hwait are sequentially consistent, as are the
+ * sleeper's registration in hwait and its trylock: either this sees the
+ * sleeper, or the sleeper sees the mutex released.
+ */
+static void hybrid_wake(pi_mutex_t *mutex)
+{
+	if (!(__atomic_load_n(&mutex->hwait, __ATOMIC_SEQ_CST) &
+	      HYBRID_SLEEPERS))
+		return;
+	__atomic_add_fetch(&mutex->hwait, HYBRID_SEQ, __ATOMIC_SEQ_CST);
+	futex_wake(&mutex->hwait, 1, mutex->flags);
+}
+
+static int hybrid_unlock(pi_mutex_t *mutex)
+{
+	__u32 locked = futex_tid();
+	int ret = 0;
+
+	if (!__atomic_compare_exchange_n(&mutex->futex, &locked, 0, false,
+					 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) &&
+	    futex_unlock_pi(&mutex->futex, mutex->flags))
+		ret = errno;
+	hybrid_wake(mutex);
+	return ret;
+}
+
+/**
+ * hybrid_block() - sleep without PI until the hybrid mutex is acquired
+ * @mutex: RTPI_MUTEX_HYBRID mutex to acquire
+ * @abstime: CLOCK_MONOTONIC deadline, or NULL to wait forever
+ */
+static int hybrid_block(pi_mutex_t *mutex, const struct timespec *abstime)
+{
+	__u32 pid = futex_tid();
+	__u32 seq, unlocked;
+	int ret;
+
+	__atomic_add_fetch(&mutex->hwait, HYBRID_SLEEPER, __ATOMIC_SEQ_CST);
+	for (;;) {
+		seq = __atomic_load_n(&mutex->hwait, __ATOMIC_SEQ_CST);
+		unlocked = 0;
+		if (__atomic_compare_exchange_n(&mutex->futex, &unlocked, pid,
+						false, __ATOMIC_SEQ_CST,
+						__ATOMIC_SEQ_CST)) {
+			ret = 0;
+			break;
+		}
+		/* hwait changes with every wakeup and every new sleeper */
+		if (futex_wait(&mutex->hwait, seq, abstime, mutex->flags) &&
+		    errno != EAGAIN && errno != EINTR) {
+			ret = errno;
+			break;
+		}
+	}
+	__atomic_sub_fetch(&mutex->hwait, HYBRID_SLEEPER, __ATOMIC_SEQ_CST);
+
+	/* A wakeup consumed by a timed out sleeper goes to the next one */
+	if (ret && !__atomic_load_n(&mutex->futex, __ATOMIC_SEQ_CST))
+		hybrid_wake(mutex);
+	return ret;
+}
+
+/**
+ * mutex_acquire() - common path of the pi_mutex lock calls
+ * @mutex: PI mutex to acquire
+ * @timeout: CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @relative: timeout is relative to now rather than a deadline
+ *
+ * A relative timeout is turned into a deadline only once the mutex turns out
+ * to be contended, so an uncontended acquisition does not read the clock.
+ */
+static int mutex_acquire(pi_mutex_t *mutex, const struct timespec *timeout,
+			 bool relative)
+{
+	const struct timespec *abstime = timeout;
+	struct timespec deadline;
+	__u64 start = 0;
+	bool slow = false;
+	int ret;
+
+	ret = word_trylock(&mutex->futex);
+	if (ret != EBUSY)
+		goto out;
+
+	if (timeout && relative) {
+		ret = futex_deadline(timeout, &deadline);
+		if (ret)
+			return ret;
+		abstime = &deadline;
+	}
+	if (abstime && (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000))
+		return EINVAL;
+
+	if (stats_enabled(mutex))
+		start = stats_now();
+
+	if ((mutex->flags & RTPI_MUTEX_ADAPTIVE) && !mutex_spin(mutex)) {
+		ret = 0;
+		goto out;
+	}
+
+	/* The ceiling already bounds the blocking of a PROTECT mutex */
+	if ((mutex->flags & RTPI_MUTEX_PROTECT) ||
+	    ((mutex->flags & RTPI_MUTEX_HYBRID) && !protect_thread_is_rt()))
+		ret = hybrid_block(mutex, abstime);
+	else
+		ret = word_block(&mutex->futex, mutex->flags, abstime);
+	slow = true;
+out:
+	if (!ret && stats_enabled(mutex))
+		stats_acquired(mutex, start, slow);
+	return ret;
+}
+
+/**
+ * mutex_lock() - take a mutex, under its priority ceiling if it has one
+ * @mutex: PI mutex to acquire
+ * @timeout: CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @relative: timeout is relative to now rather than a deadline
+ */
+static int mutex_lock(pi_mutex_t *mutex, const struct timespec *timeout,
+		      bool relative)
+{
+	__u32 ceiling;
+	int ret;
+
+	if (!protect_enabled(mutex))
+		return mutex_acquire(mutex, timeout, relative);
+
+	ceiling = protect_ceiling(mutex);
+	ret = protect_enter(ceiling);
+	if (ret)
+		return ret;
+	ret = mutex_acquire(mutex, timeout, relative);
+	if (ret)
+		protect_exit(ceiling);
+	return ret;
+}
+
+int pi_mutex_lock(pi_mutex_t *mutex)
+{
+	return mutex_lock(mutex, NULL, false);
+}
+
+int pi_mutex_timedlock(pi_mutex_t *mutex, const struct timespec *abstime)
+{
+	return mutex_lock(mutex, abstime, false);
+}
+
+int pi_mutex_reltimedlock(pi_mutex_t *mutex, const struct timespec *reltime)
+{
+	return mutex_lock(mutex, reltime, true);
+}
+
+int pi_mutex_trylock(pi_mutex_t *mutex)
+{
+	__u32 ceiling = 0;
+	int ret;
+
+	if (protect_enabled(mutex)) {
+		ceiling = protect_ceiling(mutex);
+		ret = protect_enter(ceiling);
+		if (ret)
+			return ret;
+	}
+
+	ret = word_trylock(&mutex->futex);
+	if (ret && ceiling)
+		protect_exit(ceiling);
+	if (!ret && stats_enabled(mutex))
+		stats_acquired(mutex, 0, false);
+	return ret;
+}
+
+int pi_mutex_unlock(pi_mutex_t *mutex)
+{
+	int ret;
+
+	ret = word_check_owner(&mutex->futex);
+	if (ret)
+		return ret;
+
+	if (stats_enabled(mutex))
+		stats_release(mutex);
+
+	if (protect_enabled(mutex)) {
+		/* Drop the ceiling only once the mutex is released */
+		__u32 ceiling = protect_ceiling(mutex);
+
+		ret = hybrid_unlock(mutex);
+		protect_exit(ceiling);
+		return ret;
+	}
+	if (mutex->flags & RTPI_MUTEX_HYBRID)
+		return hybrid_unlock(mutex);
+	return word_unlock(&mutex->futex, mutex->flags);
+}
+
+int pi_mutex_get_stats(pi_mutex_t *mutex, struct pi_mutex_stats *stats)
+{
+	if (!(mutex->flags & RTPI_MUTEX_STATS))
+		return EINVAL;
+
+	stats->fast = __atomic_load_n(&mutex->nr_fast, __ATOMIC_RELAXED);
+	stats->slow = __atomic_load_n(&mutex->nr_slow, __ATOMIC_RELAXED);
+	stats->wait_ns = __atomic_load_n(&mutex->wait_ns, __ATOMIC_RELAXED);
+	stats->max_wait_ns = __atomic_load_n(&mutex->max_wait_ns,
+					     __ATOMIC_RELAXED);
+	stats->max_hold_ns = __atomic_load_n(&mutex->max_hold_ns,
+					     __ATOMIC_RELAXED);
+	return 0;
+}
+
+int pi_mutex_compact_init(pi_mutex_compact_t *mutex, uint32_t flags)
+{
+	/* Check for unknown options */
+	if (flags & ~RTPI_MUTEX_PSHARED)
+		return EINVAL;
+
+	mutex->futex = 0;
+	mutex->flags = flags;
+	return 0;
+}
+
+int pi_mutex_compact_destroy(pi_mutex_compact_t *mutex)
+{
+	mutex->futex = 0;
+	mutex->flags = 0;
+	return 0;
+}
+
+int pi_mutex_compact_lock(pi_mutex_compact_t *mutex)
+{
+	int ret;
+
+	ret = word_trylock(&mutex->futex);
+	if (ret != EBUSY)
+		return ret;
+	return word_block(&mutex->futex, mutex->flags, NULL);
+}
+
+int pi_mutex_compact_timedlock(pi_mutex_compact_t *mutex,
+			       const struct timespec *abstime)
+{
+	int ret;
+
+	ret = word_trylock(&mutex->futex);
+	if (ret != EBUSY)
+		return ret;
+	if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000)
+		return EINVAL;
+	return word_block(&mutex->futex, mutex->flags, abstime);
+}
+
+int pi_mutex_compact_trylock(pi_mutex_compact_t *mutex)
+{
+	return word_trylock(&mutex->futex);
+}
+
+int pi_mutex_compact_unlock(pi_mutex_compact_t *mutex)
+{
+	int ret;
+
+	ret = word_check_owner(&mutex->futex);
+	if (ret)
+		return ret;
+	return word_unlock(&mutex->futex, mutex->flags);
 }
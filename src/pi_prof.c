@@ -0,0 +1,493 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * librtpi-prof.so: LD_PRELOAD contention profiler for librtpi mutexes.
+ *
+ * Interposes the pi_mutex lock/unlock calls and the pi_cond waits of an
+ * unmodified binary and keeps per-lock acquisition, wait and hold time
+ * counters. At exit, or when RTPI_PROF_SIGNAL (SIGUSR1 by default) is
+ * delivered, the locks with the most time spent waiting are printed to
+ * stderr along with the call sites that waited and the priorities of the
+ * waiting threads.
+ *
+ * Environment:
+ *   RTPI_PROF_TOP=n      number of locks to report (default 10)
+ *   RTPI_PROF_SIGNAL=n   signal that prints the report, 0 to disable
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rtpi.h"
+
+#define PROF_LOCKS	4096	/* power of two */
+#define PROF_SITES	4
+#define PROF_HOLD_BUCKETS 6	/* <1us, <10us, <100us, <1ms, <10ms, more */
+
+struct prof_site {
+	void		*ip;
+	__u64		count;
+	__u64		wait_ns;
+};
+
+/*
+ * Everything but the key is only written by the owner of the mutex, so the
+ * counters need no atomics; the report reads them racily.
+ */
+struct prof_lock {
+	pi_mutex_t	*mutex;
+	__u64		locked;
+	__u64		contended;
+	__u64		wait_ns;
+	__u64		max_wait_ns;
+	__u64		hold_start;
+	__u64		hold_ns;
+	__u64		max_hold_ns;
+	__u64		hold[PROF_HOLD_BUCKETS];
+	int		min_prio;
+	int		max_prio;
+	struct prof_site sites[PROF_SITES];
+};
+
+static struct prof_lock prof_locks[PROF_LOCKS];
+static unsigned long prof_dropped;
+
+static int (*real_lock)(pi_mutex_t *);
+static int (*real_timedlock)(pi_mutex_t *, const struct timespec *);
+static int (*real_reltimedlock)(pi_mutex_t *, const struct timespec *);
+static int (*real_trylock)(pi_mutex_t *);
+static int (*real_unlock)(pi_mutex_t *);
+static int (*real_cond_wait)(pi_cond_t *, pi_mutex_t *);
+static int (*real_cond_timedwait)(pi_cond_t *, pi_mutex_t *,
+				  const struct timespec *);
+static int (*real_cond_clockwait)(pi_cond_t *, pi_mutex_t *, int,
+				  const struct timespec *);
+static int (*real_cond_reltimedwait)(pi_cond_t *, pi_mutex_t *,
+				     const struct timespec *);
+
+/*
+ * Set while inside a pi_cond wait, whose own calls to the mutex functions
+ * resolve back to the wrappers below.
+ */
+static __thread int in_cond;
+
+static void prof_resolve(void)
+{
+	real_lock = dlsym(RTLD_NEXT, "pi_mutex_lock");
+	real_timedlock = dlsym(RTLD_NEXT, "pi_mutex_timedlock");
+	real_reltimedlock = dlsym(RTLD_NEXT, "pi_mutex_reltimedlock");
+	real_trylock = dlsym(RTLD_NEXT, "pi_mutex_trylock");
+	real_unlock = dlsym(RTLD_NEXT, "pi_mutex_unlock");
+	real_cond_wait = dlsym(RTLD_NEXT, "pi_cond_wait");
+	real_cond_timedwait = dlsym(RTLD_NEXT, "pi_cond_timedwait");
+	real_cond_clockwait = dlsym(RTLD_NEXT, "pi_cond_clockwait");
+	real_cond_reltimedwait = dlsym(RTLD_NEXT, "pi_cond_reltimedwait");
+}
+
+#define REAL(fn) \
+	(__builtin_expect(!real_##fn, 0) ? prof_resolve(), real_##fn \
+					 : real_##fn)
+
+static __u64 prof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * prof_lookup() - find or insert the entry of a mutex
+ * @mutex: PI mutex to look up
+ *
+ * Returns NULL once the table is full.
+ */
+static struct prof_lock *prof_lookup(pi_mutex_t *mutex)
+{
+	unsigned long i, h = ((unsigned long)mutex >> 6) * 0x9e3779b97f4a7c15UL;
+	struct prof_lock *l;
+	pi_mutex_t *key;
+
+	h >>= 20;
+	for (i = 0; i < PROF_LOCKS; i++) {
+		l = &prof_locks[(h + i) & (PROF_LOCKS - 1)];
+		key = __atomic_load_n(&l->mutex, __ATOMIC_ACQUIRE);
+		if (key == mutex)
+			return l;
+		if (key)
+			continue;
+		if (__atomic_compare_exchange_n(&l->mutex, &key, mutex, false,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			l->min_prio = INT32_MAX;
+			l->max_prio = -1;
+			return l;
+		}
+		if (key == mutex)
+			return l;
+	}
+	__atomic_add_fetch(&prof_dropped, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static int prof_prio(void)
+{
+	struct sched_param param;
+	int policy;
+
+	if (pthread_getschedparam(pthread_self(), &policy, &param))
+		return 0;
+	return (policy == SCHED_FIFO || policy == SCHED_RR) ?
+		param.sched_priority : 0;
+}
+
+/* Account an acquisition, called by the new owner. */
+static void prof_acquired(pi_mutex_t *mutex, void *ip, __u64 start)
+{
+	struct prof_lock *l = prof_lookup(mutex);
+	__u64 now = prof_now(), wait;
+	int i, prio;
+
+	if (!l)
+		return;
+	l->locked++;
+	l->hold_start = now;
+	if (!start)
+		return;
+
+	wait = now - start;
+	l->contended++;
+	l->wait_ns += wait;
+	if (wait > l->max_wait_ns)
+		l->max_wait_ns = wait;
+
+	prio = prof_prio();
+	if (prio < l->min_prio)
+		l->min_prio = prio;
+	if (prio > l->max_prio)
+		l->max_prio = prio;
+
+	for (i = 0; i < PROF_SITES; i++) {
+		if (!l->sites[i].ip)
+			l->sites[i].ip = ip;
+		if (l->sites[i].ip == ip) {
+			l->sites[i].count++;
+			l->sites[i].wait_ns += wait;
+			break;
+		}
+	}
+}
+
+/* Account the hold time, called by the owner before it releases. */
+static void prof_release(pi_mutex_t *mutex)
+{
+	struct prof_lock *l = prof_lookup(mutex);
+	__u64 hold, limit = 1000;
+	int b;
+
+	if (!l || !l->hold_start)
+		return;
+	hold = prof_now() - l->hold_start;
+	l->hold_start = 0;
+	l->hold_ns += hold;
+	if (hold > l->max_hold_ns)
+		l->max_hold_ns = hold;
+	for (b = 0; b < PROF_HOLD_BUCKETS - 1 && hold >= limit; b++)
+		limit *= 10;
+	l->hold[b]++;
+}
+
+int pi_mutex_lock(pi_mutex_t *mutex)
+{
+	__u64 start;
+	int ret;
+
+	if (in_cond)
+		return REAL(lock)(mutex);
+
+	ret = REAL(trylock)(mutex);
+	if (!ret) {
+		prof_acquired(mutex, NULL, 0);
+		return 0;
+	}
+	if (ret != EBUSY)
+		return ret;
+
+	start = prof_now();
+	ret = REAL(lock)(mutex);
+	if (!ret)
+		prof_acquired(mutex, __builtin_return_address(0), start);
+	return ret;
+}
+
+int pi_mutex_timedlock(pi_mutex_t *mutex, const struct timespec *abstime)
+{
+	__u64 start;
+	int ret;
+
+	if (in_cond)
+		return REAL(timedlock)(mutex, abstime);
+
+	ret = REAL(trylock)(mutex);
+	if (!ret) {
+		prof_acquired(mutex, NULL, 0);
+		return 0;
+	}
+	if (ret != EBUSY)
+		return ret;
+
+	start = prof_now();
+	ret = REAL(timedlock)(mutex, abstime);
+	if (!ret)
+		prof_acquired(mutex, __builtin_return_address(0), start);
+	return ret;
+}
+
+int pi_mutex_reltimedlock(pi_mutex_t *mutex, const struct timespec *reltime)
+{
+	__u64 start;
+	int ret;
+
+	if (in_cond)
+		return REAL(reltimedlock)(mutex, reltime);
+
+	ret = REAL(trylock)(mutex);
+	if (!ret) {
+		prof_acquired(mutex, NULL, 0);
+		return 0;
+	}
+	if (ret != EBUSY)
+		return ret;
+
+	start = prof_now();
+	ret = REAL(reltimedlock)(mutex, reltime);
+	if (!ret)
+		prof_acquired(mutex, __builtin_return_address(0), start);
+	return ret;
+}
+
+int pi_mutex_trylock(pi_mutex_t *mutex)
+{
+	int ret;
+
+	ret = REAL(trylock)(mutex);
+	if (!ret && !in_cond)
+		prof_acquired(mutex, NULL, 0);
+	return ret;
+}
+
+int pi_mutex_unlock(pi_mutex_t *mutex)
+{
+	if (!in_cond && (mutex->futex & FUTEX_TID_MASK) == (__u32)pi_gettid())
+		prof_release(mutex);
+	return REAL(unlock)(mutex);
+}
+
+/*
+ * A condvar wait ends the current hold and starts a new one once the mutex
+ * is reacquired. The time blocked on the condvar is not lock contention.
+ */
+int pi_cond_timedwait(pi_cond_t *cond, pi_mutex_t *mutex,
+		      const struct timespec *abstime)
+{
+	struct prof_lock *l;
+	int ret;
+
+	if (in_cond)
+		return REAL(cond_timedwait)(cond, mutex, abstime);
+
+	prof_release(mutex);
+	in_cond++;
+	ret = REAL(cond_timedwait)(cond, mutex, abstime);
+	in_cond--;
+	l = prof_lookup(mutex);
+	if (l)
+		l->hold_start = prof_now();
+	return ret;
+}
+
+int pi_cond_clockwait(pi_cond_t *cond, pi_mutex_t *mutex, int clock,
+		      const struct timespec *abstime)
+{
+	struct prof_lock *l;
+	int ret;
+
+	if (in_cond)
+		return REAL(cond_clockwait)(cond, mutex, clock, abstime);
+
+	prof_release(mutex);
+	in_cond++;
+	ret = REAL(cond_clockwait)(cond, mutex, clock, abstime);
+	in_cond--;
+	l = prof_lookup(mutex);
+	if (l)
+		l->hold_start = prof_now();
+	return ret;
+}
+
+int pi_cond_reltimedwait(pi_cond_t *cond, pi_mutex_t *mutex,
+			 const struct timespec *reltime)
+{
+	struct prof_lock *l;
+	int ret;
+
+	if (in_cond)
+		return REAL(cond_reltimedwait)(cond, mutex, reltime);
+
+	prof_release(mutex);
+	in_cond++;
+	ret = REAL(cond_reltimedwait)(cond, mutex, reltime);
+	in_cond--;
+	l = prof_lookup(mutex);
+	if (l)
+		l->hold_start = prof_now();
+	return ret;
+}
+
+int pi_cond_wait(pi_cond_t *cond, pi_mutex_t *mutex)
+{
+	struct prof_lock *l;
+	int ret;
+
+	if (in_cond)
+		return REAL(cond_wait)(cond, mutex);
+
+	prof_release(mutex);
+	in_cond++;
+	ret = REAL(cond_wait)(cond, mutex);
+	in_cond--;
+	l = prof_lookup(mutex);
+	if (l)
+		l->hold_start = prof_now();
+	return ret;
+}
+
+static int prof_cmp(const void *a, const void *b)
+{
+	const struct prof_lock *la = *(struct prof_lock * const *)a;
+	const struct prof_lock *lb = *(struct prof_lock * const *)b;
+
+	if (la->wait_ns != lb->wait_ns)
+		return la->wait_ns < lb->wait_ns ? 1 : -1;
+	return la->locked < lb->locked ? 1 : la->locked > lb->locked ? -1 : 0;
+}
+
+static void prof_print_site(const struct prof_site *s)
+{
+	const char *obj;
+	Dl_info info;
+
+	fprintf(stderr, "    %8llu waits %12.3f ms  ",
+		(unsigned long long)s->count, s->wait_ns / 1e6);
+	if (!dladdr(s->ip, &info)) {
+		fprintf(stderr, "%p\n", s->ip);
+		return;
+	}
+	obj = info.dli_fname ? info.dli_fname : "?";
+	if (strrchr(obj, '/'))
+		obj = strrchr(obj, '/') + 1;
+	if (info.dli_sname)
+		fprintf(stderr, "%s+0x%lx (%s)\n", info.dli_sname,
+			(unsigned long)((char *)s->ip - (char *)info.dli_saddr),
+			obj);
+	else
+		fprintf(stderr, "%s+0x%lx\n", obj,
+			(unsigned long)((char *)s->ip - (char *)info.dli_fbase));
+}
+
+static void prof_report(void)
+{
+	static const char *const hold_label[PROF_HOLD_BUCKETS] = {
+		"<1us", "<10us", "<100us", "<1ms", "<10ms", ">=10ms"
+	};
+	static struct prof_lock *sorted[PROF_LOCKS];
+	const struct prof_lock *l;
+	const char *env;
+	int i, j, n = 0, top = 10;
+
+	env = getenv("RTPI_PROF_TOP");
+	if (env)
+		top = atoi(env);
+
+	for (i = 0; i < PROF_LOCKS; i++)
+		if (__atomic_load_n(&prof_locks[i].mutex, __ATOMIC_ACQUIRE))
+			sorted[n++] = &prof_locks[i];
+	if (!n)
+		return;
+	qsort(sorted, n, sizeof(*sorted), prof_cmp);
+
+	fprintf(stderr, "librtpi-prof: %d locks used", n);
+	if (prof_dropped)
+		fprintf(stderr, ", %lu acquisitions untracked (table full)",
+			prof_dropped);
+	fprintf(stderr, ", top %d by wait time:\n", top < n ? top : n);
+	fprintf(stderr, "%-18s %10s %10s %12s %12s %12s %12s %7s\n", "mutex",
+		"locked", "contended", "wait ms", "max wait us", "avg hold us",
+		"max hold us", "prio");
+
+	for (i = 0; i < n && i < top; i++) {
+		l = sorted[i];
+		fprintf(stderr, "%-18p %10llu %10llu %12.3f %12.3f %12.3f %12.3f",
+			(void *)l->mutex, (unsigned long long)l->locked,
+			(unsigned long long)l->contended, l->wait_ns / 1e6,
+			l->max_wait_ns / 1e3,
+			l->locked ? l->hold_ns / 1e3 / l->locked : 0.0,
+			l->max_hold_ns / 1e3);
+		if (l->contended)
+			fprintf(stderr, " %3d-%-3d\n", l->min_prio, l->max_prio);
+		else
+			fprintf(stderr, " %7s\n", "-");
+
+		fprintf(stderr, "    hold:");
+		for (j = 0; j < PROF_HOLD_BUCKETS; j++)
+			fprintf(stderr, " %s %llu", hold_label[j],
+				(unsigned long long)l->hold[j]);
+		fprintf(stderr, "\n");
+		for (j = 0; j < PROF_SITES && l->sites[j].ip; j++)
+			prof_print_site(&l->sites[j]);
+	}
+}
+
+/*
+ * Like mutrace, the report is printed from the signal handler itself; it is
+ * meant for diagnosis, not for processes that must survive the signal
+ * interrupting stdio.
+ */
+static void prof_signal(int sig __attribute__ ((unused)))
+{
+	prof_report();
+}
+
+__attribute__((constructor)) static void prof_init(void)
+{
+	struct sigaction sa, old;
+	const char *env;
+	int sig = SIGUSR1;
+
+	prof_resolve();
+
+	env = getenv("RTPI_PROF_SIGNAL");
+	if (env)
+		sig = atoi(env);
+	if (sig <= 0 || sig >= NSIG)
+		return;
+
+	/* Leave the signal alone if the application already handles it. */
+	if (sigaction(sig, NULL, &old) || old.sa_handler != SIG_DFL)
+		return;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = prof_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(sig, &sa, NULL);
+}
+
+__attribute__((destructor)) static void prof_fini(void)
+{
+	prof_report();
+}
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include "rtpi.h"
+#include "pi_protect.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE		6
+#endif
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK	0x40000000
+#endif
+
+/* A SCHED_DEADLINE thread runs ahead of every ceiling and is never raised */
+#define PROTECT_PRIO_DEADLINE	INT_MAX
+
+/*
+ * Scheduling state of the calling thread. base_* are the parameters the
+ * thread has outside of any ceiling, cached once base_valid is set. A lock
+ * taken at the base priority reads them again whenever they would make it
+ * fail or be raised to the ceiling, both of which cost a system call anyway:
+ * the parameters restored once the ceiling is dropped are then those the
+ * thread had just before. Only a lock at a ceiling equal to the cached
+ * priority, or by a SCHED_DEADLINE thread, trusts the cache, which
+ * pi_sched_changed() and fork() clear.
+ * boost is the SCHED_FIFO priority currently applied for a ceiling, 0 while
+ * at the base priority, and held counts the PROTECT mutexes held per
+ * ceiling.
+ */
+struct protect_thread {
+	bool			base_valid;
+	int			base_policy;
+	struct sched_param	base_param;
+	int			base_prio;
+	int			boost;
+	__u16			held[PROTECT_PRIO_MAX + 1];
+};
+
+static __thread struct protect_thread protect;
+
+static bool policy_is_rt(int policy)
+{
+	policy &= ~SCHED_RESET_ON_FORK;
+	return policy == SCHED_FIFO || policy == SCHED_RR ||
+	       policy == SCHED_DEADLINE;
+}
+
+static void protect_read_base(struct protect_thread *t)
+{
+	t->base_policy = sched_getscheduler(0);
+	sched_getparam(0, &t->base_param);
+	switch (t->base_policy & ~SCHED_RESET_ON_FORK) {
+	case SCHED_FIFO:
+	case SCHED_RR:
+		t->base_prio = t->base_param.sched_priority;
+		break;
+	case SCHED_DEADLINE:
+		t->base_prio = PROTECT_PRIO_DEADLINE;
+		break;
+	default:
+		t->base_prio = 0;
+	}
+	t->base_valid = true;
+}
+
+/**
+ * protect_set() - run the caller at a ceiling, or at its base priority
+ * @t: scheduling state of the caller
+ * @prio: SCHED_FIFO priority, 0 for the base parameters
+ */
+static int protect_set(struct protect_thread *t, int prio)
+{
+	struct sched_param param = { .sched_priority = prio };
+	int ret;
+
+	if (prio)
+		ret = sched_setscheduler(0, SCHED_FIFO |
+					 (t->base_policy & SCHED_RESET_ON_FORK),
+					 &param);
+	else
+		ret = sched_setscheduler(0, t->base_policy, &t->base_param);
+	if (ret)
+		return errno;
+	t->boost = prio;
+	return 0;
+}
+
+int protect_enter(__u32 ceiling)
+{
+	struct protect_thread *t = &protect;
+	int ret;
+
+	if (!t->boost && (!t->base_valid ||
+			  (t->base_prio != (int)ceiling &&
+			   t->base_prio != PROTECT_PRIO_DEADLINE)))
+		protect_read_base(t);
+
+	if (t->base_prio > (int)ceiling &&
+	    t->base_prio != PROTECT_PRIO_DEADLINE)
+		return EINVAL;
+	if ((int)ceiling > t->base_prio && (int)ceiling > t->boost) {
+		ret = protect_set(t, ceiling);
+		if (ret)
+			return ret;
+	}
+	t->held[ceiling]++;
+	return 0;
+}
+
+void protect_exit(__u32 ceiling)
+{
+	struct protect_thread *t = &protect;
+	int prio;
+
+	if (t->held[ceiling])
+		t->held[ceiling]--;
+	if ((int)ceiling != t->boost || t->held[ceiling])
+		return;
+
+	/* Drop to the highest ceiling still held, or back to the base */
+	for (prio = ceiling - 1; prio > t->base_prio; prio--)
+		if (t->held[prio])
+			break;
+	protect_set(t, prio > t->base_prio ? prio : 0);
+}
+
+bool protect_thread_is_rt(void)
+{
+	/* Raised to a ceiling, the thread runs SCHED_FIFO */
+	if (protect.boost)
+		return true;
+	return policy_is_rt(sched_getscheduler(0));
+}
+
+void pi_sched_changed(void)
+{
+	protect.base_valid = false;
+}
+
+/*
+ * SCHED_RESET_ON_FORK may have put the child of fork() back to SCHED_OTHER
+ * behind the cache of the forking thread.
+ */
+static void protect_atfork_child(void)
+{
+	protect.base_valid = false;
+}
+
+__attribute__((constructor)) static void protect_init(void)
+{
+	pthread_atfork(NULL, NULL, protect_atfork_child);
+}
+
+void protect_handover(pi_mutex_t *mutex)
+{
+	__u32 ceiling;
+
+	if (!protect_enabled(mutex))
+		return;
+	ceiling = protect_ceiling(mutex);
+	if (protect_enter(ceiling))
+		protect.held[ceiling]++;
+}
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef PI_PROTECT_H
+#define PI_PROTECT_H
+
+#include <stdbool.h>
+
+#include "rtpi.h"
+
+/*
+ * RTPI_MUTEX_PROTECT priority ceiling. A thread locking a PROTECT mutex runs
+ * at SCHED_FIFO priority of at least the ceiling until it releases it. A
+ * ceiling fits in the bits of RTPI_MUTEX_CEILING_MASK.
+ */
+#define PROTECT_PRIO_MAX \
+	(RTPI_MUTEX_CEILING_MASK >> RTPI_MUTEX_CEILING_SHIFT)
+
+static inline bool protect_enabled(pi_mutex_t *mutex)
+{
+	return __builtin_expect(mutex->flags & RTPI_MUTEX_PROTECT, 0);
+}
+
+static inline __u32 protect_ceiling(pi_mutex_t *mutex)
+{
+	return (mutex->flags & RTPI_MUTEX_CEILING_MASK) >>
+	       RTPI_MUTEX_CEILING_SHIFT;
+}
+
+/**
+ * protect_enter() - raise the caller to a ceiling before it takes a mutex
+ * @ceiling: ceiling of the PROTECT mutex about to be locked
+ *
+ * Returns 0, EINVAL if the caller runs above the ceiling, or the error of
+ * sched_setscheduler. On success the caller must call protect_exit() once it
+ * has released the mutex, or failed to take it.
+ */
+int protect_enter(__u32 ceiling) __attribute__ ((visibility("hidden")));
+
+/**
+ * protect_exit() - drop a ceiling after the caller released a mutex
+ * @ceiling: ceiling of the PROTECT mutex
+ */
+void protect_exit(__u32 ceiling) __attribute__ ((visibility("hidden")));
+
+/**
+ * protect_thread_is_rt() - whether the caller runs under a real-time policy
+ *
+ * SCHED_FIFO, SCHED_RR and SCHED_DEADLINE count as real-time. The policy is
+ * looked up on every call, which is only made by a contender about to block.
+ */
+bool protect_thread_is_rt(void) __attribute__ ((visibility("hidden")));
+
+/**
+ * protect_handover() - apply the ceiling of a mutex acquired by requeue
+ * @mutex: PI mutex handed over by FUTEX_WAIT_REQUEUE_PI
+ *
+ * The condvar waiter already owns the mutex, so the ceiling is accounted
+ * even if the caller cannot be raised to it.
+ */
+void protect_handover(pi_mutex_t *mutex)
+	__attribute__ ((visibility("hidden")));
+
+#endif // PI_PROTECT_H
@@ -0,0 +1,344 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * librtpi-pthread.so: LD_PRELOAD shim running the pthread mutexes and
+ * condvars of an unmodified binary on librtpi.
+ *
+ * Every pthread_mutex_t becomes a PI mutex and every pthread_cond_t a
+ * requeue-PI condvar with priority ordered wakeups. The librtpi state lives
+ * in the storage of the pthread object itself, laid out so that the
+ * all-zeros static initializers are valid unlocked objects, and so that the
+ * type set by PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP and friends is found
+ * where glibc puts it. pthread_cond_signal and pthread_cond_broadcast take
+ * no mutex, so each waiter records its mutex in the condvar for the
+ * requeue; POSIX requires concurrent waiters to use the same mutex.
+ *
+ * Robust mutexes are refused with ENOTSUP. Objects initialized by glibc
+ * internally and never passed to the calls below are not converted.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "rtpi.h"
+#include "pi_cond.h"
+
+struct shim_mutex {
+	pi_mutex_compact_t	m;
+	__u32			count;	/* recursive locks beyond the first */
+};
+
+#define SHIM_KIND_OFFSET	offsetof(pthread_mutex_t, __data.__kind)
+#define SHIM_KIND_TYPE		0x3	/* PTHREAD_MUTEX_{NORMAL,RECURSIVE,...} */
+
+_Static_assert(sizeof(struct shim_mutex) <= SHIM_KIND_OFFSET,
+	       "shim mutex overlaps the glibc mutex kind");
+
+/*
+ * The condvar words of struct pi_cond_words, run by the librtpi condvar
+ * algorithm in place.
+ */
+struct shim_cond {
+	__u32		cond;
+	__u32		flags;
+	__u64		state;
+	__u32		*futex;		/* mutex futex of the current waiters */
+	__u32		clock;		/* SHIM_COND_MONOTONIC */
+};
+
+/* pthread condvars default to CLOCK_REALTIME, so that is the zero value */
+#define SHIM_COND_MONOTONIC	0x1
+
+_Static_assert(sizeof(struct shim_cond) <= sizeof(pthread_cond_t),
+	       "shim condvar does not fit pthread_cond_t");
+_Static_assert(_Alignof(struct shim_cond) <= _Alignof(pthread_cond_t),
+	       "shim condvar is more aligned than pthread_cond_t");
+_Static_assert(_Alignof(struct shim_mutex) <= _Alignof(pthread_mutex_t),
+	       "shim mutex is more aligned than pthread_mutex_t");
+_Static_assert(sizeof(struct shim_mutex) <= sizeof(pthread_mutex_t),
+	       "shim mutex does not fit pthread_mutex_t");
+
+static inline struct shim_mutex *to_mutex(pthread_mutex_t *mutex)
+{
+	return (struct shim_mutex *)mutex;
+}
+
+static inline int mutex_type(pthread_mutex_t *mutex)
+{
+	return *(int *)((char *)mutex + SHIM_KIND_OFFSET) & SHIM_KIND_TYPE;
+}
+
+static inline struct shim_cond *to_cond(pthread_cond_t *cond)
+{
+	return (struct shim_cond *)cond;
+}
+
+static inline struct pi_cond_words cond_words(struct shim_cond *c)
+{
+	return (struct pi_cond_words){ &c->cond, &c->state, c->flags };
+}
+
+static inline bool mutex_owned(struct shim_mutex *m)
+{
+	return (__atomic_load_n(&m->m.futex, __ATOMIC_RELAXED) &
+		FUTEX_TID_MASK) == (__u32)pi_gettid();
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex,
+		       const pthread_mutexattr_t *attr)
+{
+	int type = PTHREAD_MUTEX_DEFAULT, pshared = PTHREAD_PROCESS_PRIVATE;
+	int robust = PTHREAD_MUTEX_STALLED;
+
+	if (attr) {
+		pthread_mutexattr_gettype(attr, &type);
+		pthread_mutexattr_getpshared(attr, &pshared);
+		pthread_mutexattr_getrobust(attr, &robust);
+	}
+	if (robust != PTHREAD_MUTEX_STALLED)
+		return ENOTSUP;
+
+	memset(mutex, 0, sizeof(*mutex));
+	pi_mutex_compact_init(&to_mutex(mutex)->m,
+			      pshared == PTHREAD_PROCESS_SHARED ?
+				      RTPI_MUTEX_PSHARED : 0);
+	*(int *)((char *)mutex + SHIM_KIND_OFFSET) = type & SHIM_KIND_TYPE;
+	return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+	if (__atomic_load_n(&to_mutex(mutex)->m.futex, __ATOMIC_RELAXED))
+		return EBUSY;
+	memset(mutex, 0, sizeof(*mutex));
+	return 0;
+}
+
+/* Returns 0 with the lock counted if the caller already holds it */
+static int mutex_relock(pthread_mutex_t *mutex)
+{
+	struct shim_mutex *m = to_mutex(mutex);
+
+	if (mutex_type(mutex) != PTHREAD_MUTEX_RECURSIVE || !mutex_owned(m))
+		return ESRCH;
+	if (m->count == UINT32_MAX)
+		return EAGAIN;
+	m->count++;
+	return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	int ret = mutex_relock(mutex);
+
+	if (ret != ESRCH)
+		return ret;
+	return pi_mutex_compact_lock(&to_mutex(mutex)->m);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+	int ret = mutex_relock(mutex);
+
+	if (ret != ESRCH)
+		return ret;
+	ret = pi_mutex_compact_trylock(&to_mutex(mutex)->m);
+	return ret == EDEADLOCK ? EBUSY : ret;
+}
+
+/**
+ * shim_monotonic() - translate a deadline to CLOCK_MONOTONIC
+ * @clock: clock of abstime, CLOCK_REALTIME or CLOCK_MONOTONIC
+ * @abstime: absolute deadline
+ * @mono: returns the CLOCK_MONOTONIC deadline
+ */
+static int shim_monotonic(clockid_t clock, const struct timespec *abstime,
+			  struct timespec *mono)
+{
+	struct timespec now, real;
+
+	if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000)
+		return EINVAL;
+	if (clock == CLOCK_MONOTONIC) {
+		*mono = *abstime;
+		return 0;
+	}
+	if (clock != CLOCK_REALTIME)
+		return EINVAL;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	clock_gettime(CLOCK_REALTIME, &real);
+	mono->tv_sec = now.tv_sec + abstime->tv_sec - real.tv_sec;
+	mono->tv_nsec = now.tv_nsec + abstime->tv_nsec - real.tv_nsec;
+	if (mono->tv_nsec < 0) {
+		mono->tv_sec--;
+		mono->tv_nsec += 1000000000;
+	} else if (mono->tv_nsec >= 1000000000) {
+		mono->tv_sec++;
+		mono->tv_nsec -= 1000000000;
+	}
+	return 0;
+}
+
+int pthread_mutex_clocklock(pthread_mutex_t *mutex, clockid_t clock,
+			    const struct timespec *abstime)
+{
+	struct timespec mono;
+	int ret = mutex_relock(mutex);
+
+	if (ret != ESRCH)
+		return ret;
+	ret = shim_monotonic(clock, abstime, &mono);
+	if (ret)
+		return ret;
+	return pi_mutex_compact_timedlock(&to_mutex(mutex)->m, &mono);
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t *mutex,
+			    const struct timespec *abstime)
+{
+	return pthread_mutex_clocklock(mutex, CLOCK_REALTIME, abstime);
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	struct shim_mutex *m = to_mutex(mutex);
+
+	if (m->count && mutex_owned(m)) {
+		m->count--;
+		return 0;
+	}
+	return pi_mutex_compact_unlock(&m->m);
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+	struct shim_cond *c = to_cond(cond);
+	int pshared = PTHREAD_PROCESS_PRIVATE;
+	clockid_t clock = CLOCK_REALTIME;
+
+	if (attr) {
+		pthread_condattr_getpshared(attr, &pshared);
+		pthread_condattr_getclock(attr, &clock);
+	}
+
+	memset(cond, 0, sizeof(*cond));
+	if (pshared == PTHREAD_PROCESS_SHARED)
+		c->flags = RTPI_COND_PSHARED;
+	if (clock == CLOCK_MONOTONIC)
+		c->clock = SHIM_COND_MONOTONIC;
+	return 0;
+}
+
+/*
+ * Waiters woken by a broadcast may still be on their way out, so destroy
+ * waits for them, and the storage can be freed once it returns. They leave
+ * only after the kernel hands them the mutex, so a caller holding it gets
+ * EBUSY instead of a deadlock.
+ */
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+	struct shim_cond *c = to_cond(cond);
+	struct pi_cond_words cw = cond_words(c);
+	__u32 *futex;
+	int ret;
+
+	if (__atomic_load_n(&c->state, __ATOMIC_ACQUIRE) >> 32) {
+		/* The waiters keep the mutex alive */
+		futex = __atomic_load_n(&c->futex, __ATOMIC_RELAXED);
+		if (futex && (__atomic_load_n(futex, __ATOMIC_RELAXED) &
+			      FUTEX_TID_MASK) == (__u32)pi_gettid())
+			return EBUSY;
+	}
+	ret = pi_cond_words_destroy(&cw);
+	if (ret)
+		return ret;
+	memset(cond, 0, sizeof(*cond));
+	return 0;
+}
+
+static int shim_cond_lock(void *mutex)
+{
+	return pi_mutex_compact_lock(mutex);
+}
+
+static int shim_cond_unlock(void *mutex)
+{
+	return pi_mutex_compact_unlock(mutex);
+}
+
+static int cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+		     clockid_t clock, const struct timespec *abstime)
+{
+	struct shim_cond *c = to_cond(cond);
+	struct shim_mutex *m = to_mutex(mutex);
+	struct pi_cond_words cw = cond_words(c);
+	struct pi_cond_lock lk = {
+		.futex = &m->m.futex,
+		.mutex = &m->m,
+		.lock = shim_cond_lock,
+		.unlock = shim_cond_unlock,
+	};
+	__u32 count;
+	int ret;
+
+	if (abstime && clock != CLOCK_MONOTONIC && clock != CLOCK_REALTIME)
+		return EINVAL;
+	if (!mutex_owned(m))
+		return EPERM;
+
+	/* Published to signalers by the release of the mutex in the wait */
+	__atomic_store_n(&c->futex, &m->m.futex, __ATOMIC_RELAXED);
+
+	/* A recursive mutex is released and reacquired in full */
+	count = m->count;
+	m->count = 0;
+	ret = pi_cond_words_wait(&cw, &lk, abstime, clock == CLOCK_REALTIME);
+	m->count = count;
+	return ret;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	return cond_wait(cond, mutex, CLOCK_REALTIME, NULL);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+			   const struct timespec *abstime)
+{
+	clockid_t clock = (to_cond(cond)->clock & SHIM_COND_MONOTONIC) ?
+				  CLOCK_MONOTONIC : CLOCK_REALTIME;
+
+	return cond_wait(cond, mutex, clock, abstime);
+}
+
+int pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+			   clockid_t clock, const struct timespec *abstime)
+{
+	return cond_wait(cond, mutex, clock, abstime);
+}
+
+static int cond_wake(pthread_cond_t *cond, __u32 n)
+{
+	struct shim_cond *c = to_cond(cond);
+	struct pi_cond_words cw = cond_words(c);
+	__u32 *futex = __atomic_load_n(&c->futex, __ATOMIC_RELAXED);
+
+	/* Nobody ever waited */
+	if (!futex)
+		return 0;
+	return pi_cond_words_wake(&cw, futex, n);
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+	return cond_wake(cond, 1);
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+	return cond_wake(cond, UINT32_MAX);
+}
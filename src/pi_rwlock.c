@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#include <stdbool.h>
+#include <string.h>
+#include "rtpi.h"
+#include "pi_futex.h"
+#include "pi_slab.h"
+
+/*
+ * Readers register with a CAS on rwlock->readers and never enter the kernel
+ * while no writer is around. A writer first takes the wlock PI mutex, then
+ * sets RWLOCK_WRITER and waits for the registered readers to drain. Readers
+ * arriving meanwhile block on wlock, so both they and any other writer
+ * boost the writer through the PI futex. The writer waiting for readers to
+ * drain is a plain futex wait: a read lock has no single owner to boost.
+ *
+ * Once RWLOCK_WRITER is set new readers queue behind the writer, so a thread
+ * must not take a read lock recursively.
+ */
+#define RWLOCK_WRITER		(1U << 31)
+#define RWLOCK_READERS		(RWLOCK_WRITER - 1)
+
+pi_rwlock_t *pi_rwlock_alloc(void)
+{
+	return pi_slab_alloc(&pi_slab_128);
+}
+
+void pi_rwlock_free(pi_rwlock_t *rwlock)
+{
+	pi_slab_free(&pi_slab_128, rwlock);
+}
+
+int pi_rwlock_init(pi_rwlock_t *rwlock, uint32_t flags)
+{
+	int ret;
+
+	/* Check for unknown options */
+	if (flags & ~RTPI_RWLOCK_PSHARED)
+		return EINVAL;
+
+	memset(rwlock, 0, sizeof(*rwlock));
+	ret = pi_mutex_init(&rwlock->wlock, flags);
+	if (ret)
+		return ret;
+	rwlock->flags = flags;
+	return 0;
+}
+
+int pi_rwlock_destroy(pi_rwlock_t *rwlock)
+{
+	memset(rwlock, 0, sizeof(*rwlock));
+	return 0;
+}
+
+static int rwlock_lock_writer(pi_rwlock_t *rwlock,
+			      const struct timespec *abstime)
+{
+	if (abstime)
+		return pi_mutex_timedlock(&rwlock->wlock, abstime);
+	return pi_mutex_lock(&rwlock->wlock);
+}
+
+static int rwlock_rdlock(pi_rwlock_t *rwlock, const struct timespec *abstime)
+{
+	__u32 readers;
+	int ret;
+
+	readers = __atomic_load_n(&rwlock->readers, __ATOMIC_RELAXED);
+	while (!(readers & RWLOCK_WRITER)) {
+		if ((readers & RWLOCK_READERS) == RWLOCK_READERS)
+			return EAGAIN;
+		if (__atomic_compare_exchange_n(&rwlock->readers, &readers,
+						readers + 1, true,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			return 0;
+	}
+
+	/*
+	 * A writer holds or is waiting for the lock. Block on its PI mutex,
+	 * boosting it, and register while holding the mutex: no writer can
+	 * set RWLOCK_WRITER then.
+	 */
+	ret = rwlock_lock_writer(rwlock, abstime);
+	if (ret)
+		return ret;
+	__atomic_add_fetch(&rwlock->readers, 1, __ATOMIC_ACQUIRE);
+	pi_mutex_unlock(&rwlock->wlock);
+	return 0;
+}
+
+int pi_rwlock_rdlock(pi_rwlock_t *rwlock)
+{
+	return rwlock_rdlock(rwlock, NULL);
+}
+
+int pi_rwlock_timedrdlock(pi_rwlock_t *rwlock, const struct timespec *abstime)
+{
+	return rwlock_rdlock(rwlock, abstime);
+}
+
+int pi_rwlock_tryrdlock(pi_rwlock_t *rwlock)
+{
+	__u32 readers;
+
+	readers = __atomic_load_n(&rwlock->readers, __ATOMIC_RELAXED);
+	while (!(readers & RWLOCK_WRITER)) {
+		if ((readers & RWLOCK_READERS) == RWLOCK_READERS)
+			return EAGAIN;
+		if (__atomic_compare_exchange_n(&rwlock->readers, &readers,
+						readers + 1, true,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			return 0;
+	}
+	return EBUSY;
+}
+
+static int rwlock_wrlock(pi_rwlock_t *rwlock, const struct timespec *abstime)
+{
+	__u32 readers;
+	int ret;
+
+	ret = rwlock_lock_writer(rwlock, abstime);
+	if (ret)
+		return ret;
+
+	readers = __atomic_or_fetch(&rwlock->readers, RWLOCK_WRITER,
+				    __ATOMIC_ACQ_REL);
+	while (readers != RWLOCK_WRITER) {
+		if (futex_wait(&rwlock->readers, readers, abstime,
+			       rwlock->flags) &&
+		    errno != EAGAIN && errno != EINTR) {
+			/* Timeout or error, let the blocked readers in */
+			ret = errno;
+			__atomic_and_fetch(&rwlock->readers, ~RWLOCK_WRITER,
+					   __ATOMIC_RELAXED);
+			pi_mutex_unlock(&rwlock->wlock);
+			return ret;
+		}
+		readers = __atomic_load_n(&rwlock->readers, __ATOMIC_ACQUIRE);
+	}
+	return 0;
+}
+
+int pi_rwlock_wrlock(pi_rwlock_t *rwlock)
+{
+	return rwlock_wrlock(rwlock, NULL);
+}
+
+int pi_rwlock_timedwrlock(pi_rwlock_t *rwlock, const struct timespec *abstime)
+{
+	return rwlock_wrlock(rwlock, abstime);
+}
+
+int pi_rwlock_trywrlock(pi_rwlock_t *rwlock)
+{
+	__u32 readers = 0;
+	int ret;
+
+	ret = pi_mutex_trylock(&rwlock->wlock);
+	if (ret)
+		return ret;
+
+	if (!__atomic_compare_exchange_n(&rwlock->readers, &readers,
+					 RWLOCK_WRITER, false,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		pi_mutex_unlock(&rwlock->wlock);
+		return EBUSY;
+	}
+	return 0;
+}
+
+int pi_rwlock_unlock(pi_rwlock_t *rwlock)
+{
+	__u32 readers;
+
+	if ((rwlock->wlock.futex & FUTEX_TID_MASK) == (__u32)futex_tid()) {
+		/* Write locked by the caller */
+		__atomic_and_fetch(&rwlock->readers, ~RWLOCK_WRITER,
+				   __ATOMIC_RELEASE);
+		return pi_mutex_unlock(&rwlock->wlock);
+	}
+
+	readers = __atomic_load_n(&rwlock->readers, __ATOMIC_RELAXED);
+	if (!(readers & RWLOCK_READERS))
+		return EPERM;
+
+	/* The last reader out wakes a writer waiting for them to drain */
+	readers = __atomic_sub_fetch(&rwlock->readers, 1, __ATOMIC_RELEASE);
+	if (readers == RWLOCK_WRITER)
+		futex_wake(&rwlock->readers, 1, rwlock->flags);
+	return 0;
+}
@@ -0,0 +1,455 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "rtpi.h"
+#include "pi_futex.h"
+
+/*
+ * Layout of an arena: a header, a directory of named objects and the objects
+ * themselves, each on its own cache line. Nothing is ever freed, so objects
+ * are carved off with an atomic bump of brk.
+ *
+ * The first process to map a fresh, zero-filled region moves hdr->init from
+ * ARENA_UNINIT to busy, lays out the header and publishes it with
+ * ARENA_READY; the others sleep on init meanwhile. The directory is an open
+ * addressing hash table that is only ever inserted into. An entry is
+ * claimed by moving its state from ENTRY_FREE to busy, and turns
+ * ENTRY_READY once its name is written and its object initialized. A lookup
+ * walks the probe sequence of the name and waits for each busy entry it
+ * meets, so two processes creating the same name meet in one entry.
+ *
+ * A busy word holds the PID of the process setting it up, which the waiters
+ * check for every ARENA_POLL_NS they sleep. Should it have died, a header is
+ * laid out again, and an entry becomes ENTRY_DEAD: lookups skip it, so the
+ * next one creates the object afresh in a later entry. The PID is only
+ * meaningful within one PID namespace, and a recycled PID reads as alive
+ * until its new process exits, which merely delays the recovery.
+ */
+#define ARENA_MAGIC		0x72747069	/* "rtpi" */
+#define ARENA_VERSION		2
+
+#define ARENA_UNINIT		0
+#define ARENA_READY		2
+
+#define ENTRY_FREE		0
+#define ENTRY_READY		2
+#define ENTRY_DEAD		3
+
+#define ARENA_BUSY		0x80000000	/* | PID of the owner */
+#define ARENA_BUSY_PID(s)	((pid_t)((s) & ~ARENA_BUSY))
+#define ARENA_POLL_NS		10000000
+
+#define ARENA_ALIGN		64
+#define ARENA_MIN_ENTRIES	16
+
+enum arena_kind {
+	ARENA_OBJECT = 1,
+	ARENA_MUTEX,
+	ARENA_COND,
+	ARENA_MQUEUE,
+};
+
+struct arena_header {
+	__u32	init;
+	__u32	magic;
+	__u32	version;
+	__u32	nr_entries;	/* power of two */
+	__u64	size;		/* usable bytes, fixed by the initializer */
+	__u64	brk;		/* offset of the next free cache line */
+} __attribute__ ((aligned(ARENA_ALIGN)));
+
+struct arena_entry {
+	__u32	state;
+	__u32	kind;
+	__u64	off;
+	__u64	size;
+	char	name[RTPI_SHM_NAME_MAX + 1];
+} __attribute__ ((aligned(ARENA_ALIGN)));
+
+_Static_assert(sizeof(struct arena_entry) == ARENA_ALIGN,
+	       "directory entries are one cache line");
+
+static inline struct arena_header *arena_hdr(pi_shm_arena_t *arena)
+{
+	return arena->base;
+}
+
+static inline struct arena_entry *arena_dir(pi_shm_arena_t *arena)
+{
+	return (struct arena_entry *)(arena_hdr(arena) + 1);
+}
+
+static inline __u32 arena_busy(void)
+{
+	return ARENA_BUSY | getpid();
+}
+
+/**
+ * arena_settle() - wait for the process setting up a header or an entry
+ * @word: hdr->init or the state of an entry
+ * @dead: replaces the busy value if its owner died
+ *
+ * Returns the first value of word that is not busy.
+ */
+static __u32 arena_settle(__u32 *word, __u32 dead)
+{
+	const struct timespec poll = { 0, ARENA_POLL_NS };
+	struct timespec deadline;
+	__u32 state;
+
+	while ((state = __atomic_load_n(word, __ATOMIC_ACQUIRE)) & ARENA_BUSY) {
+		futex_deadline(&poll, &deadline);
+		futex_wait(word, state, &deadline, RTPI_MUTEX_PSHARED);
+		if (__atomic_load_n(word, __ATOMIC_ACQUIRE) == state &&
+		    kill(ARENA_BUSY_PID(state), 0) && errno == ESRCH)
+			__atomic_compare_exchange_n(word, &state, dead, false,
+						    __ATOMIC_ACQUIRE,
+						    __ATOMIC_ACQUIRE);
+	}
+	return state;
+}
+
+static void arena_publish(__u32 *word, __u32 val)
+{
+	__atomic_store_n(word, val, __ATOMIC_RELEASE);
+	futex_wake(word, INT_MAX, RTPI_MUTEX_PSHARED);
+}
+
+/**
+ * arena_layout() - lay out the header of a fresh arena
+ * @arena: arena mapped by the caller, which moved hdr->init to busy
+ */
+static int arena_layout(pi_shm_arena_t *arena)
+{
+	struct arena_header *hdr = arena_hdr(arena);
+	size_t nr = ARENA_MIN_ENTRIES, dir_end;
+
+	/* About one entry per KiB of arena */
+	while (nr * 2 <= arena->size >> 10)
+		nr *= 2;
+	dir_end = sizeof(*hdr) + nr * sizeof(struct arena_entry);
+	if (dir_end + ARENA_ALIGN > arena->size)
+		return EINVAL;
+
+	hdr->magic = ARENA_MAGIC;
+	hdr->version = ARENA_VERSION;
+	hdr->nr_entries = nr;
+	hdr->size = arena->size;
+	hdr->brk = dir_end;
+	return 0;
+}
+
+/**
+ * arena_map() - map an arena file and make sure its header is laid out
+ * @arena: arena with fd set
+ * @size: size asked for by a creator, 0 to attach
+ * @flags: RTPI_SHM_* flags
+ *
+ * The size of an arena is fixed by the process that lays it out. Objects are
+ * handed out up to hdr->size in every process, so asking for more than that,
+ * or mapping less, fails with EINVAL.
+ */
+static int arena_map(pi_shm_arena_t *arena, size_t size, uint32_t flags)
+{
+	struct arena_header *hdr;
+	struct stat st;
+	__u32 init;
+	int ret;
+
+	if (fstat(arena->fd, &st))
+		return errno;
+	arena->size = st.st_size;
+	if (arena->size < sizeof(*hdr))
+		return EINVAL;
+
+	/* MAP_POPULATE prefaults the pages, so first use does not fault */
+	arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, arena->fd, 0);
+	if (arena->base == MAP_FAILED)
+		return errno;
+	hdr = arena_hdr(arena);
+
+	init = ARENA_UNINIT;
+	while (!__atomic_compare_exchange_n(&hdr->init, &init, arena_busy(),
+					    false, __ATOMIC_ACQUIRE,
+					    __ATOMIC_ACQUIRE)) {
+		init = arena_settle(&hdr->init, ARENA_UNINIT);
+		if (init != ARENA_UNINIT)
+			break;
+	}
+	if (init == ARENA_UNINIT) {
+		ret = arena_layout(arena);
+		/* Leave a region too small to lay out for another attempt */
+		arena_publish(&hdr->init, ret ? ARENA_UNINIT : ARENA_READY);
+		if (ret)
+			goto unmap;
+		init = ARENA_READY;
+	}
+
+	ret = EINVAL;
+	if (init != ARENA_READY || hdr->magic != ARENA_MAGIC ||
+	    hdr->version != ARENA_VERSION || hdr->size > arena->size ||
+	    size > hdr->size)
+		goto unmap;
+
+	if ((flags & RTPI_SHM_MLOCK) && mlock(arena->base, arena->size)) {
+		ret = errno;
+		goto unmap;
+	}
+	return 0;
+unmap:
+	munmap(arena->base, st.st_size);
+	return ret;
+}
+
+static pi_shm_arena_t *arena_open(int fd, size_t size, uint32_t flags)
+{
+	pi_shm_arena_t *arena;
+	struct stat st;
+	int ret;
+
+	arena = malloc(sizeof(*arena));
+	if (!arena) {
+		close(fd);
+		return NULL;
+	}
+	arena->fd = fd;
+
+	/*
+	 * Only size a fresh region. posix_fallocate() never shrinks the file,
+	 * so racing creators cannot truncate the region under each other.
+	 */
+	ret = 0;
+	if (fstat(fd, &st))
+		ret = errno;
+	else if (!st.st_size && size)
+		ret = posix_fallocate(fd, 0, size);
+	if (!ret)
+		ret = arena_map(arena, size, flags);
+	if (ret) {
+		close(fd);
+		free(arena);
+		errno = ret;
+		return NULL;
+	}
+	return arena;
+}
+
+pi_shm_arena_t *pi_shm_arena_open(const char *name, size_t size,
+				  uint32_t flags)
+{
+	int fd, oflag = O_RDWR | O_CLOEXEC;
+
+	/* Check for unknown options */
+	if (flags & ~(RTPI_SHM_CREATE | RTPI_SHM_EXCL | RTPI_SHM_MLOCK)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!(flags & RTPI_SHM_CREATE))
+		size = 0;
+	else if (!size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!name) {
+		fd = memfd_create("rtpi-arena", MFD_CLOEXEC);
+	} else {
+		if (flags & RTPI_SHM_CREATE)
+			oflag |= O_CREAT;
+		if (flags & RTPI_SHM_EXCL)
+			oflag |= O_EXCL;
+		fd = shm_open(name, oflag, 0600);
+	}
+	if (fd < 0)
+		return NULL;
+	return arena_open(fd, size, flags);
+}
+
+pi_shm_arena_t *pi_shm_arena_open_fd(int fd, uint32_t flags)
+{
+	if (flags & ~RTPI_SHM_MLOCK) {
+		errno = EINVAL;
+		return NULL;
+	}
+	fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	return arena_open(fd, 0, flags);
+}
+
+int pi_shm_arena_fd(pi_shm_arena_t *arena)
+{
+	return arena->fd;
+}
+
+void pi_shm_arena_close(pi_shm_arena_t *arena)
+{
+	if (!arena)
+		return;
+	munmap(arena->base, arena->size);
+	close(arena->fd);
+	free(arena);
+}
+
+int pi_shm_arena_unlink(const char *name)
+{
+	return shm_unlink(name) ? errno : 0;
+}
+
+/* FNV-1a */
+static __u32 arena_hash(const char *name)
+{
+	__u32 h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return h;
+}
+
+/* Geometry of a message queue, for arena_init_mqueue() */
+struct arena_mqueue {
+	size_t	nr;
+	size_t	msg_size;
+};
+
+static int arena_init_mutex(void *obj, uint32_t flags,
+			     const void *arg __attribute__ ((unused)))
+{
+	return pi_mutex_init(obj, flags | RTPI_MUTEX_PSHARED);
+}
+
+static int arena_init_cond(void *obj, uint32_t flags,
+			    const void *arg __attribute__ ((unused)))
+{
+	return pi_cond_init(obj, flags | RTPI_COND_PSHARED);
+}
+
+static int arena_init_mqueue(void *obj, uint32_t flags, const void *arg)
+{
+	const struct arena_mqueue *geo = arg;
+
+	return pi_mqueue_init(obj, geo->nr, geo->msg_size,
+			      flags | RTPI_MQUEUE_PSHARED);
+}
+
+/**
+ * arena_get() - look up a named object, creating it on first use
+ * @arena: arena to search
+ * @name: object name, at most RTPI_SHM_NAME_MAX bytes
+ * @kind: kind of object, which must match an existing entry
+ * @size: object size, which must match an existing entry
+ * @init: initializes a new object, NULL to leave it zero-filled
+ * @flags: passed to init
+ * @arg: passed to init
+ *
+ * A new object stays unpublished, and other processes looking it up wait,
+ * until init has run. Returns NULL with errno set on failure.
+ */
+static void *arena_get(pi_shm_arena_t *arena, const char *name,
+		       enum arena_kind kind, size_t size,
+		       int (*init)(void *, uint32_t, const void *),
+		       uint32_t flags, const void *arg)
+{
+	struct arena_header *hdr = arena_hdr(arena);
+	struct arena_entry *dir = arena_dir(arena), *e;
+	__u32 mask = hdr->nr_entries - 1, i, n, state;
+	size_t len = strlen(name);
+	__u64 off, need;
+	int ret;
+
+	if (len > RTPI_SHM_NAME_MAX) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	if (!len || !size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (i = arena_hash(name), n = 0; n <= mask; i++, n++) {
+		e = &dir[i & mask];
+		state = ENTRY_FREE;
+		if (__atomic_compare_exchange_n(&e->state, &state, arena_busy(),
+						false, __ATOMIC_ACQUIRE,
+						__ATOMIC_ACQUIRE))
+			goto claimed;
+		if (arena_settle(&e->state, ENTRY_DEAD) == ENTRY_DEAD ||
+		    strcmp(e->name, name))
+			continue;
+		if (e->kind != kind || e->size != size) {
+			errno = EINVAL;
+			return NULL;
+		}
+		return (char *)arena->base + e->off;
+	}
+	errno = ENOSPC;
+	return NULL;
+
+claimed:
+	memcpy(e->name, name, len + 1);
+	e->kind = kind;
+	e->size = size;
+
+	/* A failed entry keeps its name with no object, and fails lookups */
+	need = (size + ARENA_ALIGN - 1) & ~(__u64)(ARENA_ALIGN - 1);
+	off = __atomic_fetch_add(&hdr->brk, need, __ATOMIC_RELAXED);
+	if (off + need > hdr->size) {
+		ret = ENOMEM;
+		e->kind = 0;
+	} else {
+		e->off = off;
+		ret = init ? init((char *)arena->base + off, flags, arg) : 0;
+		if (ret)
+			e->kind = 0;
+	}
+	arena_publish(&e->state, ENTRY_READY);
+	if (ret) {
+		errno = ret;
+		return NULL;
+	}
+	return (char *)arena->base + off;
+}
+
+void *pi_shm_arena_object(pi_shm_arena_t *arena, const char *name,
+			  size_t size)
+{
+	return arena_get(arena, name, ARENA_OBJECT, size, NULL, 0, NULL);
+}
+
+pi_mutex_t *pi_shm_arena_mutex(pi_shm_arena_t *arena, const char *name,
+			       uint32_t flags)
+{
+	return arena_get(arena, name, ARENA_MUTEX, sizeof(pi_mutex_t),
+			 arena_init_mutex, flags, NULL);
+}
+
+pi_cond_t *pi_shm_arena_cond(pi_shm_arena_t *arena, const char *name,
+			     uint32_t flags)
+{
+	return arena_get(arena, name, ARENA_COND, sizeof(pi_cond_t),
+			 arena_init_cond, flags, NULL);
+}
+
+pi_mqueue_t *pi_shm_arena_mqueue(pi_shm_arena_t *arena, const char *name,
+				 size_t nr, size_t msg_size, uint32_t flags)
+{
+	struct arena_mqueue geo = { nr, msg_size };
+	size_t size = pi_mqueue_size(nr, msg_size);
+
+	if (!size) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return arena_get(arena, name, ARENA_MQUEUE, size, arena_init_mqueue,
+			 flags, &geo);
+}
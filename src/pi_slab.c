@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+#include "rtpi.h"
+#include "pi_slab.h"
+
+_Static_assert(sizeof(pi_mutex_t) == 64, "pi_mutex_t does not fit its pool");
+_Static_assert(sizeof(pi_cond_t) == 128, "pi_cond_t does not fit its pool");
+_Static_assert(sizeof(pi_rwlock_t) == 128, "pi_rwlock_t does not fit its pool");
+
+struct pi_slab pi_slab_64 = PI_SLAB_INIT(64);
+struct pi_slab pi_slab_128 = PI_SLAB_INIT(128);
+
+/*
+ * Objects are named by their index across the chunks of a pool, so that the
+ * free list head fits an index and an ABA tag in one 64-bit CAS. A free
+ * object holds the index + 1 of the next free object in its first word.
+ * Chunk c lives at c * SLAB_CHUNK_SIZE into the reserved range, so both the
+ * address of an index and the index of an address are plain arithmetic.
+ */
+
+static inline __u32 slab_per_chunk(struct pi_slab *slab)
+{
+	return SLAB_CHUNK_SIZE / slab->size;
+}
+
+static inline __u32 *slab_obj(struct pi_slab *slab, __u32 idx)
+{
+	__u32 per_chunk = slab_per_chunk(slab);
+	char *base = __atomic_load_n(&slab->base, __ATOMIC_ACQUIRE);
+
+	return (__u32 *)(base + (size_t)(idx / per_chunk) * SLAB_CHUNK_SIZE +
+			 (idx % per_chunk) * slab->size);
+}
+
+/**
+ * slab_index() - find the index of an object
+ * @slab: pool the object should come from
+ * @obj: object to look up
+ * @idx: returns the index of obj
+ *
+ * Returns false if obj is not the start of an object of a chunk mapped so
+ * far.
+ */
+static bool slab_index(struct pi_slab *slab, void *obj, __u32 *idx)
+{
+	__u32 nr = __atomic_load_n(&slab->nr_chunks, __ATOMIC_ACQUIRE);
+	char *base = __atomic_load_n(&slab->base, __ATOMIC_ACQUIRE);
+	size_t off, in_chunk;
+
+	if (nr > SLAB_MAX_CHUNKS)
+		nr = SLAB_MAX_CHUNKS;
+	if (!base || (char *)obj < base)
+		return false;
+	off = (char *)obj - base;
+	in_chunk = off % SLAB_CHUNK_SIZE;
+	if (off / SLAB_CHUNK_SIZE >= nr || in_chunk % slab->size ||
+	    in_chunk / slab->size >= slab_per_chunk(slab))
+		return false;
+	*idx = off / SLAB_CHUNK_SIZE * slab_per_chunk(slab) +
+	       in_chunk / slab->size;
+	return true;
+}
+
+/**
+ * slab_push() - push a chain of free objects onto the free list
+ * @slab: pool to push to
+ * @first: index of the first object of the chain
+ * @last: index of the last object, whose link is overwritten
+ */
+static void slab_push(struct pi_slab *slab, __u32 first, __u32 last)
+{
+	__u64 head, next;
+
+	head = __atomic_load_n(&slab->head, __ATOMIC_RELAXED);
+	do {
+		__atomic_store_n(slab_obj(slab, last), (__u32)head,
+				 __ATOMIC_RELAXED);
+		next = ((head >> 32) + 1) << 32 | (first + 1);
+	} while (!__atomic_compare_exchange_n(&slab->head, &head, next, true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+}
+
+/**
+ * slab_reserve() - reserve the address range of a pool on first use
+ * @slab: pool to reserve for
+ *
+ * The range is PROT_NONE and takes no memory until chunks are mapped in it.
+ * Returns its start, or NULL.
+ */
+static char *slab_reserve(struct pi_slab *slab)
+{
+	char *base = __atomic_load_n(&slab->base, __ATOMIC_ACQUIRE), *range;
+
+	if (base)
+		return base;
+	range = mmap(NULL, SLAB_RESERVE, PROT_NONE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (range == MAP_FAILED)
+		return NULL;
+	if (!__atomic_compare_exchange_n(&slab->base, &base, range, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		/* Reserved by a concurrent caller */
+		munmap(range, SLAB_RESERVE);
+		return base;
+	}
+	return range;
+}
+
+/**
+ * slab_grow() - add a prefaulted chunk of objects to the pool
+ * @slab: pool to grow
+ *
+ * Concurrent callers each add a chunk. Returns 0, or ENOMEM once all
+ * SLAB_MAX_CHUNKS chunks are mapped or if mapping one fails.
+ */
+static int slab_grow(struct pi_slab *slab)
+{
+	__u32 c, i, base, per_chunk = slab_per_chunk(slab);
+	char *range, *chunk;
+
+	range = slab_reserve(slab);
+	if (!range)
+		return ENOMEM;
+	/* Never count past the range, so chunk c is always inside it */
+	c = __atomic_load_n(&slab->nr_chunks, __ATOMIC_RELAXED);
+	do {
+		if (c >= SLAB_MAX_CHUNKS)
+			return ENOMEM;
+	} while (!__atomic_compare_exchange_n(&slab->nr_chunks, &c, c + 1,
+					      true, __ATOMIC_ACQ_REL,
+					      __ATOMIC_RELAXED));
+
+	chunk = mmap(range + (size_t)c * SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE,
+		     PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_POPULATE,
+		     -1, 0);
+	if (chunk == MAP_FAILED) {
+		/*
+		 * Give the slot back unless a concurrent caller took the next
+		 * one, in which case it stays a PROT_NONE hole no index of
+		 * the free list ever points to.
+		 */
+		__u32 next = c + 1;
+
+		__atomic_compare_exchange_n(&slab->nr_chunks, &next, c, false,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		return ENOMEM;
+	}
+
+	base = c * per_chunk;
+	for (i = 0; i < per_chunk - 1; i++)
+		*(__u32 *)(chunk + i * slab->size) = base + i + 2;
+	slab_push(slab, base, base + per_chunk - 1);
+	return 0;
+}
+
+void *pi_slab_alloc(struct pi_slab *slab)
+{
+	__u64 head, next;
+	__u32 idx, link;
+
+	head = __atomic_load_n(&slab->head, __ATOMIC_ACQUIRE);
+	do {
+		idx = (__u32)head;
+		if (!idx) {
+			if (slab_grow(slab))
+				return NULL;
+			head = __atomic_load_n(&slab->head, __ATOMIC_ACQUIRE);
+			continue;
+		}
+		/*
+		 * The object may be popped and reused meanwhile, in which
+		 * case the tag makes the CAS fail and the link is dropped.
+		 */
+		link = __atomic_load_n(slab_obj(slab, idx - 1),
+				       __ATOMIC_RELAXED);
+		next = ((head >> 32) + 1) << 32 | link;
+	} while (!idx ||
+		 !__atomic_compare_exchange_n(&slab->head, &head, next, true,
+					      __ATOMIC_ACQUIRE,
+					      __ATOMIC_ACQUIRE));
+
+	return slab_obj(slab, idx - 1);
+}
+
+int pi_slab_alloc_bulk(struct pi_slab *slab, void **objs, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		objs[i] = pi_slab_alloc(slab);
+		if (!objs[i]) {
+			while (i--)
+				pi_slab_free(slab, objs[i]);
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
+
+void pi_slab_free(struct pi_slab *slab, void *obj)
+{
+	__u32 idx;
+
+	/* Objects not from the pool are undefined; they are left alone */
+	if (obj && slab_index(slab, obj, &idx))
+		slab_push(slab, idx, idx);
+}
+
+/*
+ * Preallocate the first chunk of each pool at load time, so that a program
+ * allocating a handful of objects never maps memory after startup.
+ */
+__attribute__((constructor)) static void slab_init(void)
+{
+	slab_grow(&pi_slab_64);
+	slab_grow(&pi_slab_128);
+}
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef PI_SLAB_H
+#define PI_SLAB_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+/*
+ * Lock-free pools of cache-line-aligned objects backing the pi_*_alloc()
+ * calls. Memory comes from prefaulted anonymous mappings and is never
+ * returned, so a freed object stays mapped and readable.
+ */
+
+/*
+ * Each pool reserves address space for SLAB_MAX_CHUNKS chunks on first use,
+ * and grows by mapping the next SLAB_CHUNK_SIZE bytes of it at a time.
+ */
+#define SLAB_CHUNK_SIZE		(16 * 1024)
+#define SLAB_MAX_CHUNKS		4096
+#define SLAB_RESERVE		((size_t)SLAB_CHUNK_SIZE * SLAB_MAX_CHUNKS)
+
+struct pi_slab {
+	/* Free list: ABA tag in the upper 32 bits, index + 1 in the lower */
+	__u64	head __attribute__ ((aligned(64)));
+	__u32	size __attribute__ ((aligned(64)));
+	__u32	nr_chunks;
+	char	*base;		/* reserved range, NULL until first use */
+};
+
+#define PI_SLAB_INIT(s)	{ .head = 0, .size = (s), .nr_chunks = 0 }
+
+#define __slab_hidden	__attribute__ ((visibility("hidden")))
+
+/* Pools for pi_mutex_t, and for pi_cond_t and pi_rwlock_t */
+extern struct pi_slab pi_slab_64 __slab_hidden;
+extern struct pi_slab pi_slab_128 __slab_hidden;
+
+void *pi_slab_alloc(struct pi_slab *slab) __slab_hidden;
+
+int pi_slab_alloc_bulk(struct pi_slab *slab, void **objs, size_t n)
+	__slab_hidden;
+
+void pi_slab_free(struct pi_slab *slab, void *obj) __slab_hidden;
+
+#endif // PI_SLAB_H
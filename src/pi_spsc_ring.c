@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "rtpi.h"
+
+/*
+ * The producer publishes a slot with a release store to tail and the
+ * consumer frees one with a release store to head, so while the ring is
+ * neither full nor empty no side touches the lock. A side that finds the
+ * ring full or empty sets its bit in ring->waiting under ring->lock, checks
+ * again and sleeps on ring->cond. The other side rereads waiting after each
+ * index update, behind a full fence, and only then clears the bit and takes
+ * the lock to signal: either it sees the bit, or the sleeper's check sees the
+ * new index. The sleeper sets the bit again each time it rechecks.
+ */
+#define SPSC_CONSUMER		0x1
+#define SPSC_PRODUCER		0x2
+
+static inline char *ring_slot(pi_spsc_ring_t *ring, __u32 idx)
+{
+	return (char *)ring + ring->data_off +
+	       (size_t)(idx & ring->mask) * ring->elem_size;
+}
+
+static size_t ring_size(size_t nr, size_t elem_size)
+{
+	return sizeof(pi_spsc_ring_t) + nr * elem_size;
+}
+
+int pi_spsc_ring_init(pi_spsc_ring_t *ring, void *buf, size_t nr,
+		      size_t elem_size, uint32_t flags)
+{
+	int ret;
+
+	/* Check for unknown options and a power of two slot count */
+	if (flags & ~RTPI_SPSC_RING_PSHARED)
+		return EINVAL;
+	if (!nr || (nr & (nr - 1)) || nr > 1UL << 31)
+		return EINVAL;
+	if (!elem_size || elem_size > UINT32_MAX)
+		return EINVAL;
+
+	memset(ring, 0, sizeof(*ring));
+	ret = pi_mutex_init(&ring->lock, flags);
+	if (ret)
+		return ret;
+	ret = pi_cond_init(&ring->cond, flags);
+	if (ret)
+		return ret;
+	ring->mask = nr - 1;
+	ring->elem_size = elem_size;
+	ring->flags = flags;
+	/* An offset, so that a shared ring works at any address */
+	ring->data_off = (char *)buf - (char *)ring;
+	return 0;
+}
+
+int pi_spsc_ring_destroy(pi_spsc_ring_t *ring)
+{
+	pi_cond_destroy(&ring->cond);
+	pi_mutex_destroy(&ring->lock);
+	memset(ring, 0, sizeof(*ring));
+	return 0;
+}
+
+pi_spsc_ring_t *pi_spsc_ring_alloc(size_t nr, size_t elem_size,
+				   uint32_t flags)
+{
+	pi_spsc_ring_t *ring;
+	int ret;
+
+	if (!nr || nr > 1UL << 31 || !elem_size || elem_size > UINT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ring = mmap(NULL, ring_size(nr, elem_size), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (ring == MAP_FAILED)
+		return NULL;
+
+	ret = pi_spsc_ring_init(ring, ring + 1, nr, elem_size, flags);
+	if (ret) {
+		munmap(ring, ring_size(nr, elem_size));
+		errno = ret;
+		return NULL;
+	}
+	return ring;
+}
+
+void pi_spsc_ring_free(pi_spsc_ring_t *ring)
+{
+	size_t size;
+
+	if (!ring)
+		return;
+	size = ring_size((size_t)ring->mask + 1, ring->elem_size);
+	pi_spsc_ring_destroy(ring);
+	munmap(ring, size);
+}
+
+/**
+ * ring_wake() - wake the other side if it sleeps on the ring
+ * @ring: SPSC ring whose index the caller just updated
+ * @side: SPSC_CONSUMER or SPSC_PRODUCER, the side to wake
+ */
+static int ring_wake(pi_spsc_ring_t *ring, __u32 side)
+{
+	int ret;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!(__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) & side))
+		return 0;
+	/* Signal once per sleep, not for every index update until it runs */
+	if (!(__atomic_fetch_and(&ring->waiting, ~side, __ATOMIC_RELAXED) &
+	      side))
+		return 0;
+
+	ret = pi_mutex_lock(&ring->lock);
+	if (ret)
+		return ret;
+	ret = pi_cond_signal(&ring->cond, &ring->lock);
+	pi_mutex_unlock(&ring->lock);
+	return ret;
+}
+
+static bool ring_has_space(pi_spsc_ring_t *ring)
+{
+	__u32 head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+
+	return ring->tail - head <= ring->mask;
+}
+
+static bool ring_has_data(pi_spsc_ring_t *ring)
+{
+	return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != ring->head;
+}
+
+/**
+ * ring_wait() - sleep until the ring is ready for the caller's side
+ * @ring: SPSC ring to wait on
+ * @side: SPSC_CONSUMER or SPSC_PRODUCER, the caller's side
+ * @ready: ring_has_data() or ring_has_space()
+ */
+static int ring_wait(pi_spsc_ring_t *ring, __u32 side,
+		     bool (*ready)(pi_spsc_ring_t *))
+{
+	int ret;
+
+	ret = pi_mutex_lock(&ring->lock);
+	if (ret)
+		return ret;
+	for (;;) {
+		__atomic_or_fetch(&ring->waiting, side, __ATOMIC_SEQ_CST);
+		if (ready(ring))
+			break;
+		ret = pi_cond_wait(&ring->cond, &ring->lock);
+		if (ret)
+			break;
+	}
+	__atomic_and_fetch(&ring->waiting, ~side, __ATOMIC_RELAXED);
+	pi_mutex_unlock(&ring->lock);
+	return ret;
+}
+
+void *pi_spsc_ring_reserve(pi_spsc_ring_t *ring)
+{
+	__u32 tail = ring->tail;
+
+	if (tail - ring->head_cache > ring->mask) {
+		ring->head_cache = __atomic_load_n(&ring->head,
+						   __ATOMIC_ACQUIRE);
+		if (tail - ring->head_cache > ring->mask)
+			return NULL;
+	}
+	return ring_slot(ring, tail);
+}
+
+int pi_spsc_ring_commit(pi_spsc_ring_t *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+	return ring_wake(ring, SPSC_CONSUMER);
+}
+
+int pi_spsc_ring_wait_space(pi_spsc_ring_t *ring)
+{
+	return ring_wait(ring, SPSC_PRODUCER, ring_has_space);
+}
+
+void *pi_spsc_ring_front(pi_spsc_ring_t *ring)
+{
+	__u32 head = ring->head;
+
+	if (head == ring->tail_cache) {
+		ring->tail_cache = __atomic_load_n(&ring->tail,
+						   __ATOMIC_ACQUIRE);
+		if (head == ring->tail_cache)
+			return NULL;
+	}
+	return ring_slot(ring, head);
+}
+
+int pi_spsc_ring_release(pi_spsc_ring_t *ring)
+{
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+	return ring_wake(ring, SPSC_PRODUCER);
+}
+
+int pi_spsc_ring_wait_data(pi_spsc_ring_t *ring)
+{
+	return ring_wait(ring, SPSC_CONSUMER, ring_has_data);
+}
+
+int pi_spsc_ring_trypush(pi_spsc_ring_t *ring, const void *elem)
+{
+	void *slot = pi_spsc_ring_reserve(ring);
+
+	if (!slot)
+		return EAGAIN;
+	memcpy(slot, elem, ring->elem_size);
+	return pi_spsc_ring_commit(ring);
+}
+
+int pi_spsc_ring_push(pi_spsc_ring_t *ring, const void *elem)
+{
+	void *slot;
+	int ret;
+
+	while (!(slot = pi_spsc_ring_reserve(ring))) {
+		ret = pi_spsc_ring_wait_space(ring);
+		if (ret)
+			return ret;
+	}
+	memcpy(slot, elem, ring->elem_size);
+	return pi_spsc_ring_commit(ring);
+}
+
+int pi_spsc_ring_trypop(pi_spsc_ring_t *ring, void *elem)
+{
+	void *slot = pi_spsc_ring_front(ring);
+
+	if (!slot)
+		return EAGAIN;
+	memcpy(elem, slot, ring->elem_size);
+	return pi_spsc_ring_release(ring);
+}
+
+int pi_spsc_ring_pop(pi_spsc_ring_t *ring, void *elem)
+{
+	void *slot;
+	int ret;
+
+	while (!(slot = pi_spsc_ring_front(ring))) {
+		ret = pi_spsc_ring_wait_data(ring);
+		if (ret)
+			return ret;
+	}
+	memcpy(elem, slot, ring->elem_size);
+	return pi_spsc_ring_release(ring);
+}
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef PI_STATS_H
+#define PI_STATS_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "rtpi.h"
+
+/*
+ * RTPI_MUTEX_STATS accounting. The counters live in the mutex padding and are
+ * only updated by the current owner, so plain read-modify-write is enough;
+ * pi_mutex_get_stats() reads them racily.
+ */
+
+static inline bool stats_enabled(pi_mutex_t *mutex)
+{
+	return __builtin_expect(mutex->flags & RTPI_MUTEX_STATS, 0);
+}
+
+static inline __u64 stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * stats_acquired() - account an acquisition by the new owner
+ * @mutex: PI mutex just acquired
+ * @wait_start: time the caller started waiting, 0 if it did not wait
+ * @slow: whether the mutex was acquired by blocking in the kernel
+ */
+static inline void stats_acquired(pi_mutex_t *mutex, __u64 wait_start,
+				  bool slow)
+{
+	__u64 now = stats_now(), wait;
+
+	if (slow)
+		mutex->nr_slow++;
+	else
+		mutex->nr_fast++;
+	if (wait_start) {
+		wait = now - wait_start;
+		mutex->wait_ns += wait;
+		if (wait > mutex->max_wait_ns)
+			mutex->max_wait_ns = wait;
+	}
+	mutex->lock_ns = now;
+}
+
+/**
+ * stats_handover() - start the hold time of a mutex acquired by requeue
+ * @mutex: PI mutex handed over by FUTEX_WAIT_REQUEUE_PI
+ *
+ * A condvar waiter woken through the requeue owns the mutex without having
+ * asked for it, so only its hold time is tracked.
+ */
+static inline void stats_handover(pi_mutex_t *mutex)
+{
+	if (stats_enabled(mutex))
+		mutex->lock_ns = stats_now();
+}
+
+/**
+ * stats_release() - account the hold time before the owner releases
+ * @mutex: PI mutex about to be unlocked
+ */
+static inline void stats_release(pi_mutex_t *mutex)
+{
+	__u64 hold = stats_now() - mutex->lock_ns;
+
+	if (hold > mutex->max_hold_ns)
+		mutex->max_hold_ns = hold;
+}
+
+#endif // PI_STATS_H
@@ -17,7 +17,13 @@ extern "C" {
 #endif
 
 typedef union pi_mutex pi_mutex_t;
+typedef struct pi_mutex_compact pi_mutex_compact_t;
+typedef struct pi_lock_table pi_lock_table_t;
 typedef union pi_cond pi_cond_t;
+typedef union pi_rwlock pi_rwlock_t;
+typedef struct pi_spsc_ring pi_spsc_ring_t;
+typedef struct pi_mqueue pi_mqueue_t;
+typedef struct pi_shm_arena pi_shm_arena_t;
 
 /*
  * PI Mutex Interface
@@ -28,9 +34,37 @@ typedef union pi_cond pi_cond_t;
 #define RTPI_MUTEX_PSHARED    0x1
 //#define RTPI_MUTEX_ROBUST     0x2
 //#define RTPI_MUTEX_ERRORCHECK 0x4
+#define RTPI_MUTEX_ADAPTIVE   0x8
+#define RTPI_MUTEX_STATS      0x10
+#define RTPI_MUTEX_HYBRID     0x20
+#define RTPI_MUTEX_PROTECT    0x40
+
+/*
+ * Priority ceiling of an RTPI_MUTEX_PROTECT mutex, a SCHED_FIFO priority
+ * passed along with the flags, e.g. RTPI_MUTEX_PROTECT | RTPI_MUTEX_CEILING(50)
+ */
+#define RTPI_MUTEX_CEILING_SHIFT 24
+#define RTPI_MUTEX_CEILING_MASK  (0x7fU << RTPI_MUTEX_CEILING_SHIFT)
+#define RTPI_MUTEX_CEILING(prio) \
+	(((uint32_t)(prio) << RTPI_MUTEX_CEILING_SHIFT) & \
+	 RTPI_MUTEX_CEILING_MASK)
+
+/*
+ * Contention statistics of an RTPI_MUTEX_STATS mutex. Times are in
+ * nanoseconds of CLOCK_MONOTONIC.
+ */
+struct pi_mutex_stats {
+	uint64_t fast;		/* acquisitions without entering the kernel */
+	uint64_t slow;		/* acquisitions that blocked in the kernel */
+	uint64_t wait_ns;	/* cumulative time spent waiting for the lock */
+	uint64_t max_wait_ns;	/* longest single wait */
+	uint64_t max_hold_ns;	/* longest time the lock was held */
+};
 
 pi_mutex_t *pi_mutex_alloc(void);
 
+int pi_mutex_alloc_bulk(pi_mutex_t **mutexes, size_t n);
+
 void pi_mutex_free(pi_mutex_t *mutex);
 
 int pi_mutex_init(pi_mutex_t *mutex, uint32_t flags);
@@ -39,10 +73,140 @@ int pi_mutex_destroy(pi_mutex_t *mutex);
 
 int pi_mutex_lock(pi_mutex_t *mutex);
 
+int pi_mutex_timedlock(pi_mutex_t *mutex, const struct timespec *abstime);
+
+int pi_mutex_reltimedlock(pi_mutex_t *mutex, const struct timespec *reltime);
+
 int pi_mutex_trylock(pi_mutex_t *mutex);
 
 int pi_mutex_unlock(pi_mutex_t *mutex);
 
+int pi_mutex_get_stats(pi_mutex_t *mutex, struct pi_mutex_stats *stats);
+
+/*
+ * Call after changing the scheduling parameters of the calling thread, so
+ * that RTPI_MUTEX_PROTECT locks do not rely on the old ones.
+ */
+void pi_sched_changed(void);
+
+/*
+ * Inline fast paths: take and release an uncontended mutex without a library
+ * call, falling back to the functions above on contention, for error
+ * checking, and for any flag other than RTPI_MUTEX_PSHARED. Define
+ * RTPI_INLINE_FASTPATH before including rtpi.h to route pi_mutex_lock(),
+ * pi_mutex_trylock() and pi_mutex_unlock() calls through them.
+ */
+/* TID of the calling thread, the value a PI futex word holds when it owns it */
+pid_t pi_gettid(void);
+
+static inline int pi_mutex_lock_fast(pi_mutex_t *mutex)
+{
+	__u32 unlocked = 0;
+
+	if (!(mutex->flags & ~RTPI_MUTEX_PSHARED) &&
+	    __atomic_compare_exchange_n(&mutex->futex, &unlocked, pi_gettid(),
+					0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+	return pi_mutex_lock(mutex);
+}
+
+static inline int pi_mutex_trylock_fast(pi_mutex_t *mutex)
+{
+	__u32 unlocked = 0;
+
+	if (!(mutex->flags & ~RTPI_MUTEX_PSHARED) &&
+	    __atomic_compare_exchange_n(&mutex->futex, &unlocked, pi_gettid(),
+					0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+	return pi_mutex_trylock(mutex);
+}
+
+static inline int pi_mutex_unlock_fast(pi_mutex_t *mutex)
+{
+	__u32 locked = pi_gettid();
+
+	if (!(mutex->flags & ~RTPI_MUTEX_PSHARED) &&
+	    __atomic_compare_exchange_n(&mutex->futex, &locked, 0, 0,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		return 0;
+	return pi_mutex_unlock(mutex);
+}
+
+#ifdef RTPI_INLINE_FASTPATH
+#define pi_mutex_lock(mutex)	pi_mutex_lock_fast(mutex)
+#define pi_mutex_trylock(mutex)	pi_mutex_trylock_fast(mutex)
+#define pi_mutex_unlock(mutex)	pi_mutex_unlock_fast(mutex)
+#endif
+
+/*
+ * Compact PI Mutex Interface
+ *
+ * An 8-byte PI mutex for dense lock tables: the same lock semantics as
+ * pi_mutex_t, without its cache line isolation. Neighbouring compact mutexes
+ * share cache lines, and they cannot be used with pi_cond_t.
+ */
+#define DEFINE_PI_MUTEX_COMPACT(mutex, flags) \
+	pi_mutex_compact_t mutex = PI_MUTEX_COMPACT_INIT(flags)
+
+int pi_mutex_compact_init(pi_mutex_compact_t *mutex, uint32_t flags);
+
+int pi_mutex_compact_destroy(pi_mutex_compact_t *mutex);
+
+int pi_mutex_compact_lock(pi_mutex_compact_t *mutex);
+
+int pi_mutex_compact_timedlock(pi_mutex_compact_t *mutex,
+			       const struct timespec *abstime);
+
+int pi_mutex_compact_trylock(pi_mutex_compact_t *mutex);
+
+int pi_mutex_compact_unlock(pi_mutex_compact_t *mutex);
+
+/*
+ * PI Lock Table Interface
+ *
+ * Stripes a key space, typically object addresses, over a power of two
+ * number of pi_mutex_t, so that contention scales with the number of stripes
+ * rather than the number of objects. Keys hashing to the same stripe share
+ * its mutex.
+ */
+#define RTPI_LOCK_TABLE_MAX_KEYS	16
+
+pi_lock_table_t *pi_lock_table_alloc(size_t nr_stripes, uint32_t flags);
+
+void pi_lock_table_free(pi_lock_table_t *table);
+
+int pi_lock_table_init(pi_lock_table_t *table, pi_mutex_t *stripes,
+		       size_t nr_stripes, uint32_t flags);
+
+int pi_lock_table_destroy(pi_lock_table_t *table);
+
+static inline size_t pi_lock_table_index(const pi_lock_table_t *table,
+					 uintptr_t key)
+{
+	/* Fibonacci hashing: the top bits of the product mix all key bits */
+	uint64_t h = (uint64_t)key * 0x9e3779b97f4a7c15ULL;
+
+	return table->bits ? h >> (64 - table->bits) : 0;
+}
+
+static inline pi_mutex_t *pi_lock_table_mutex(const pi_lock_table_t *table,
+					      uintptr_t key)
+{
+	return &table->stripes[pi_lock_table_index(table, key)];
+}
+
+int pi_lock_table_lock(pi_lock_table_t *table, uintptr_t key);
+
+int pi_lock_table_trylock(pi_lock_table_t *table, uintptr_t key);
+
+int pi_lock_table_unlock(pi_lock_table_t *table, uintptr_t key);
+
+int pi_lock_table_lock_n(pi_lock_table_t *table, const uintptr_t *keys,
+			 size_t n);
+
+int pi_lock_table_unlock_n(pi_lock_table_t *table, const uintptr_t *keys,
+			   size_t n);
+
 
 /*
  * PI Cond Interface
@@ -51,9 +215,13 @@ int pi_mutex_unlock(pi_mutex_t *mutex);
 	pi_cond_t condvar = PI_COND_INIT(flags)
 
 #define RTPI_COND_PSHARED     RTPI_MUTEX_PSHARED
+#define RTPI_COND_CLOCK_REALTIME 0x2
+#define RTPI_COND_SPIN        0x4
 
 pi_cond_t *pi_cond_alloc(void);
 
+int pi_cond_alloc_bulk(pi_cond_t **conds, size_t n);
+
 void pi_cond_free(pi_cond_t *cond);
 
 int pi_cond_init(pi_cond_t *cond, uint32_t flags);
@@ -65,10 +233,187 @@ int pi_cond_wait(pi_cond_t *cond, pi_mutex_t *mutex);
 int pi_cond_timedwait(pi_cond_t *cond, pi_mutex_t *mutex,
 		      const struct timespec *abstime);
 
+int pi_cond_clockwait(pi_cond_t *cond, pi_mutex_t *mutex, int clock,
+		      const struct timespec *abstime);
+
+int pi_cond_reltimedwait(pi_cond_t *cond, pi_mutex_t *mutex,
+			 const struct timespec *reltime);
+
 int pi_cond_signal(pi_cond_t *cond, pi_mutex_t *mutex);
 
+int pi_cond_signal_n(pi_cond_t *cond, pi_mutex_t *mutex, unsigned int n);
+
 int pi_cond_broadcast(pi_cond_t *cond, pi_mutex_t *mutex);
 
+/*
+ * PI Reader-Writer Lock Interface
+ */
+#define DEFINE_PI_RWLOCK(rwlock, flags) \
+	pi_rwlock_t rwlock = PI_RWLOCK_INIT(flags)
+
+#define RTPI_RWLOCK_PSHARED   RTPI_MUTEX_PSHARED
+
+pi_rwlock_t *pi_rwlock_alloc(void);
+
+void pi_rwlock_free(pi_rwlock_t *rwlock);
+
+int pi_rwlock_init(pi_rwlock_t *rwlock, uint32_t flags);
+
+int pi_rwlock_destroy(pi_rwlock_t *rwlock);
+
+int pi_rwlock_rdlock(pi_rwlock_t *rwlock);
+
+int pi_rwlock_timedrdlock(pi_rwlock_t *rwlock, const struct timespec *abstime);
+
+int pi_rwlock_tryrdlock(pi_rwlock_t *rwlock);
+
+int pi_rwlock_wrlock(pi_rwlock_t *rwlock);
+
+int pi_rwlock_timedwrlock(pi_rwlock_t *rwlock, const struct timespec *abstime);
+
+int pi_rwlock_trywrlock(pi_rwlock_t *rwlock);
+
+int pi_rwlock_unlock(pi_rwlock_t *rwlock);
+
+/*
+ * PI SPSC Ring
+ *
+ * A ring of fixed-size elements between one producer and one consumer
+ * thread. Neither side takes a lock unless the ring is full or empty, in
+ * which case the blocked side sleeps on a PI condvar.
+ */
+#define RTPI_SPSC_RING_PSHARED RTPI_MUTEX_PSHARED
+
+pi_spsc_ring_t *pi_spsc_ring_alloc(size_t nr, size_t elem_size,
+				   uint32_t flags);
+
+void pi_spsc_ring_free(pi_spsc_ring_t *ring);
+
+int pi_spsc_ring_init(pi_spsc_ring_t *ring, void *buf, size_t nr,
+		      size_t elem_size, uint32_t flags);
+
+int pi_spsc_ring_destroy(pi_spsc_ring_t *ring);
+
+int pi_spsc_ring_push(pi_spsc_ring_t *ring, const void *elem);
+
+int pi_spsc_ring_trypush(pi_spsc_ring_t *ring, const void *elem);
+
+int pi_spsc_ring_pop(pi_spsc_ring_t *ring, void *elem);
+
+int pi_spsc_ring_trypop(pi_spsc_ring_t *ring, void *elem);
+
+/* Zero-copy access: a slot is filled or read in place, then handed over */
+void *pi_spsc_ring_reserve(pi_spsc_ring_t *ring);
+
+int pi_spsc_ring_commit(pi_spsc_ring_t *ring);
+
+int pi_spsc_ring_wait_space(pi_spsc_ring_t *ring);
+
+void *pi_spsc_ring_front(pi_spsc_ring_t *ring);
+
+int pi_spsc_ring_release(pi_spsc_ring_t *ring);
+
+int pi_spsc_ring_wait_data(pi_spsc_ring_t *ring);
+
+/*
+ * PI Message Queue
+ *
+ * Fixed-size messages with priorities between any number of senders and
+ * receivers, which may be in different processes if the queue is
+ * RTPI_MQUEUE_PSHARED and in a shared mapping. Messages are written and read
+ * in place in the queue's slots; receivers get the highest priority message
+ * first, and the highest priority receiver is woken first.
+ */
+#define RTPI_MQUEUE_PSHARED	RTPI_MUTEX_PSHARED
+
+#define RTPI_MQUEUE_PRIO_MAX	32	/* message priorities 0..31 */
+
+size_t pi_mqueue_size(size_t nr, size_t msg_size);
+
+int pi_mqueue_init(pi_mqueue_t *mq, size_t nr, size_t msg_size,
+		   uint32_t flags);
+
+int pi_mqueue_destroy(pi_mqueue_t *mq);
+
+pi_mqueue_t *pi_mqueue_alloc(size_t nr, size_t msg_size, uint32_t flags);
+
+void pi_mqueue_free(pi_mqueue_t *mq);
+
+int pi_mqueue_send(pi_mqueue_t *mq, const void *msg, unsigned int prio);
+
+int pi_mqueue_receive(pi_mqueue_t *mq, void *msg, unsigned int *prio);
+
+/* Zero-copy access: a slot is filled or read in place, then handed over */
+void *pi_mqueue_reserve(pi_mqueue_t *mq);
+
+void *pi_mqueue_tryreserve(pi_mqueue_t *mq);
+
+int pi_mqueue_commit(pi_mqueue_t *mq, void *msg, unsigned int prio);
+
+void *pi_mqueue_acquire(pi_mqueue_t *mq, unsigned int *prio);
+
+void *pi_mqueue_tryacquire(pi_mqueue_t *mq, unsigned int *prio);
+
+int pi_mqueue_acquire_batch(pi_mqueue_t *mq, void **msgs,
+			    unsigned int *prios, unsigned int *nr);
+
+int pi_mqueue_release(pi_mqueue_t *mq, void *msg);
+
+int pi_mqueue_release_batch(pi_mqueue_t *mq, void **msgs, unsigned int nr);
+
+/*
+ * PI Shared Memory Arena
+ *
+ * A named shared memory region, created or attached by any number of
+ * processes, holding process-shared mutexes, condvars and plain objects
+ * looked up by name. The first lookup of a name creates and initializes
+ * the object; concurrent lookups from other processes wait for it, and
+ * create it again if its creator died. Creators are tracked by PID, so all
+ * processes using an arena must share a PID namespace, or the arena may be
+ * corrupted; see README.md.
+ */
+#define RTPI_SHM_CREATE		0x1	/* create the region if missing */
+#define RTPI_SHM_EXCL		0x2	/* with CREATE, fail if it exists */
+#define RTPI_SHM_MLOCK		0x4	/* lock the mapping into memory */
+
+#define RTPI_SHM_NAME_MAX	39
+
+pi_shm_arena_t *pi_shm_arena_open(const char *name, size_t size,
+				  uint32_t flags);
+
+pi_shm_arena_t *pi_shm_arena_open_fd(int fd, uint32_t flags);
+
+int pi_shm_arena_fd(pi_shm_arena_t *arena);
+
+void pi_shm_arena_close(pi_shm_arena_t *arena);
+
+int pi_shm_arena_unlink(const char *name);
+
+pi_mutex_t *pi_shm_arena_mutex(pi_shm_arena_t *arena, const char *name,
+			       uint32_t flags);
+
+pi_cond_t *pi_shm_arena_cond(pi_shm_arena_t *arena, const char *name,
+			     uint32_t flags);
+
+void *pi_shm_arena_object(pi_shm_arena_t *arena, const char *name,
+			  size_t size);
+
+pi_mqueue_t *pi_shm_arena_mqueue(pi_shm_arena_t *arena, const char *name,
+				 size_t nr, size_t msg_size, uint32_t flags);
+
+/*
+ * Kernel Capabilities
+ *
+ * Probed once when the library is loaded. RTPI_CAP_LOCK_PI and
+ * RTPI_CAP_REQUEUE_PI are required for the PI mutexes and condvars to work.
+ */
+#define RTPI_CAP_LOCK_PI	0x1	/* FUTEX_LOCK_PI, FUTEX_UNLOCK_PI */
+#define RTPI_CAP_LOCK_PI2	0x2	/* FUTEX_LOCK_PI2, Linux 5.14 */
+#define RTPI_CAP_REQUEUE_PI	0x4	/* FUTEX_{WAIT,CMP}_REQUEUE_PI */
+#define RTPI_CAP_FUTEX_WAITV	0x8	/* futex_waitv(), Linux 5.16 */
+
+uint32_t pi_get_capabilities(void);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,347 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef RTPI_BOUNDED_QUEUE_HPP
+#define RTPI_BOUNDED_QUEUE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "rtpi/condition_variable.hpp"
+#include "rtpi/mutex.hpp"
+
+namespace rtpi
+{
+// The bounded_queue class is a fixed-capacity multi-producer multi-consumer
+// FIFO queue. Its ring buffer is allocated once by the constructor, so
+// pushing and popping never allocate. T must be move-constructible, and
+// also move-assignable for the try_pop overloads that move into a T&.
+//
+// Producers blocked on a full queue and consumers blocked on an empty one
+// wait on rtpi::condition_variable, so they are woken highest priority
+// first and boost the thread holding the queue lock. A push or pop only
+// notifies when a thread is actually waiting, and a batch push or pop wakes
+// as many waiters as it made room or elements for with a single notify_n.
+
+template <class T> class bounded_queue {
+	static_assert(std::is_move_constructible<T>::value,
+		      "T must be move-constructible");
+
+    private:
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+	typedef std::unique_lock<rtpi::mutex> lock_type;
+
+	rtpi::mutex m;
+	rtpi::condition_variable not_empty;
+	rtpi::condition_variable not_full;
+	std::unique_ptr<slot[]> slots;
+	std::size_t cap;
+	std::size_t head = 0;
+	std::size_t count = 0;
+	unsigned int pop_waiters = 0;
+	unsigned int push_waiters = 0;
+
+	T *at(std::size_t i)
+	{
+		return reinterpret_cast<T *>(&slots[(head + i) % cap]);
+	}
+
+	template <class... Args> void put(Args &&...args)
+	{
+		::new (static_cast<void *>(at(count)))
+			T(std::forward<Args>(args)...);
+		count++;
+	}
+
+	T take()
+	{
+		T *p = at(0);
+		T v(std::move(*p));
+
+		p->~T();
+		head = (head + 1) % cap;
+		count--;
+		return v;
+	}
+
+	// Counts the caller among the waiters on a condition for its scope,
+	// so the count is restored even if the wait throws. The condvar
+	// reacquires the lock before it throws.
+	class waiter_count {
+		unsigned int &n;
+
+	    public:
+		explicit waiter_count(unsigned int &waiters) : n(waiters)
+		{
+			n++;
+		}
+
+		~waiter_count()
+		{
+			n--;
+		}
+
+		waiter_count(const waiter_count &) = delete;
+		waiter_count &operator=(const waiter_count &) = delete;
+	};
+
+	// Wakes up to n threads waiting on cv, if any.
+	static void wake(lock_type &lock, rtpi::condition_variable &cv,
+			 unsigned int waiters, std::size_t n)
+	{
+		if (!waiters || !n)
+			return;
+		if (n == 1)
+			cv.notify_one(lock);
+		else
+			cv.notify_n(lock, n < waiters ? n : waiters);
+	}
+
+	void wait_not_full(lock_type &lock)
+	{
+		waiter_count w(push_waiters);
+
+		not_full.wait(lock, [this] { return count < cap; });
+	}
+
+	void wait_not_empty(lock_type &lock)
+	{
+		waiter_count w(pop_waiters);
+
+		not_empty.wait(lock, [this] { return count > 0; });
+	}
+
+	template <class Rep, class Period>
+	bool wait_not_full_for(lock_type &lock,
+			       const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		waiter_count w(push_waiters);
+
+		return not_full.wait_for(lock, rel_time,
+					 [this] { return count < cap; });
+	}
+
+	template <class Rep, class Period>
+	bool
+	wait_not_empty_for(lock_type &lock,
+			   const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		waiter_count w(pop_waiters);
+
+		return not_empty.wait_for(lock, rel_time,
+					  [this] { return count > 0; });
+	}
+
+    public:
+	typedef T value_type;
+	typedef std::size_t size_type;
+
+	// Constructs an empty queue holding up to capacity elements.
+	explicit bounded_queue(size_type capacity)
+		: slots(new slot[capacity ? capacity : 1]), cap(capacity)
+	{
+		if (!capacity)
+			throw std::invalid_argument("bounded_queue capacity is 0");
+	}
+
+	// Copy constructor is deleted.
+	bounded_queue(const bounded_queue &) = delete;
+
+	// Destroys the elements left in the queue.
+	~bounded_queue()
+	{
+		while (count) {
+			at(0)->~T();
+			head = (head + 1) % cap;
+			count--;
+		}
+	}
+
+	// Not copy-assignable.
+	const bounded_queue &operator=(const bounded_queue &) = delete;
+
+	// Appends value, blocking while the queue is full.
+	void push(const T &value)
+	{
+		emplace(value);
+	}
+
+	void push(T &&value)
+	{
+		emplace(std::move(value));
+	}
+
+	// Constructs an element in place from args, blocking while the queue
+	// is full.
+	template <class... Args> void emplace(Args &&...args)
+	{
+		lock_type lock(m);
+
+		if (count == cap)
+			wait_not_full(lock);
+		put(std::forward<Args>(args)...);
+		wake(lock, not_empty, pop_waiters, 1);
+	}
+
+	// Appends value if the queue is not full. Returns immediately. Returns
+	// true if value was queued, otherwise returns false.
+	bool try_push(const T &value)
+	{
+		return try_emplace(value);
+	}
+
+	bool try_push(T &&value)
+	{
+		return try_emplace(std::move(value));
+	}
+
+	template <class... Args> bool try_emplace(Args &&...args)
+	{
+		lock_type lock(m);
+
+		if (count == cap)
+			return false;
+		put(std::forward<Args>(args)...);
+		wake(lock, not_empty, pop_waiters, 1);
+		return true;
+	}
+
+	// Appends value, blocking while the queue is full for at most
+	// rel_time. Returns true if value was queued, otherwise returns false.
+	template <class Rep, class Period>
+	bool try_push_for(T &&value,
+			  const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		lock_type lock(m);
+
+		if (count == cap && !wait_not_full_for(lock, rel_time))
+			return false;
+		put(std::move(value));
+		wake(lock, not_empty, pop_waiters, 1);
+		return true;
+	}
+
+	// Appends the elements of [first, last) in order, blocking while the
+	// queue is full. Elements are copied or, through a
+	// std::move_iterator, moved. Other producers may interleave whenever
+	// the queue fills up.
+	template <class InputIt> void push(InputIt first, InputIt last)
+	{
+		lock_type lock(m);
+
+		while (first != last) {
+			size_type n = 0;
+
+			if (count == cap)
+				wait_not_full(lock);
+			for (; first != last && count < cap; ++first, n++)
+				put(*first);
+			wake(lock, not_empty, pop_waiters, n);
+		}
+	}
+
+	// Removes and returns the oldest element, blocking while the queue is
+	// empty.
+	T pop()
+	{
+		lock_type lock(m);
+
+		if (!count)
+			wait_not_empty(lock);
+		T v(take());
+		wake(lock, not_full, push_waiters, 1);
+		return v;
+	}
+
+	// Moves the oldest element to value if the queue is not empty.
+	// Returns immediately. Returns true if an element was popped,
+	// otherwise returns false.
+	bool try_pop(T &value)
+	{
+		static_assert(std::is_move_assignable<T>::value,
+			      "try_pop(T &) needs a move-assignable T");
+		lock_type lock(m);
+
+		if (!count)
+			return false;
+		value = take();
+		wake(lock, not_full, push_waiters, 1);
+		return true;
+	}
+
+	// Moves the oldest element to value, blocking while the queue is empty
+	// for at most rel_time. Returns true if an element was popped,
+	// otherwise returns false.
+	template <class Rep, class Period>
+	bool try_pop_for(T &value,
+			 const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		static_assert(std::is_move_assignable<T>::value,
+			      "try_pop_for() needs a move-assignable T");
+		lock_type lock(m);
+
+		if (!count && !wait_not_empty_for(lock, rel_time))
+			return false;
+		value = take();
+		wake(lock, not_full, push_waiters, 1);
+		return true;
+	}
+
+	// Moves up to max of the oldest elements to out, blocking while the
+	// queue is empty. Returns the number of elements popped, at least one
+	// unless max is 0.
+	template <class OutputIt> size_type pop(OutputIt out, size_type max)
+	{
+		lock_type lock(m);
+		size_type n;
+
+		if (!max)
+			return 0;
+		if (!count)
+			wait_not_empty(lock);
+		for (n = 0; n < max && count; n++)
+			*out++ = take();
+		wake(lock, not_full, push_waiters, n);
+		return n;
+	}
+
+	// As pop(out, max), but returns 0 immediately if the queue is empty.
+	template <class OutputIt> size_type try_pop(OutputIt out, size_type max)
+	{
+		lock_type lock(m);
+		size_type n;
+
+		for (n = 0; n < max && count; n++)
+			*out++ = take();
+		wake(lock, not_full, push_waiters, n);
+		return n;
+	}
+
+	// Returns the number of queued elements.
+	size_type size()
+	{
+		lock_type lock(m);
+
+		return count;
+	}
+
+	bool empty()
+	{
+		return !size();
+	}
+
+	// Returns the maximum number of queued elements.
+	size_type capacity() const noexcept
+	{
+		return cap;
+	}
+};
+
+} // namespace rtpi
+
+#endif
@@ -56,6 +56,14 @@ class condition_variable {
 		pi_cond_signal(&c, lock.mutex()->native_handle());
 	}
 
+	// Unblocks up to n of the threads waiting on *this, the highest
+	// priority ones first, with a single requeue.
+	void notify_n(std::unique_lock<rtpi::mutex> &lock,
+		      unsigned int n) noexcept
+	{
+		pi_cond_signal_n(&c, lock.mutex()->native_handle(), n);
+	}
+
 	// Unblocks all threads currently waiting for *this.
 	void notify_all(std::unique_lock<rtpi::mutex> &lock) noexcept
 	{
@@ -96,19 +104,38 @@ class condition_variable {
 	cv_status wait_for(std::unique_lock<rtpi::mutex> &lock,
 			   const std::chrono::duration<Clock, Period> &rel_time)
 	{
-		using duration = std::chrono::steady_clock::duration;
+		using std::chrono::nanoseconds;
 
-		// When converting from a floating-point rel_time to the
-		// (integer) steady_clock duration type, the loss of precision
-		// may result in the time being rounded down, so round it
-		// back up if necessary.
+		// When converting from a floating-point rel_time to integer
+		// nanoseconds, the loss of precision may result in the time
+		// being rounded down, so round it back up if necessary.
 		auto relative_time =
-			std::chrono::duration_cast<duration>(rel_time);
+			std::chrono::duration_cast<nanoseconds>(rel_time);
 		if (relative_time < rel_time)
 			++relative_time;
+		if (relative_time < nanoseconds::zero())
+			relative_time = nanoseconds::zero();
+
+		auto s = std::chrono::duration_cast<std::chrono::seconds>(
+			relative_time);
+		struct timespec ts = {
+			static_cast<std::time_t>(s.count()),
+			static_cast<long>((relative_time - s).count())
+		};
+
+		// pi_cond_reltimedwait reads CLOCK_MONOTONIC once, in the
+		// library, rather than here through steady_clock::now().
+		int e = pi_cond_reltimedwait(&c, lock.mutex()->native_handle(),
+					     &ts);
 
-		return wait_until(lock, std::chrono::steady_clock::now() +
-						relative_time);
+		if (e == 0) {
+			return cv_status::no_timeout;
+		} else if (e == ETIMEDOUT) {
+			return cv_status::timeout;
+		} else {
+			throw std::system_error(
+				std::error_code(e, std::generic_category()));
+		}
 	}
 
 	// Overload that takes a predicate. This overload may be used to
@@ -144,7 +171,18 @@ class condition_variable {
 		   const std::chrono::time_point<std::chrono::steady_clock,
 						 Duration> &timeout_time)
 	{
-		return wait_until_impl(lock, timeout_time);
+		return wait_until_impl(lock, timeout_time, CLOCK_MONOTONIC);
+	}
+
+	// system_clock deadlines wait against CLOCK_REALTIME in the kernel,
+	// so they follow clock adjustments without a conversion.
+	template <class Duration>
+	cv_status
+	wait_until(std::unique_lock<rtpi::mutex> &lock,
+		   const std::chrono::time_point<std::chrono::system_clock,
+						 Duration> &timeout_time)
+	{
+		return wait_until_impl(lock, timeout_time, CLOCK_REALTIME);
 	}
 
 	template <class Clock, class Duration>
@@ -162,7 +200,8 @@ class condition_variable {
 		const auto delta = timeout_time - user_clock_entry;
 		const auto steady_timeout_time = steady_clock_entry + delta;
 
-		if (wait_until_impl(lock, steady_timeout_time) ==
+		if (wait_until_impl(lock, steady_timeout_time,
+				    CLOCK_MONOTONIC) ==
 		    cv_status::no_timeout) {
 			return cv_status::no_timeout;
 		}
@@ -185,7 +224,7 @@ class condition_variable {
 		   const std::chrono::time_point<Clock, Duration> &timeout_time,
 		   Predicate stop_waiting)
 	{
-		while (!stop_waiting) {
+		while (!stop_waiting()) {
 			if (wait_until(lock, timeout_time) ==
 			    cv_status::timeout)
 				return stop_waiting();
@@ -203,11 +242,11 @@ class condition_variable {
 	}
 
     private:
-	template <class Duration>
+	template <class Clock, class Duration>
 	cv_status
 	wait_until_impl(std::unique_lock<rtpi::mutex> &lock,
-			const std::chrono::time_point<std::chrono::steady_clock,
-						      Duration> &timeout_time)
+			const std::chrono::time_point<Clock, Duration> &timeout_time,
+			clockid_t clock)
 	{
 		auto s = std::chrono::time_point_cast<std::chrono::seconds>(
 			timeout_time);
@@ -218,9 +257,9 @@ class condition_variable {
 					       s.time_since_epoch().count()),
 				       static_cast<long>(ns.count()) };
 
-		// pi_cond_timedwait uses CLOCK_MONOTONIC (steady_clock)
-		int e = pi_cond_timedwait(&c, lock.mutex()->native_handle(),
-					  &ts);
+		// CLOCK_MONOTONIC is steady_clock, CLOCK_REALTIME system_clock
+		int e = pi_cond_clockwait(&c, lock.mutex()->native_handle(),
+					  clock, &ts);
 
 		if (e == 0) {
 			return cv_status::no_timeout;
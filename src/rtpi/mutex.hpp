@@ -16,6 +16,9 @@ namespace rtpi
 // The API is based on the C++ std::mutex API.
 //
 // The mutex class satisfies the Mutex named requirement.
+//
+// Define RTPI_INLINE_FASTPATH before including this header to inline the
+// uncontended lock, try_lock and unlock paths.
 
 class mutex {
     private:
@@ -77,6 +80,145 @@ class mutex {
 	{
 		return &m;
 	}
+
+    protected:
+	// Constructs the mutex with the given RTPI_MUTEX_* flags, for the
+	// mutex variants below.
+	explicit constexpr mutex(uint32_t flags) noexcept
+		: m(PI_MUTEX_INIT(flags))
+	{
+	}
+};
+
+// The adaptive_mutex class is a mutex which spins for a bounded, self-tuning
+// number of iterations before blocking in the kernel (RTPI_MUTEX_ADAPTIVE).
+// It is a mutex, so it can be used with rtpi::condition_variable.
+
+class adaptive_mutex : public mutex {
+    public:
+	// Constructs the mutex. The mutex is in unlocked state after the constructor completes.
+	constexpr adaptive_mutex() noexcept : mutex(RTPI_MUTEX_ADAPTIVE)
+	{
+	}
+};
+
+// The stats_mutex class is a mutex which keeps per-lock contention counters
+// (RTPI_MUTEX_STATS), read back with stats(). It is a mutex, so it can be
+// used with rtpi::condition_variable.
+
+class stats_mutex : public mutex {
+    public:
+	typedef pi_mutex_stats stats_type;
+
+	// Constructs the mutex. The mutex is in unlocked state after the constructor completes.
+	constexpr stats_mutex() noexcept : mutex(RTPI_MUTEX_STATS)
+	{
+	}
+
+	// Returns a snapshot of the contention counters.
+	stats_type stats()
+	{
+		stats_type s;
+
+		pi_mutex_get_stats(native_handle(), &s);
+		return s;
+	}
+};
+
+// The hybrid_mutex class is a mutex whose SCHED_OTHER contenders block
+// without priority inheritance, switching to the PI protocol only when a
+// real-time thread contends (RTPI_MUTEX_HYBRID). It is a mutex, so it can be
+// used with rtpi::condition_variable.
+
+class hybrid_mutex : public mutex {
+    public:
+	// Constructs the mutex. The mutex is in unlocked state after the constructor completes.
+	constexpr hybrid_mutex() noexcept : mutex(RTPI_MUTEX_HYBRID)
+	{
+	}
+};
+
+// The ceiling_mutex class is a mutex with the priority ceiling protocol
+// (RTPI_MUTEX_PROTECT): a thread holding it runs at SCHED_FIFO priority
+// Ceiling or above. It is a mutex, so it can be used with
+// rtpi::condition_variable.
+
+template <int Ceiling> class ceiling_mutex : public mutex {
+	static_assert(Ceiling >= 1 && Ceiling <= 99,
+		      "Ceiling must be a SCHED_FIFO priority");
+
+    public:
+	// Constructs the mutex. The mutex is in unlocked state after the constructor completes.
+	constexpr ceiling_mutex() noexcept
+		: mutex(RTPI_MUTEX_PROTECT | RTPI_MUTEX_CEILING(Ceiling))
+	{
+	}
+};
+
+// The compact_mutex class is an 8-byte mutex for large lock tables, trading
+// the cache line isolation of mutex for density. It cannot be used with
+// rtpi::condition_variable.
+//
+// The compact_mutex class satisfies the Mutex named requirement.
+
+class compact_mutex {
+    private:
+	pi_mutex_compact m;
+
+    public:
+	typedef pi_mutex_compact *native_handle_type;
+
+	// Constructs the mutex. The mutex is in unlocked state after the constructor completes.
+	constexpr compact_mutex() noexcept : m(PI_MUTEX_COMPACT_INIT(0))
+	{
+	}
+
+	// Copy constructor is deleted.
+	compact_mutex(const compact_mutex &) = delete;
+
+	// Destroys the mutex.
+	~compact_mutex()
+	{
+		pi_mutex_compact_destroy(&m);
+	}
+
+	// Not copy-assignable.
+	const compact_mutex &operator=(const compact_mutex &) = delete;
+
+	// Locks the mutex. If another thread has already locked the mutex,
+	// a call to lock will block execution until the lock is acquired.
+	void lock()
+	{
+		int e = pi_mutex_compact_lock(&m);
+
+		if (e)
+			throw std::system_error(
+				std::error_code(e, std::generic_category()));
+	}
+
+	// Tries to lock the mutex. Returns immediately. On successful lock
+	// acquisition returns true, otherwise returns false.
+	bool try_lock()
+	{
+		// can return EBUSY or EDEADLOCK
+		return !pi_mutex_compact_trylock(&m);
+	}
+
+	// Unlocks the mutex.
+	void unlock()
+	{
+		// pi_mutex_compact_unlock might fail, but the Mutex
+		// requirement states that unlock does not throw exceptions.
+		pi_mutex_compact_unlock(&m);
+	}
+
+	// Returns the underlying implementation-defined native handle object.
+	//
+	// for librtpi, this is a pi_mutex_compact*.
+	native_handle_type native_handle()
+	{
+		return &m;
+	}
 };
 
 } // namespace rtpi
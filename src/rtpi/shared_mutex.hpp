@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef RTPI_SHARED_MUTEX_HPP
+#define RTPI_SHARED_MUTEX_HPP
+
+#include <chrono>
+#include <mutex>
+#include <system_error>
+
+#include "rtpi.h"
+
+namespace rtpi
+{
+// The shared_mutex class is a synchronization primitive that can be used to
+// protect shared data from being simultaneously accessed by multiple threads.
+// Readers share the lock without entering the kernel while no writer is
+// around; threads blocking on a writer boost it through priority
+// inheritance.
+//
+// The API is based on the C++ std::shared_mutex API, and works with
+// std::unique_lock and std::shared_lock. A thread must not take the shared
+// lock recursively: once a writer is waiting, new readers queue behind it.
+//
+// The shared_mutex class satisfies the SharedMutex named requirement.
+
+class shared_mutex {
+    protected:
+	pi_rwlock rw;
+
+	static void check(int e)
+	{
+		if (e)
+			throw std::system_error(
+				std::error_code(e, std::generic_category()));
+	}
+
+    public:
+	typedef pi_rwlock *native_handle_type;
+
+	// Constructs the mutex. The mutex is in unlocked state after the constructor completes.
+	constexpr shared_mutex() noexcept : rw(PI_RWLOCK_INIT(0))
+	{
+	}
+
+	// Copy constructor is deleted.
+	shared_mutex(const shared_mutex &) = delete;
+
+	// Destroys the mutex.
+	~shared_mutex()
+	{
+		pi_rwlock_destroy(&rw);
+	}
+
+	// Not copy-assignable.
+	const shared_mutex &operator=(const shared_mutex &) = delete;
+
+	// Locks the mutex exclusively, blocking until no other thread holds
+	// it in any mode.
+	void lock()
+	{
+		check(pi_rwlock_wrlock(&rw));
+	}
+
+	// Tries to lock the mutex exclusively. Returns immediately. On
+	// successful lock acquisition returns true, otherwise returns false.
+	bool try_lock()
+	{
+		// can return EBUSY or EDEADLOCK
+		return !pi_rwlock_trywrlock(&rw);
+	}
+
+	// Unlocks the mutex.
+	void unlock()
+	{
+		// pi_rwlock_unlock might fail, but the Mutex requirement states
+		// that unlock does not throw exceptions.
+		pi_rwlock_unlock(&rw);
+	}
+
+	// Locks the mutex in shared mode, blocking while a writer holds or
+	// waits for it.
+	void lock_shared()
+	{
+		check(pi_rwlock_rdlock(&rw));
+	}
+
+	// Tries to lock the mutex in shared mode. Returns immediately. On
+	// successful lock acquisition returns true, otherwise returns false.
+	bool try_lock_shared()
+	{
+		return !pi_rwlock_tryrdlock(&rw);
+	}
+
+	// Unlocks the mutex from shared mode.
+	void unlock_shared()
+	{
+		pi_rwlock_unlock(&rw);
+	}
+
+	// Returns the underlying implementation-defined native handle object.
+	//
+	// for librtpi, this is a pi_rwlock*.
+	native_handle_type native_handle()
+	{
+		return &rw;
+	}
+};
+
+// The shared_timed_mutex class is a shared_mutex which can also be locked,
+// in either mode, with a timeout.
+//
+// The API is based on the C++ std::shared_timed_mutex API.
+//
+// The shared_timed_mutex class satisfies the SharedTimedMutex named
+// requirement.
+
+class shared_timed_mutex : public shared_mutex {
+    public:
+	// Tries to lock the mutex exclusively, blocking until the relative
+	// timeout rel_time has elapsed or the lock is acquired.
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		return try_lock_until(std::chrono::steady_clock::now() +
+				      round_up(rel_time));
+	}
+
+	// Tries to lock the mutex exclusively, blocking until the absolute
+	// time point timeout_time is reached or the lock is acquired.
+	template <class Clock, class Duration>
+	bool
+	try_lock_until(const std::chrono::time_point<Clock, Duration> &timeout_time)
+	{
+		return until(pi_rwlock_timedwrlock, timeout_time);
+	}
+
+	// Tries to lock the mutex in shared mode, blocking until the relative
+	// timeout rel_time has elapsed or the lock is acquired.
+	template <class Rep, class Period>
+	bool
+	try_lock_shared_for(const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		return try_lock_shared_until(std::chrono::steady_clock::now() +
+					     round_up(rel_time));
+	}
+
+	// Tries to lock the mutex in shared mode, blocking until the absolute
+	// time point timeout_time is reached or the lock is acquired.
+	template <class Clock, class Duration>
+	bool try_lock_shared_until(
+		const std::chrono::time_point<Clock, Duration> &timeout_time)
+	{
+		return until(pi_rwlock_timedrdlock, timeout_time);
+	}
+
+    private:
+	typedef int (*timedlock_fn)(pi_rwlock_t *, const struct timespec *);
+
+	template <class Rep, class Period>
+	static std::chrono::steady_clock::duration
+	round_up(const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		using duration = std::chrono::steady_clock::duration;
+
+		// If the conversion requires it, round up.
+		auto relative_time =
+			std::chrono::duration_cast<duration>(rel_time);
+		if (relative_time < rel_time)
+			++relative_time;
+		return relative_time;
+	}
+
+	template <class Duration>
+	bool until(timedlock_fn fn,
+		   const std::chrono::time_point<std::chrono::steady_clock,
+						 Duration> &timeout_time)
+	{
+		return until_impl(fn, timeout_time);
+	}
+
+	template <class Clock, class Duration>
+	bool until(timedlock_fn fn,
+		   const std::chrono::time_point<Clock, Duration> &timeout_time)
+	{
+		using std::chrono::steady_clock;
+
+		// The pi_rwlock timed calls only know CLOCK_MONOTONIC, so
+		// convert and retry until the caller-supplied clock has
+		// expired.
+		do {
+			const auto delta = timeout_time - Clock::now();
+			if (until_impl(fn, steady_clock::now() + delta))
+				return true;
+		} while (Clock::now() < timeout_time);
+
+		return false;
+	}
+
+	template <class Duration>
+	bool until_impl(timedlock_fn fn,
+			const std::chrono::time_point<std::chrono::steady_clock,
+						      Duration> &timeout_time)
+	{
+		auto s = std::chrono::time_point_cast<std::chrono::seconds>(
+			timeout_time);
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			timeout_time - s);
+
+		struct timespec ts = { static_cast<std::time_t>(
+					       s.time_since_epoch().count()),
+				       static_cast<long>(ns.count()) };
+
+		int e = fn(&rw, &ts);
+
+		if (e == 0) {
+			return true;
+		} else if (e == ETIMEDOUT || e == EDEADLOCK) {
+			return false;
+		} else {
+			throw std::system_error(
+				std::error_code(e, std::generic_category()));
+		}
+	}
+};
+
+} // namespace rtpi
+
+#endif
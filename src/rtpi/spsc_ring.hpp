@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef RTPI_SPSC_RING_HPP
+#define RTPI_SPSC_RING_HPP
+
+#include <cstddef>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "rtpi.h"
+
+namespace rtpi
+{
+// The spsc_ring class is a fixed-capacity FIFO queue between exactly one
+// producer thread and one consumer thread (pi_spsc_ring_t). While the ring
+// is neither full nor empty, push and pop are lock-free. A side that has to
+// block sleeps on a PI condvar, and the other side takes the ring's PI mutex
+// only to wake it.
+//
+// Elements are constructed in place in the ring, so T only needs to be
+// move-constructible.
+
+template <class T, std::size_t N> class spsc_ring {
+	static_assert(N && !(N & (N - 1)), "N must be a power of two");
+	static_assert(std::is_move_constructible<T>::value,
+		      "T must be move-constructible");
+
+    private:
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+
+	pi_spsc_ring ring;
+	slot slots[N];
+
+	static void check(int e)
+	{
+		if (e)
+			throw std::system_error(
+				std::error_code(e, std::generic_category()));
+	}
+
+	void *reserve()
+	{
+		void *p;
+
+		while (!(p = pi_spsc_ring_reserve(&ring)))
+			check(pi_spsc_ring_wait_space(&ring));
+		return p;
+	}
+
+	T *front()
+	{
+		void *p;
+
+		while (!(p = pi_spsc_ring_front(&ring)))
+			check(pi_spsc_ring_wait_data(&ring));
+		return static_cast<T *>(p);
+	}
+
+	T take(T *p)
+	{
+		T v(std::move(*p));
+
+		p->~T();
+		check(pi_spsc_ring_release(&ring));
+		return v;
+	}
+
+    public:
+	typedef T value_type;
+
+	// Constructs an empty ring.
+	spsc_ring()
+	{
+		check(pi_spsc_ring_init(&ring, slots, N, sizeof(slot), 0));
+	}
+
+	// Copy constructor is deleted.
+	spsc_ring(const spsc_ring &) = delete;
+
+	// Destroys the elements left in the ring.
+	~spsc_ring()
+	{
+		void *p;
+
+		while ((p = pi_spsc_ring_front(&ring))) {
+			static_cast<T *>(p)->~T();
+			pi_spsc_ring_release(&ring);
+		}
+		pi_spsc_ring_destroy(&ring);
+	}
+
+	// Not copy-assignable.
+	const spsc_ring &operator=(const spsc_ring &) = delete;
+
+	// Appends value, blocking while the ring is full. Producer only.
+	void push(const T &value)
+	{
+		emplace(value);
+	}
+
+	void push(T &&value)
+	{
+		emplace(std::move(value));
+	}
+
+	template <class... Args> void emplace(Args &&...args)
+	{
+		::new (reserve()) T(std::forward<Args>(args)...);
+		check(pi_spsc_ring_commit(&ring));
+	}
+
+	// Appends value if the ring is not full. Returns immediately. Returns
+	// true if value was queued, otherwise returns false. Producer only.
+	bool try_push(const T &value)
+	{
+		return try_emplace(value);
+	}
+
+	bool try_push(T &&value)
+	{
+		return try_emplace(std::move(value));
+	}
+
+	template <class... Args> bool try_emplace(Args &&...args)
+	{
+		void *p = pi_spsc_ring_reserve(&ring);
+
+		if (!p)
+			return false;
+		::new (p) T(std::forward<Args>(args)...);
+		check(pi_spsc_ring_commit(&ring));
+		return true;
+	}
+
+	// Removes and returns the oldest element, blocking while the ring is
+	// empty. Consumer only.
+	T pop()
+	{
+		return take(front());
+	}
+
+	// Moves the oldest element to value if the ring is not empty. Returns
+	// immediately. Returns true if an element was popped, otherwise
+	// returns false. Consumer only.
+	bool try_pop(T &value)
+	{
+		void *p = pi_spsc_ring_front(&ring);
+
+		if (!p)
+			return false;
+		value = take(static_cast<T *>(p));
+		return true;
+	}
+
+	// Returns the maximum number of queued elements.
+	constexpr std::size_t capacity() const noexcept
+	{
+		return N;
+	}
+
+	// Returns the underlying ring.
+	pi_spsc_ring *native_handle()
+	{
+		return &ring;
+	}
+};
+
+} // namespace rtpi
+
+#endif
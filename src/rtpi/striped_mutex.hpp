@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef RTPI_STRIPED_MUTEX_HPP
+#define RTPI_STRIPED_MUTEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <type_traits>
+
+#include "rtpi.h"
+#include "rtpi/mutex.hpp"
+
+namespace rtpi
+{
+// The striped_mutex class protects a large set of objects with N mutexes,
+// selecting the mutex for an object by hashing its address or key
+// (pi_lock_table_t). Each stripe is an rtpi::mutex on its own cache line,
+// so it works with std::unique_lock and rtpi::condition_variable.
+//
+// lock_keys and unlock_keys take several keys at once in a canonical order,
+// so threads locking overlapping sets of keys cannot deadlock.
+
+template <std::size_t N> class striped_mutex {
+	static_assert(N && !(N & (N - 1)), "N must be a power of two");
+	static_assert(sizeof(mutex) == sizeof(pi_mutex),
+		      "rtpi::mutex must be layout compatible with pi_mutex");
+
+    private:
+	mutex stripes[N];
+	pi_lock_table table;
+
+	static std::uintptr_t to_key(const void *addr)
+	{
+		return reinterpret_cast<std::uintptr_t>(addr);
+	}
+
+	template <class T>
+	static typename std::enable_if<std::is_integral<T>::value,
+				       std::uintptr_t>::type
+	to_key(T key)
+	{
+		return static_cast<std::uintptr_t>(key);
+	}
+
+	static void check(int e)
+	{
+		if (e)
+			throw std::system_error(
+				std::error_code(e, std::generic_category()));
+	}
+
+    public:
+	// Constructs the table. All stripes are unlocked after the constructor completes.
+	striped_mutex()
+	{
+		check(pi_lock_table_init(&table, stripes[0].native_handle(), N,
+					 0));
+	}
+
+	// Copy constructor is deleted.
+	striped_mutex(const striped_mutex &) = delete;
+
+	// Not copy-assignable.
+	const striped_mutex &operator=(const striped_mutex &) = delete;
+
+	// Returns the stripe protecting key.
+	template <class Key> mutex &operator[](const Key &key)
+	{
+		return stripes[pi_lock_table_index(&table, to_key(key))];
+	}
+
+	// Locks the stripe protecting key.
+	template <class Key> void lock(const Key &key)
+	{
+		(*this)[key].lock();
+	}
+
+	// Tries to lock the stripe protecting key. Returns immediately. On
+	// successful lock acquisition returns true, otherwise returns false.
+	template <class Key> bool try_lock(const Key &key)
+	{
+		return (*this)[key].try_lock();
+	}
+
+	// Unlocks the stripe protecting key.
+	template <class Key> void unlock(const Key &key)
+	{
+		(*this)[key].unlock();
+	}
+
+	// Locks the stripes protecting all keys, each stripe once, in the
+	// canonical order. At most RTPI_LOCK_TABLE_MAX_KEYS keys.
+	template <class... Keys> void lock_keys(const Keys &...keys)
+	{
+		const std::uintptr_t k[] = { to_key(keys)... };
+
+		check(pi_lock_table_lock_n(&table, k, sizeof...(keys)));
+	}
+
+	// Unlocks the stripes locked by lock_keys with the same keys.
+	template <class... Keys> void unlock_keys(const Keys &...keys)
+	{
+		const std::uintptr_t k[] = { to_key(keys)... };
+
+		pi_lock_table_unlock_n(&table, k, sizeof...(keys));
+	}
+
+	// Returns the underlying lock table.
+	pi_lock_table *native_handle()
+	{
+		return &table;
+	}
+};
+
+} // namespace rtpi
+
+#endif
@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef RTPI_TIMED_MUTEX_HPP
+#define RTPI_TIMED_MUTEX_HPP
+
+#include <chrono>
+#include <mutex>
+#include <system_error>
+
+#include "rtpi.h"
+
+namespace rtpi
+{
+// The timed_mutex class is a synchronization primitive that can be used to
+// protect shared data from being simultaneously accessed by multiple threads,
+// with bounded blocking through try_lock_for and try_lock_until.
+//
+// The API is based on the C++ std::timed_mutex API.
+//
+// The timed_mutex class satisfies the TimedMutex named requirement.
+
+class timed_mutex {
+    private:
+	pi_mutex m;
+
+    public:
+	typedef pi_mutex *native_handle_type;
+
+	// Constructs the mutex. The mutex is in unlocked state after the constructor completes.
+	constexpr timed_mutex() noexcept : m(PI_MUTEX_INIT(0))
+	{
+	}
+
+	// Copy constructor is deleted.
+	timed_mutex(const timed_mutex &) = delete;
+
+	// Destroys the mutex.
+	~timed_mutex()
+	{
+		pi_mutex_destroy(&m);
+	}
+
+	// Not copy-assignable.
+	const timed_mutex &operator=(const timed_mutex &) = delete;
+
+	// Locks the mutex. If another thread has already locked the mutex,
+	// a call to lock will block execution until the lock is acquired.
+	void lock()
+	{
+		int e = pi_mutex_lock(&m);
+
+		if (e)
+			throw std::system_error(
+				std::error_code(e, std::generic_category()));
+	}
+
+	// Tries to lock the mutex. Returns immediately. On successful lock
+	// acquisition returns true, otherwise returns false.
+	bool try_lock()
+	{
+		// can return EBUSY or EDEADLOCK
+		return !pi_mutex_trylock(&m);
+	}
+
+	// Tries to lock the mutex, blocking until the relative timeout
+	// rel_time has elapsed or the lock is acquired. Returns true on
+	// successful lock acquisition, otherwise returns false.
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		using std::chrono::nanoseconds;
+
+		// If the conversion requires it, round up.
+		auto relative_time =
+			std::chrono::duration_cast<nanoseconds>(rel_time);
+		if (relative_time < rel_time)
+			++relative_time;
+		if (relative_time < nanoseconds::zero())
+			relative_time = nanoseconds::zero();
+
+		auto s = std::chrono::duration_cast<std::chrono::seconds>(
+			relative_time);
+		struct timespec ts = {
+			static_cast<std::time_t>(s.count()),
+			static_cast<long>((relative_time - s).count())
+		};
+
+		// An uncontended pi_mutex_reltimedlock does not read the clock
+		return lock_result(pi_mutex_reltimedlock(&m, &ts));
+	}
+
+	// Tries to lock the mutex, blocking until the absolute time point
+	// timeout_time is reached or the lock is acquired. Returns true on
+	// successful lock acquisition, otherwise returns false.
+	template <class Duration>
+	bool try_lock_until(
+		const std::chrono::time_point<std::chrono::steady_clock,
+					      Duration> &timeout_time)
+	{
+		return try_lock_until_impl(timeout_time);
+	}
+
+	template <class Clock, class Duration>
+	bool
+	try_lock_until(const std::chrono::time_point<Clock, Duration> &timeout_time)
+	{
+		using std::chrono::steady_clock;
+
+		// pi_mutex_timedlock only knows CLOCK_MONOTONIC, so convert
+		// and retry until the caller-supplied clock has expired.
+		do {
+			const auto delta = timeout_time - Clock::now();
+			if (try_lock_until_impl(steady_clock::now() + delta))
+				return true;
+		} while (Clock::now() < timeout_time);
+
+		return false;
+	}
+
+	// Unlocks the mutex.
+	void unlock()
+	{
+		pi_mutex_unlock(&m);
+
+		// pi_mutex_unlock might fail (EPERM, or errno from futex)
+		// but the Mutex requirement states that unlock does not
+		// throw exceptions.
+	}
+
+	// Returns the underlying implementation-defined native handle object.
+	//
+	// for librtpi, this is a pi_mutex*.
+	native_handle_type native_handle()
+	{
+		return &m;
+	}
+
+    private:
+	template <class Duration>
+	bool try_lock_until_impl(
+		const std::chrono::time_point<std::chrono::steady_clock,
+					      Duration> &timeout_time)
+	{
+		auto s = std::chrono::time_point_cast<std::chrono::seconds>(
+			timeout_time);
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			timeout_time - s);
+
+		struct timespec ts = { static_cast<std::time_t>(
+					       s.time_since_epoch().count()),
+				       static_cast<long>(ns.count()) };
+
+		// pi_mutex_timedlock uses CLOCK_MONOTONIC (steady_clock)
+		return lock_result(pi_mutex_timedlock(&m, &ts));
+	}
+
+	static bool lock_result(int e)
+	{
+		if (e == 0) {
+			return true;
+		} else if (e == ETIMEDOUT || e == EDEADLOCK) {
+			return false;
+		} else {
+			throw std::system_error(
+				std::error_code(e, std::generic_category()));
+		}
+	}
+};
+
+} // namespace rtpi
+
+#endif
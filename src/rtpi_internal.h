@@ -8,11 +8,25 @@
 
 /*
  * PI Mutex
+ *
+ * spins is the learned spin budget of an RTPI_MUTEX_ADAPTIVE mutex. hwait is
+ * the non-PI futex word that SCHED_OTHER contenders of an RTPI_MUTEX_HYBRID
+ * mutex sleep on. The remaining fields are the contention counters of an
+ * RTPI_MUTEX_STATS mutex, only written by the owner; lock_ns is the time the
+ * owner acquired it.
  */
 union pi_mutex {
 	struct {
 		__u32	futex;
 		__u32	flags;
+		__u32	spins;
+		__u32	hwait;
+		__u64	nr_fast;
+		__u64	nr_slow;
+		__u64	wait_ns;
+		__u64	max_wait_ns;
+		__u64	max_hold_ns;
+		__u64	lock_ns;
 	};
 	__u8 pad[64];
 } __attribute__ ((aligned(64)));
@@ -21,37 +35,157 @@ union pi_mutex {
 #define PI_MUTEX_INIT(f) { .futex = 0, .flags = f }
 #else
 inline constexpr pi_mutex PI_MUTEX_INIT(__u32 f) {
-	return pi_mutex{ 0, f };
+	return pi_mutex{ 0, f, 0, 0, 0, 0, 0, 0, 0, 0 };
 }
 #endif
 
+/*
+ * Compact PI Mutex
+ *
+ * The futex word and flags of a PI mutex without the cache line padding.
+ */
+struct pi_mutex_compact {
+	__u32	futex;
+	__u32	flags;
+} __attribute__ ((aligned(8)));
+
+#ifndef __cplusplus
+#define PI_MUTEX_COMPACT_INIT(f) { .futex = 0, .flags = f }
+#else
+inline constexpr pi_mutex_compact PI_MUTEX_COMPACT_INIT(__u32 f) {
+	return pi_mutex_compact{ 0, f };
+}
+#endif
+
+/*
+ * PI Lock Table
+ *
+ * An array of 1 << bits PI mutexes, one cache line each, selected by a
+ * multiplicative hash of the key.
+ */
+struct pi_lock_table {
+	union pi_mutex	*stripes;
+	__u32		bits;
+	__u32		flags;
+};
+
 /*
  * PI Cond
+ *
+ * cond is the FUTEX_WAIT_REQUEUE_PI futex word, a sequence bumped by every
+ * signal and broadcast. state packs the waiter bookkeeping into a single
+ * word so it can be updated with one CAS: the upper 32 bits count registered
+ * waiters, the lower 32 bits count wakeups granted but not yet consumed.
  */
 union pi_cond {
 	struct {
-		union pi_mutex	priv_mut;
 		__u32		cond;
 		__u32		flags;
-		__u32		wake_id;
-		__u32		pending_wake;
-		__u32		pending_wait;
+		__u64		state;
 	};
 	__u8 pad[128];
 } __attribute__ ((aligned(64)));
 
 #ifndef __cplusplus
 #define PI_COND_INIT(f) \
-	{ .priv_mut = PI_MUTEX_INIT(f) \
-	, .cond = 0 \
+	{ .cond = 0 \
 	, .flags = f \
-	, .wake_id = 0 \
-	, .pending_wake = 0 \
-	, .pending_wait = 0 }
+	, .state = 0 }
 #else
 inline constexpr pi_cond PI_COND_INIT(__u32 f) {
-	return pi_cond{ PI_MUTEX_INIT(f), 0, f, 0, 0, 0 };
+	return pi_cond{ 0, f, 0 };
+}
+#endif
+
+/*
+ * PI Reader-Writer Lock
+ *
+ * wlock is the PI mutex held by the writer, and by blocked readers just long
+ * enough to register. readers counts the read lock holders in its low 31
+ * bits; the top bit is set by a writer holding wlock, which turns new
+ * readers away from the lock-free path and onto wlock. readers sits on its
+ * own cache line so readers do not bounce the writer's futex.
+ */
+union pi_rwlock {
+	struct {
+		union pi_mutex	wlock;
+		__u32		readers;
+		__u32		flags;
+	};
+	__u8 pad[128];
+} __attribute__ ((aligned(64)));
+
+#ifndef __cplusplus
+#define PI_RWLOCK_INIT(f) \
+	{ .wlock = PI_MUTEX_INIT(f) \
+	, .readers = 0 \
+	, .flags = f }
+#else
+inline constexpr pi_rwlock PI_RWLOCK_INIT(__u32 f) {
+	return pi_rwlock{ PI_MUTEX_INIT(f), 0, f };
 }
 #endif
 
+/*
+ * PI SPSC Ring
+ *
+ * tail is only written by the producer and head by the consumer, each on its
+ * own cache line along with that side's cached copy of the other index. The
+ * indices run freely and are masked into the 1 << n slots at data_off bytes
+ * from the ring. waiting flags a side blocked on cond, so the other side
+ * only takes lock to wake it when needed.
+ */
+struct pi_spsc_ring {
+	__u32		tail __attribute__ ((aligned(64)));
+	__u32		head_cache;
+	__u32		head __attribute__ ((aligned(64)));
+	__u32		tail_cache;
+	__u32		waiting __attribute__ ((aligned(64)));
+	__u32		mask;
+	__u32		elem_size;
+	__u32		flags;
+	__s64		data_off;
+	union pi_mutex	lock;
+	union pi_cond	cond;
+};
+
+/*
+ * PI Message Queue
+ *
+ * The header of a message queue, followed in the same block by the next
+ * links of its slots and by the slots themselves. Slots are linked by index,
+ * so that a shared queue works at any address.
+ */
+struct pi_mqueue_list {
+	__u32		head;
+	__u32		tail;
+};
+
+struct pi_mqueue {
+	union pi_mutex	lock;
+	union pi_cond	not_empty;
+	union pi_cond	not_full;
+	__u32		nr;
+	__u32		msg_size;
+	__u32		stride;		/* slot size, whole cache lines */
+	__u32		flags;
+	__u32		free;		/* stack of free slots */
+	__u32		prio_map;	/* bit n set while queue[n] is not empty */
+	__u32		data_off;
+	/* One list per priority, RTPI_MQUEUE_PRIO_MAX */
+	struct pi_mqueue_list queue[32];
+};
+
+/*
+ * PI Shared Memory Arena
+ *
+ * The process-local handle of an arena: the file descriptor of the shared
+ * memory region and where it is mapped.
+ */
+struct pi_shm_arena {
+	void		*base;
+	size_t		size;
+	int		fd;
+};
+
 #endif // RPTI_H_INTERNAL_H
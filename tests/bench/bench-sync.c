@@ -0,0 +1,353 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * Micro-benchmarks for the librtpi mutex and condvar primitives, each run
+ * side by side against pthread_mutex_t (PTHREAD_PRIO_INHERIT) and
+ * pthread_cond_t. rtpi-hybrid runs them with RTPI_MUTEX_HYBRID mutexes, so
+ * the contended runs show what non-PI blocking saves between SCHED_OTHER
+ * threads:
+ *
+ *   lock-unlock        uncontended lock/unlock pair
+ *   trylock-unlock     uncontended trylock/unlock pair
+ *   contended          lock/unlock throughput at 1..N threads
+ *   contended-yield    as contended, yielding the CPU while holding the
+ *                      lock so that nearly every acquisition blocks
+ *   cond-pingpong      signal/wait round trip between two threads
+ *   signal-idle        pi_cond_signal with no waiters
+ *   broadcast-idle     pi_cond_broadcast with no waiters
+ *   broadcast-wake     broadcast until all N waiters have run
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+static const struct bench_sync *mutex_impls[] = {
+	&bench_rtpi,
+	&bench_rtpi_inline,
+	&bench_rtpi_hybrid,
+	&bench_pthread,
+};
+
+/*
+ * The inline fast paths do not change the condvar calls. A hybrid mutex
+ * does, as the woken waiter's mutex may be contended.
+ */
+static const struct bench_sync *cond_impls[] = {
+	&bench_rtpi,
+	&bench_rtpi_hybrid,
+	&bench_pthread,
+};
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+static void *new_mutex(const struct bench_sync *s)
+{
+	void *mutex = s->mutex_new();
+
+	if (!mutex)
+		error(EXIT_FAILURE, 0, "%s: failed to allocate a mutex",
+		      s->name);
+	return mutex;
+}
+
+static void *new_cond(const struct bench_sync *s)
+{
+	void *cond = s->cond_new();
+
+	if (!cond)
+		error(EXIT_FAILURE, 0, "%s: failed to allocate a cond", s->name);
+	return cond;
+}
+
+static void bench_lock_unlock(const struct bench_sync *s)
+{
+	void *mutex = new_mutex(s);
+	long i, loops = bench_opts.loops;
+	uint64_t start;
+
+	start = bench_now_ns();
+	for (i = 0; i < loops; i++) {
+		s->lock(mutex);
+		s->unlock(mutex);
+	}
+	bench_report("lock-unlock", s->name, 1, loops, bench_now_ns() - start);
+	s->mutex_free(mutex);
+}
+
+static void bench_trylock_unlock(const struct bench_sync *s)
+{
+	void *mutex = new_mutex(s);
+	long i, loops = bench_opts.loops;
+	uint64_t start;
+
+	start = bench_now_ns();
+	for (i = 0; i < loops; i++) {
+		s->trylock(mutex);
+		s->unlock(mutex);
+	}
+	bench_report("trylock-unlock", s->name, 1, loops,
+		     bench_now_ns() - start);
+	s->mutex_free(mutex);
+}
+
+struct contended_arg {
+	const struct bench_sync *s;
+	void *mutex;
+	pthread_barrier_t *ready;
+	pthread_barrier_t *go;
+	long loops;
+	bool yield;
+	volatile long *counter;
+};
+
+static void *contended_tf(void *p)
+{
+	struct contended_arg *arg = p;
+	long i;
+
+	pthread_barrier_wait(arg->ready);
+	pthread_barrier_wait(arg->go);
+	for (i = 0; i < arg->loops; i++) {
+		arg->s->lock(arg->mutex);
+		(*arg->counter)++;
+		if (arg->yield)
+			sched_yield();
+		arg->s->unlock(arg->mutex);
+	}
+	return NULL;
+}
+
+static void bench_contended(const struct bench_sync *s, int nthreads,
+			    bool yield)
+{
+	pthread_t threads[nthreads];
+	pthread_barrier_t ready, go;
+	struct contended_arg arg;
+	volatile long counter = 0;
+	uint64_t start;
+	int i;
+
+	arg.s = s;
+	arg.mutex = new_mutex(s);
+	arg.ready = &ready;
+	arg.go = &go;
+	arg.loops = bench_opts.loops / (yield ? 40 : 4) / nthreads;
+	arg.yield = yield;
+	arg.counter = &counter;
+
+	pthread_barrier_init(&ready, NULL, nthreads + 1);
+	pthread_barrier_init(&go, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&threads[i], NULL, contended_tf, &arg))
+			error(EXIT_FAILURE, 0, "pthread_create failed");
+
+	/* Start the clock once every thread is up, then release them. */
+	pthread_barrier_wait(&ready);
+	start = bench_now_ns();
+	pthread_barrier_wait(&go);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	bench_report(yield ? "contended-yield" : "contended", s->name,
+		     nthreads, arg.loops * nthreads, bench_now_ns() - start);
+
+	pthread_barrier_destroy(&go);
+	pthread_barrier_destroy(&ready);
+	s->mutex_free(arg.mutex);
+}
+
+struct pingpong {
+	const struct bench_sync *s;
+	void *mutex;
+	void *cond;
+	long rounds;
+	int turn;
+};
+
+static void *pingpong_tf(void *p)
+{
+	struct pingpong *pp = p;
+	long i;
+
+	pp->s->lock(pp->mutex);
+	for (i = 0; i < pp->rounds; i++) {
+		while (pp->turn != 1)
+			pp->s->wait(pp->cond, pp->mutex);
+		pp->turn = 0;
+		pp->s->signal(pp->cond, pp->mutex);
+	}
+	pp->s->unlock(pp->mutex);
+	return NULL;
+}
+
+static void bench_pingpong(const struct bench_sync *s)
+{
+	struct pingpong pp;
+	pthread_t thread;
+	uint64_t start;
+	long i;
+
+	pp.s = s;
+	pp.mutex = new_mutex(s);
+	pp.cond = new_cond(s);
+	pp.rounds = bench_opts.loops / 50;
+	pp.turn = 0;
+
+	s->lock(pp.mutex);
+	if (pthread_create(&thread, NULL, pingpong_tf, &pp))
+		error(EXIT_FAILURE, 0, "pthread_create failed");
+
+	start = bench_now_ns();
+	for (i = 0; i < pp.rounds; i++) {
+		pp.turn = 1;
+		s->signal(pp.cond, pp.mutex);
+		while (pp.turn != 0)
+			s->wait(pp.cond, pp.mutex);
+	}
+	bench_report("cond-pingpong", s->name, 2, pp.rounds,
+		     bench_now_ns() - start);
+	s->unlock(pp.mutex);
+
+	pthread_join(thread, NULL);
+	s->cond_free(pp.cond);
+	s->mutex_free(pp.mutex);
+}
+
+static void bench_idle(const struct bench_sync *s, int broadcast)
+{
+	void *mutex = new_mutex(s);
+	void *cond = new_cond(s);
+	long i, loops = bench_opts.loops;
+	uint64_t start;
+
+	s->lock(mutex);
+	start = bench_now_ns();
+	if (broadcast) {
+		for (i = 0; i < loops; i++)
+			s->broadcast(cond, mutex);
+	} else {
+		for (i = 0; i < loops; i++)
+			s->signal(cond, mutex);
+	}
+	bench_report(broadcast ? "broadcast-idle" : "signal-idle", s->name, 1,
+		     loops, bench_now_ns() - start);
+	s->unlock(mutex);
+	s->cond_free(cond);
+	s->mutex_free(mutex);
+}
+
+struct bcast {
+	const struct bench_sync *s;
+	void *mutex;
+	void *cond;
+	void *done;
+	int waiters;
+	int waiting;
+	long gen;
+	int stop;
+};
+
+static void *bcast_tf(void *p)
+{
+	struct bcast *b = p;
+	long gen;
+
+	b->s->lock(b->mutex);
+	while (!b->stop) {
+		gen = b->gen;
+		if (++b->waiting == b->waiters)
+			b->s->signal(b->done, b->mutex);
+		while (b->gen == gen)
+			b->s->wait(b->cond, b->mutex);
+	}
+	b->s->unlock(b->mutex);
+	return NULL;
+}
+
+static void bench_broadcast(const struct bench_sync *s, int nwaiters)
+{
+	pthread_t threads[nwaiters];
+	struct bcast b = { 0 };
+	long i, rounds = bench_opts.loops / 1000;
+	uint64_t start;
+
+	b.s = s;
+	b.mutex = new_mutex(s);
+	b.cond = new_cond(s);
+	b.done = new_cond(s);
+	b.waiters = nwaiters;
+
+	for (i = 0; i < nwaiters; i++)
+		if (pthread_create(&threads[i], NULL, bcast_tf, &b))
+			error(EXIT_FAILURE, 0, "pthread_create failed");
+
+	s->lock(b.mutex);
+	while (b.waiting < nwaiters)
+		s->wait(b.done, b.mutex);
+
+	start = bench_now_ns();
+	for (i = 0; i < rounds; i++) {
+		b.waiting = 0;
+		b.gen++;
+		s->broadcast(b.cond, b.mutex);
+		while (b.waiting < nwaiters)
+			s->wait(b.done, b.mutex);
+	}
+	bench_report("broadcast-wake", s->name, nwaiters, rounds,
+		     bench_now_ns() - start);
+
+	b.stop = 1;
+	b.gen++;
+	s->broadcast(b.cond, b.mutex);
+	s->unlock(b.mutex);
+
+	for (i = 0; i < nwaiters; i++)
+		pthread_join(threads[i], NULL);
+	s->cond_free(b.done);
+	s->cond_free(b.cond);
+	s->mutex_free(b.mutex);
+}
+
+/* Thread counts for the scaling runs: powers of two, then the maximum. */
+static int next_threads(int n)
+{
+	if (n == bench_opts.threads)
+		return n + 1;
+	return n * 2 < bench_opts.threads ? n * 2 : bench_opts.threads;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int n;
+
+	bench_init(argc, argv);
+
+	for (i = 0; i < ARRAY_SIZE(mutex_impls); i++)
+		bench_lock_unlock(mutex_impls[i]);
+	for (i = 0; i < ARRAY_SIZE(mutex_impls); i++)
+		bench_trylock_unlock(mutex_impls[i]);
+	for (n = 1; n <= bench_opts.threads; n = next_threads(n))
+		for (i = 0; i < ARRAY_SIZE(mutex_impls); i++)
+			bench_contended(mutex_impls[i], n, false);
+	for (n = 2; n <= bench_opts.threads; n = next_threads(n))
+		for (i = 0; i < ARRAY_SIZE(mutex_impls); i++)
+			bench_contended(mutex_impls[i], n, true);
+	for (i = 0; i < ARRAY_SIZE(cond_impls); i++)
+		bench_pingpong(cond_impls[i]);
+	for (i = 0; i < ARRAY_SIZE(cond_impls); i++)
+		bench_idle(cond_impls[i], 0);
+	for (i = 0; i < ARRAY_SIZE(cond_impls); i++)
+		bench_idle(cond_impls[i], 1);
+	for (i = 0; i < ARRAY_SIZE(cond_impls); i++)
+		bench_broadcast(cond_impls[i], bench_opts.threads);
+
+	bench_finish();
+	return 0;
+}
@@ -0,0 +1,320 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RTPI_INLINE_FASTPATH
+#include "rtpi.h"
+#include "bench.h"
+
+struct bench_opts bench_opts = {
+	.format = BENCH_TEXT,
+	.threads = 0,
+	.loops = 1000000,
+};
+
+static int rows;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f text|csv|json] [-t threads] [-n loops]\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+void bench_init(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:t:n:")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (!strcmp(optarg, "text"))
+				bench_opts.format = BENCH_TEXT;
+			else if (!strcmp(optarg, "csv"))
+				bench_opts.format = BENCH_CSV;
+			else if (!strcmp(optarg, "json"))
+				bench_opts.format = BENCH_JSON;
+			else
+				usage(argv[0]);
+			break;
+		case 't':
+			bench_opts.threads = atoi(optarg);
+			break;
+		case 'n':
+			bench_opts.loops = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (bench_opts.threads <= 0) {
+		bench_opts.threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (bench_opts.threads < 2)
+			bench_opts.threads = 2;
+	}
+	if (bench_opts.loops <= 0)
+		usage(argv[0]);
+}
+
+void bench_report(const char *bench, const char *impl, int threads, long ops,
+		  uint64_t ns)
+{
+	double ns_per_op = ops ? (double)ns / ops : 0;
+
+	switch (bench_opts.format) {
+	case BENCH_TEXT:
+		if (!rows)
+			printf("%-24s %-12s %7s %10s %12s\n", "benchmark",
+			       "impl", "threads", "ops", "ns/op");
+		printf("%-24s %-12s %7d %10ld %12.2f\n", bench, impl, threads,
+		       ops, ns_per_op);
+		break;
+	case BENCH_CSV:
+		if (!rows)
+			printf("benchmark,impl,threads,ops,ns,ns_per_op\n");
+		printf("%s,%s,%d,%ld,%llu,%.2f\n", bench, impl, threads, ops,
+		       (unsigned long long)ns, ns_per_op);
+		break;
+	case BENCH_JSON:
+		printf("%s{\"benchmark\": \"%s\", \"impl\": \"%s\", "
+		       "\"threads\": %d, \"ops\": %ld, \"ns\": %llu, "
+		       "\"ns_per_op\": %.2f}",
+		       rows ? ",\n  " : "[\n  ", bench, impl, threads, ops,
+		       (unsigned long long)ns, ns_per_op);
+		break;
+	}
+	rows++;
+	fflush(stdout);
+}
+
+void bench_finish(void)
+{
+	if (bench_opts.format == BENCH_JSON)
+		printf(rows ? "\n]\n" : "[]\n");
+}
+
+/*
+ * librtpi, through the exported functions
+ */
+static void *rtpi_mutex_new(void)
+{
+	pi_mutex_t *mutex = pi_mutex_alloc();
+
+	if (mutex)
+		pi_mutex_init(mutex, 0);
+	return mutex;
+}
+
+static void *rtpi_cond_new(void)
+{
+	pi_cond_t *cond = pi_cond_alloc();
+
+	if (cond)
+		pi_cond_init(cond, 0);
+	return cond;
+}
+
+static void rtpi_mutex_free(void *mutex)
+{
+	pi_mutex_destroy(mutex);
+	pi_mutex_free(mutex);
+}
+
+static void rtpi_cond_free(void *cond)
+{
+	pi_cond_destroy(cond);
+	pi_cond_free(cond);
+}
+
+static int rtpi_lock(void *mutex)
+{
+	return (pi_mutex_lock)(mutex);
+}
+
+static int rtpi_trylock(void *mutex)
+{
+	return (pi_mutex_trylock)(mutex);
+}
+
+static int rtpi_unlock(void *mutex)
+{
+	return (pi_mutex_unlock)(mutex);
+}
+
+static int rtpi_wait(void *cond, void *mutex)
+{
+	return pi_cond_wait(cond, mutex);
+}
+
+static int rtpi_signal(void *cond, void *mutex)
+{
+	return pi_cond_signal(cond, mutex);
+}
+
+static int rtpi_broadcast(void *cond, void *mutex)
+{
+	return pi_cond_broadcast(cond, mutex);
+}
+
+const struct bench_sync bench_rtpi = {
+	.name = "rtpi",
+	.mutex_new = rtpi_mutex_new,
+	.cond_new = rtpi_cond_new,
+	.mutex_free = rtpi_mutex_free,
+	.cond_free = rtpi_cond_free,
+	.lock = rtpi_lock,
+	.trylock = rtpi_trylock,
+	.unlock = rtpi_unlock,
+	.wait = rtpi_wait,
+	.signal = rtpi_signal,
+	.broadcast = rtpi_broadcast,
+};
+
+/*
+ * librtpi, through the RTPI_INLINE_FASTPATH inline fast paths
+ */
+static int rtpi_inline_lock(void *mutex)
+{
+	return pi_mutex_lock(mutex);
+}
+
+static int rtpi_inline_trylock(void *mutex)
+{
+	return pi_mutex_trylock(mutex);
+}
+
+static int rtpi_inline_unlock(void *mutex)
+{
+	return pi_mutex_unlock(mutex);
+}
+
+const struct bench_sync bench_rtpi_inline = {
+	.name = "rtpi-inline",
+	.mutex_new = rtpi_mutex_new,
+	.cond_new = rtpi_cond_new,
+	.mutex_free = rtpi_mutex_free,
+	.cond_free = rtpi_cond_free,
+	.lock = rtpi_inline_lock,
+	.trylock = rtpi_inline_trylock,
+	.unlock = rtpi_inline_unlock,
+	.wait = rtpi_wait,
+	.signal = rtpi_signal,
+	.broadcast = rtpi_broadcast,
+};
+
+/*
+ * librtpi with RTPI_MUTEX_HYBRID mutexes, blocking without PI while all
+ * contenders are SCHED_OTHER
+ */
+static void *rtpi_hybrid_mutex_new(void)
+{
+	pi_mutex_t *mutex = pi_mutex_alloc();
+
+	if (mutex)
+		pi_mutex_init(mutex, RTPI_MUTEX_HYBRID);
+	return mutex;
+}
+
+const struct bench_sync bench_rtpi_hybrid = {
+	.name = "rtpi-hybrid",
+	.mutex_new = rtpi_hybrid_mutex_new,
+	.cond_new = rtpi_cond_new,
+	.mutex_free = rtpi_mutex_free,
+	.cond_free = rtpi_cond_free,
+	.lock = rtpi_lock,
+	.trylock = rtpi_trylock,
+	.unlock = rtpi_unlock,
+	.wait = rtpi_wait,
+	.signal = rtpi_signal,
+	.broadcast = rtpi_broadcast,
+};
+
+/*
+ * pthread_mutex_t with PTHREAD_PRIO_INHERIT and pthread_cond_t
+ */
+static void *pt_mutex_new(void)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutex_t *mutex;
+
+	mutex = malloc(sizeof(*mutex));
+	if (!mutex)
+		return NULL;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return mutex;
+}
+
+static void *pt_cond_new(void)
+{
+	pthread_cond_t *cond;
+
+	cond = malloc(sizeof(*cond));
+	if (cond)
+		pthread_cond_init(cond, NULL);
+	return cond;
+}
+
+static void pt_mutex_free(void *mutex)
+{
+	pthread_mutex_destroy(mutex);
+	free(mutex);
+}
+
+static void pt_cond_free(void *cond)
+{
+	pthread_cond_destroy(cond);
+	free(cond);
+}
+
+static int pt_lock(void *mutex)
+{
+	return pthread_mutex_lock(mutex);
+}
+
+static int pt_trylock(void *mutex)
+{
+	return pthread_mutex_trylock(mutex);
+}
+
+static int pt_unlock(void *mutex)
+{
+	return pthread_mutex_unlock(mutex);
+}
+
+static int pt_wait(void *cond, void *mutex)
+{
+	return pthread_cond_wait(cond, mutex);
+}
+
+static int pt_signal(void *cond, void *mutex)
+{
+	return pthread_cond_signal(cond);
+}
+
+static int pt_broadcast(void *cond, void *mutex)
+{
+	return pthread_cond_broadcast(cond);
+}
+
+const struct bench_sync bench_pthread = {
+	.name = "pthread-pi",
+	.mutex_new = pt_mutex_new,
+	.cond_new = pt_cond_new,
+	.mutex_free = pt_mutex_free,
+	.cond_free = pt_cond_free,
+	.lock = pt_lock,
+	.trylock = pt_trylock,
+	.unlock = pt_unlock,
+	.wait = pt_wait,
+	.signal = pt_signal,
+	.broadcast = pt_broadcast,
+};
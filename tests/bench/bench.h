@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Common helpers for the librtpi micro-benchmarks: argument parsing, timing,
+ * and reporting results as text, CSV or JSON.
+ */
+
+enum bench_format {
+	BENCH_TEXT,
+	BENCH_CSV,
+	BENCH_JSON,
+};
+
+struct bench_opts {
+	enum bench_format format;
+	int threads;	/* maximum thread count for the scaling runs */
+	long loops;	/* base iteration count */
+};
+
+extern struct bench_opts bench_opts;
+
+/*
+ * Synchronization primitives under test, so every benchmark runs the same
+ * code against librtpi and the pthread equivalents.
+ */
+struct bench_sync {
+	const char *name;
+	void *(*mutex_new)(void);
+	void *(*cond_new)(void);
+	void (*mutex_free)(void *mutex);
+	void (*cond_free)(void *cond);
+	int (*lock)(void *mutex);
+	int (*trylock)(void *mutex);
+	int (*unlock)(void *mutex);
+	int (*wait)(void *cond, void *mutex);
+	int (*signal)(void *cond, void *mutex);
+	int (*broadcast)(void *cond, void *mutex);
+};
+
+extern const struct bench_sync bench_rtpi;
+extern const struct bench_sync bench_rtpi_inline;
+extern const struct bench_sync bench_rtpi_hybrid;
+extern const struct bench_sync bench_pthread;
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * bench_init() - parse the common options
+ * @argc: argument count from main
+ * @argv: argument vector from main
+ *
+ * Accepts -f text|csv|json, -t max-threads and -n loops. Exits on error.
+ */
+void bench_init(int argc, char **argv);
+
+/**
+ * bench_report() - emit one result row
+ * @bench: benchmark name
+ * @impl: implementation name
+ * @threads: number of threads involved
+ * @ops: operations performed
+ * @ns: elapsed nanoseconds
+ */
+void bench_report(const char *bench, const char *impl, int threads, long ops,
+		  uint64_t ns);
+
+/**
+ * bench_finish() - terminate the report
+ */
+void bench_finish(void);
+
+#endif
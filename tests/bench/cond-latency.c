@@ -0,0 +1,479 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * cyclictest-style wakeup latency harness for priority ordered condvar
+ * wakeups.
+ *
+ * A set of SCHED_FIFO waiters, one per priority, block on a condvar. Every
+ * interval a higher priority signaler wakes them, either one at a time with
+ * signal or all at once with broadcast, while SCHED_OTHER load threads keep
+ * the CPUs busy. Each waiter records the time from the signal to running
+ * with the mutex held into a per-priority histogram. The order in which the
+ * waiters ran is checked against their priorities. The same run is repeated
+ * for librtpi and for pthread_cond_t with a PTHREAD_PRIO_INHERIT mutex.
+ *
+ * Run as root (or with CAP_SYS_NICE) for meaningful numbers; otherwise all
+ * threads stay SCHED_OTHER and a warning is printed.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define NSEC_PER_USEC	1000ULL
+#define NSEC_PER_SEC	1000000000ULL
+
+static struct {
+	long cycles;
+	long interval_us;
+	int waiters;
+	int prio;
+	int load;
+	int buckets;
+	int signal;
+	int broadcast;
+	int rtpi;
+	int pthread;
+	enum bench_format format;
+} opts = {
+	.cycles = 1000,
+	.interval_us = 1000,
+	.waiters = 4,
+	.prio = 10,
+	.load = -1,
+	.buckets = 1000,
+	.signal = 1,
+	.broadcast = 1,
+	.rtpi = 1,
+	.pthread = 1,
+	.format = BENCH_TEXT,
+};
+
+struct hist {
+	uint64_t *bucket;	/* 1us buckets, last one is overflow */
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+};
+
+struct waiter {
+	struct run *run;
+	pthread_t thread;
+	int prio;
+	long cycle;	/* last cycle this waiter was woken in */
+	struct hist hist;
+};
+
+struct run {
+	const struct bench_sync *s;
+	void *mutex;
+	void *cond;
+	void *done;
+	void *next;
+	struct waiter *waiters;
+	int *order;
+	long cycle;
+	int waiting;
+	int tickets;
+	int acks;
+	int stop;
+	uint64_t t_signal;
+	long inversions;
+};
+
+static volatile int load_stop;
+static int have_rt = 1;
+static int rows;
+
+static void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->bucket = calloc(opts.buckets + 1, sizeof(*h->bucket));
+	if (!h->bucket)
+		error(EXIT_FAILURE, ENOMEM, "histogram");
+	h->min = UINT64_MAX;
+}
+
+static void hist_add(struct hist *h, uint64_t ns)
+{
+	uint64_t us = ns / NSEC_PER_USEC;
+
+	h->bucket[us < (uint64_t)opts.buckets ? us : (uint64_t)opts.buckets]++;
+	h->count++;
+	h->sum += ns;
+	if (ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/*
+ * Upper bound in us of the bucket holding the given fraction of samples,
+ * clamped to the maximum seen.
+ */
+static double hist_pct(const struct hist *h, double pct)
+{
+	double max = h->max / (double)NSEC_PER_USEC;
+	uint64_t want = h->count * pct, seen = 0;
+	int i;
+
+	for (i = 0; i < opts.buckets; i++) {
+		seen += h->bucket[i];
+		if (seen > want)
+			break;
+	}
+	return i + 1 < max ? i + 1 : max;
+}
+
+static void set_fifo(pthread_attr_t *attr, int prio)
+{
+	struct sched_param param = { .sched_priority = prio };
+
+	pthread_attr_init(attr);
+	if (!have_rt)
+		return;
+	pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+	pthread_attr_setschedparam(attr, &param);
+}
+
+static void *load_tf(void *p __attribute__ ((unused)))
+{
+	volatile unsigned long x = 0;
+	unsigned long i;
+
+	while (!load_stop) {
+		for (i = 0; i < 100000; i++)
+			x += i;
+		sched_yield();
+	}
+	return NULL;
+}
+
+static void *waiter_tf(void *p)
+{
+	struct waiter *w = p;
+	struct run *r = w->run;
+	const struct bench_sync *s = r->s;
+	uint64_t now;
+
+	s->lock(r->mutex);
+	while (1) {
+		/* Each waiter is woken once per cycle. */
+		while (w->cycle == r->cycle && !r->stop)
+			s->wait(r->next, r->mutex);
+		if (r->stop)
+			break;
+		w->cycle = r->cycle;
+
+		if (++r->waiting == opts.waiters)
+			s->signal(r->done, r->mutex);
+		while (!r->tickets && !r->stop)
+			s->wait(r->cond, r->mutex);
+		if (r->stop)
+			break;
+		now = bench_now_ns();
+		r->tickets--;
+		r->waiting--;
+		hist_add(&w->hist, now - r->t_signal);
+		r->order[r->acks++] = w - r->waiters;
+		s->signal(r->done, r->mutex);
+	}
+	s->unlock(r->mutex);
+	return NULL;
+}
+
+static void wait_acks(struct run *r, int acks)
+{
+	while (r->acks < acks)
+		r->s->wait(r->done, r->mutex);
+}
+
+static void cycle(struct run *r, int broadcast)
+{
+	const struct bench_sync *s = r->s;
+	int i;
+
+	s->lock(r->mutex);
+	r->cycle++;
+	s->broadcast(r->next, r->mutex);
+	while (r->waiting < opts.waiters)
+		s->wait(r->done, r->mutex);
+
+	r->acks = 0;
+	if (broadcast) {
+		r->tickets = opts.waiters;
+		r->t_signal = bench_now_ns();
+		s->broadcast(r->cond, r->mutex);
+		wait_acks(r, opts.waiters);
+	} else {
+		for (i = 0; i < opts.waiters; i++) {
+			r->tickets = 1;
+			r->t_signal = bench_now_ns();
+			s->signal(r->cond, r->mutex);
+			wait_acks(r, i + 1);
+		}
+	}
+
+	/* Waiters must run in descending priority order. */
+	for (i = 1; i < opts.waiters; i++)
+		if (r->waiters[r->order[i]].prio >
+		    r->waiters[r->order[i - 1]].prio)
+			r->inversions++;
+	s->unlock(r->mutex);
+}
+
+static void report(struct run *r, const char *mode)
+{
+	struct waiter *w;
+	int i;
+
+	for (i = opts.waiters - 1; i >= 0; i--) {
+		w = &r->waiters[i];
+		if (!w->hist.count)
+			continue;
+		switch (opts.format) {
+		case BENCH_TEXT:
+			if (!rows)
+				printf("%-10s %-10s %4s %8s %9s %9s %9s %9s %9s %10s\n",
+				       "impl", "mode", "prio", "count",
+				       "min(us)", "avg(us)", "p99(us)",
+				       "p9999(us)", "max(us)", "inversions");
+			printf("%-10s %-10s %4d %8llu %9.2f %9.2f %9.0f %9.0f %9.2f %10ld\n",
+			       r->s->name, mode, w->prio,
+			       (unsigned long long)w->hist.count,
+			       w->hist.min / 1e3,
+			       w->hist.sum / 1e3 / w->hist.count,
+			       hist_pct(&w->hist, 0.99),
+			       hist_pct(&w->hist, 0.9999), w->hist.max / 1e3,
+			       r->inversions);
+			break;
+		case BENCH_CSV:
+			if (!rows)
+				printf("impl,mode,prio,count,min_us,avg_us,p99_us,p9999_us,max_us,inversions\n");
+			printf("%s,%s,%d,%llu,%.2f,%.2f,%.0f,%.0f,%.2f,%ld\n",
+			       r->s->name, mode, w->prio,
+			       (unsigned long long)w->hist.count,
+			       w->hist.min / 1e3,
+			       w->hist.sum / 1e3 / w->hist.count,
+			       hist_pct(&w->hist, 0.99),
+			       hist_pct(&w->hist, 0.9999), w->hist.max / 1e3,
+			       r->inversions);
+			break;
+		case BENCH_JSON:
+			printf("%s{\"impl\": \"%s\", \"mode\": \"%s\", "
+			       "\"prio\": %d, \"count\": %llu, "
+			       "\"min_us\": %.2f, \"avg_us\": %.2f, "
+			       "\"p99_us\": %.0f, \"p9999_us\": %.0f, "
+			       "\"max_us\": %.2f, \"inversions\": %ld}",
+			       rows ? ",\n  " : "[\n  ", r->s->name, mode,
+			       w->prio, (unsigned long long)w->hist.count,
+			       w->hist.min / 1e3,
+			       w->hist.sum / 1e3 / w->hist.count,
+			       hist_pct(&w->hist, 0.99),
+			       hist_pct(&w->hist, 0.9999), w->hist.max / 1e3,
+			       r->inversions);
+			break;
+		}
+		rows++;
+	}
+	fflush(stdout);
+}
+
+static void run(const struct bench_sync *s, int broadcast)
+{
+	struct timespec next;
+	pthread_attr_t attr;
+	struct run r;
+	long c;
+	int i;
+
+	memset(&r, 0, sizeof(r));
+	r.s = s;
+	r.mutex = s->mutex_new();
+	r.cond = s->cond_new();
+	r.done = s->cond_new();
+	r.next = s->cond_new();
+	r.waiters = calloc(opts.waiters, sizeof(*r.waiters));
+	r.order = calloc(opts.waiters, sizeof(*r.order));
+	if (!r.mutex || !r.cond || !r.done || !r.next || !r.waiters ||
+	    !r.order)
+		error(EXIT_FAILURE, ENOMEM, "run setup");
+
+	for (i = 0; i < opts.waiters; i++) {
+		r.waiters[i].run = &r;
+		r.waiters[i].prio = opts.prio + i;
+		hist_init(&r.waiters[i].hist);
+		set_fifo(&attr, r.waiters[i].prio);
+		if (pthread_create(&r.waiters[i].thread, &attr, waiter_tf,
+				   &r.waiters[i]))
+			error(EXIT_FAILURE, 0, "failed to create waiter");
+		pthread_attr_destroy(&attr);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (c = 0; c < opts.cycles; c++) {
+		next.tv_nsec += opts.interval_us * NSEC_PER_USEC;
+		while (next.tv_nsec >= (long)NSEC_PER_SEC) {
+			next.tv_nsec -= NSEC_PER_SEC;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		cycle(&r, broadcast);
+	}
+
+	s->lock(r.mutex);
+	r.stop = 1;
+	s->broadcast(r.cond, r.mutex);
+	s->broadcast(r.next, r.mutex);
+	s->unlock(r.mutex);
+	for (i = 0; i < opts.waiters; i++)
+		pthread_join(r.waiters[i].thread, NULL);
+
+	report(&r, broadcast ? "broadcast" : "signal");
+
+	for (i = 0; i < opts.waiters; i++)
+		free(r.waiters[i].hist.bucket);
+	free(r.order);
+	free(r.waiters);
+	s->cond_free(r.next);
+	s->cond_free(r.done);
+	s->cond_free(r.cond);
+	s->mutex_free(r.mutex);
+}
+
+static void *signaler_tf(void *p __attribute__ ((unused)))
+{
+	if (opts.rtpi && opts.signal)
+		run(&bench_rtpi, 0);
+	if (opts.pthread && opts.signal)
+		run(&bench_pthread, 0);
+	if (opts.rtpi && opts.broadcast)
+		run(&bench_rtpi, 1);
+	if (opts.pthread && opts.broadcast)
+		run(&bench_pthread, 1);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -c cycles      wakeup cycles per run (%ld)\n"
+		"  -i interval    us between cycles (%ld)\n"
+		"  -w waiters     waiter threads, one per priority (%d)\n"
+		"  -p prio        lowest waiter SCHED_FIFO priority (%d)\n"
+		"  -l threads     SCHED_OTHER load threads (online CPUs)\n"
+		"  -b buckets     histogram size in us (%d)\n"
+		"  -m mode        signal, broadcast or both\n"
+		"  -I impl        rtpi, pthread or both\n"
+		"  -f format      text, csv or json\n",
+		prog, opts.cycles, opts.interval_us, opts.waiters, opts.prio,
+		opts.buckets);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct sched_param param;
+	pthread_t *load, signaler;
+	pthread_attr_t attr;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:i:w:p:l:b:m:I:f:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			opts.cycles = atol(optarg);
+			break;
+		case 'i':
+			opts.interval_us = atol(optarg);
+			break;
+		case 'w':
+			opts.waiters = atoi(optarg);
+			break;
+		case 'p':
+			opts.prio = atoi(optarg);
+			break;
+		case 'l':
+			opts.load = atoi(optarg);
+			break;
+		case 'b':
+			opts.buckets = atoi(optarg);
+			break;
+		case 'm':
+			opts.signal = strcmp(optarg, "broadcast") != 0;
+			opts.broadcast = strcmp(optarg, "signal") != 0;
+			break;
+		case 'I':
+			opts.rtpi = strcmp(optarg, "pthread") != 0;
+			opts.pthread = strcmp(optarg, "rtpi") != 0;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv"))
+				opts.format = BENCH_CSV;
+			else if (!strcmp(optarg, "json"))
+				opts.format = BENCH_JSON;
+			else
+				opts.format = BENCH_TEXT;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (opts.cycles <= 0 || opts.interval_us <= 0 || opts.waiters <= 0 ||
+	    opts.buckets <= 0 || opts.prio < sched_get_priority_min(SCHED_FIFO) ||
+	    opts.prio + opts.waiters >= sched_get_priority_max(SCHED_FIFO))
+		usage(argv[0]);
+	if (opts.load < 0)
+		opts.load = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		fprintf(stderr, "warning: mlockall failed: %s\n",
+			strerror(errno));
+
+	param.sched_priority = opts.prio + opts.waiters;
+	if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+		fprintf(stderr,
+			"warning: no SCHED_FIFO (%s), latencies are not "
+			"meaningful\n", strerror(errno));
+		have_rt = 0;
+	}
+
+	load = calloc(opts.load, sizeof(*load));
+	param.sched_priority = 0;
+	for (i = 0; i < opts.load; i++) {
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		pthread_attr_setschedparam(&attr, &param);
+		if (pthread_create(&load[i], &attr, load_tf, NULL))
+			error(EXIT_FAILURE, 0, "failed to create load thread");
+		pthread_attr_destroy(&attr);
+	}
+
+	/* The signaler runs above every waiter. */
+	set_fifo(&attr, opts.prio + opts.waiters);
+	if (pthread_create(&signaler, &attr, signaler_tf, NULL))
+		error(EXIT_FAILURE, 0, "failed to create signaler");
+	pthread_attr_destroy(&attr);
+	pthread_join(signaler, NULL);
+
+	load_stop = 1;
+	for (i = 0; i < opts.load; i++)
+		pthread_join(load[i], NULL);
+	free(load);
+
+	if (opts.format == BENCH_JSON)
+		printf(rows ? "\n]\n" : "[]\n");
+	return 0;
+}
@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * Fixed-size messages between two processes through pi_mqueue_t and through
+ * POSIX message queues:
+ *
+ *   mq-throughput	messages moved per ns with both sides streaming
+ *   mq-pingpong	round trip of one message over a pair of queues
+ *
+ * pi_mqueue copies like mq_send/mq_receive do, pi_mqueue-zc fills and reads
+ * the slots in place, and pi_mqueue-batch also receives in batches. Both
+ * kinds of queue get the same depth, the default limit for POSIX queues.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "rtpi.h"
+#include "bench.h"
+
+#define SLOTS		10
+#define MSG_SIZE	64
+#define BATCH		SLOTS
+
+struct msg {
+	long	seq;
+	char	payload[MSG_SIZE - sizeof(long)];
+};
+
+struct queue {
+	pi_mqueue_t	*mq;
+	size_t		size;
+	mqd_t		mqd;
+	/* Receiver side of pi_mqueue-batch */
+	void		*batch[BATCH];
+	unsigned int	nr, next;
+};
+
+struct impl {
+	const char *name;
+	void (*open)(struct queue *q);
+	void (*close)(struct queue *q);
+	void (*send)(struct queue *q, long seq);
+	long (*receive)(struct queue *q);
+};
+
+static void pi_open(struct queue *q)
+{
+	memset(q, 0, sizeof(*q));
+	q->size = pi_mqueue_size(SLOTS, sizeof(struct msg));
+	q->mq = mmap(NULL, q->size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (q->mq == MAP_FAILED)
+		error(EXIT_FAILURE, errno, "mmap");
+	errno = pi_mqueue_init(q->mq, SLOTS, sizeof(struct msg),
+			       RTPI_MQUEUE_PSHARED);
+	if (errno)
+		error(EXIT_FAILURE, errno, "pi_mqueue_init");
+}
+
+static void pi_close(struct queue *q)
+{
+	pi_mqueue_destroy(q->mq);
+	munmap(q->mq, q->size);
+}
+
+static void pi_send(struct queue *q, long seq)
+{
+	struct msg m = { .seq = seq };
+
+	pi_mqueue_send(q->mq, &m, 0);
+}
+
+static long pi_receive(struct queue *q)
+{
+	struct msg m;
+
+	pi_mqueue_receive(q->mq, &m, NULL);
+	return m.seq;
+}
+
+static void zc_send(struct queue *q, long seq)
+{
+	struct msg *m = pi_mqueue_reserve(q->mq);
+
+	m->seq = seq;
+	pi_mqueue_commit(q->mq, m, 0);
+}
+
+static long zc_receive(struct queue *q)
+{
+	struct msg *m = pi_mqueue_acquire(q->mq, NULL);
+	long seq = m->seq;
+
+	pi_mqueue_release(q->mq, m);
+	return seq;
+}
+
+static long batch_receive(struct queue *q)
+{
+	if (q->next == q->nr) {
+		pi_mqueue_release_batch(q->mq, q->batch, q->nr);
+		q->nr = BATCH;
+		pi_mqueue_acquire_batch(q->mq, q->batch, NULL, &q->nr);
+		q->next = 0;
+	}
+	return ((struct msg *)q->batch[q->next++])->seq;
+}
+
+static void posix_open(struct queue *q)
+{
+	struct mq_attr attr = {
+		.mq_maxmsg = SLOTS,
+		.mq_msgsize = sizeof(struct msg),
+	};
+	char name[64];
+
+	memset(q, 0, sizeof(*q));
+	snprintf(name, sizeof(name), "/rtpi-bench-mqueue-%d", getpid());
+	q->mqd = mq_open(name, O_RDWR | O_CREAT | O_EXCL, 0600, &attr);
+	if (q->mqd == (mqd_t)-1)
+		error(EXIT_FAILURE, errno, "mq_open");
+	/* The descriptor is inherited across fork */
+	mq_unlink(name);
+}
+
+static void posix_close(struct queue *q)
+{
+	mq_close(q->mqd);
+}
+
+static void posix_send(struct queue *q, long seq)
+{
+	struct msg m = { .seq = seq };
+
+	mq_send(q->mqd, (const char *)&m, sizeof(m), 0);
+}
+
+static long posix_receive(struct queue *q)
+{
+	struct msg m;
+
+	mq_receive(q->mqd, (char *)&m, sizeof(m), NULL);
+	return m.seq;
+}
+
+static const struct impl impls[] = {
+	{ "pi_mqueue", pi_open, pi_close, pi_send, pi_receive },
+	{ "pi_mqueue-zc", pi_open, pi_close, zc_send, zc_receive },
+	{ "pi_mqueue-batch", pi_open, pi_close, zc_send, batch_receive },
+	{ "posix-mq", posix_open, posix_close, posix_send, posix_receive },
+};
+
+static void join(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		error(EXIT_FAILURE, 0, "child failed");
+}
+
+static void bench_throughput(const struct impl *impl)
+{
+	long i, loops = bench_opts.loops / 10, sum = 0;
+	struct queue q;
+	uint64_t start;
+	pid_t pid;
+
+	impl->open(&q);
+	start = bench_now_ns();
+	pid = fork();
+	if (!pid) {
+		for (i = 0; i < loops; i++)
+			impl->send(&q, i);
+		exit(0);
+	}
+	for (i = 0; i < loops; i++)
+		sum += impl->receive(&q);
+	bench_report("mq-throughput", impl->name, 2, loops,
+		     bench_now_ns() - start);
+	join(pid);
+
+	if (sum != loops * (loops - 1) / 2)
+		fprintf(stderr, "%s: lost messages\n", impl->name);
+	impl->close(&q);
+}
+
+static void bench_pingpong(const struct impl *impl)
+{
+	long i, loops = bench_opts.loops / 100;
+	struct queue ping, pong;
+	uint64_t start;
+	pid_t pid;
+
+	impl->open(&ping);
+	impl->open(&pong);
+	pid = fork();
+	if (!pid) {
+		for (i = 0; i < loops; i++)
+			impl->send(&pong, impl->receive(&ping));
+		exit(0);
+	}
+	start = bench_now_ns();
+	for (i = 0; i < loops; i++) {
+		impl->send(&ping, i);
+		impl->receive(&pong);
+	}
+	bench_report("mq-pingpong", impl->name, 2, loops,
+		     bench_now_ns() - start);
+	join(pid);
+	impl->close(&ping);
+	impl->close(&pong);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	bench_init(argc, argv);
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+		bench_throughput(&impls[i]);
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		/* Batching cannot help a single message in flight */
+		if (impls[i].receive != batch_receive)
+			bench_pingpong(&impls[i]);
+	}
+
+	bench_finish();
+	return 0;
+}
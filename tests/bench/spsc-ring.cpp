@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+// Single producer, single consumer handoff through rtpi::spsc_ring and
+// through the lock-based rtpi::bounded_queue:
+//
+//   spsc-throughput    elements moved per ns with both sides streaming
+//   spsc-pingpong      round trip of one element over a pair of queues
+
+#include <cstdio>
+#include <thread>
+
+#include "rtpi/bounded_queue.hpp"
+#include "rtpi/spsc_ring.hpp"
+
+extern "C" {
+#include "bench.h"
+}
+
+#define SLOTS	1024
+
+// Adapts both queues to the same push/pop calls.
+struct ring_queue {
+	static const char *name()
+	{
+		return "spsc_ring";
+	}
+
+	rtpi::spsc_ring<long, SLOTS> q;
+
+	void push(long v)
+	{
+		q.push(v);
+	}
+
+	long pop()
+	{
+		return q.pop();
+	}
+};
+
+struct locked_queue {
+	static const char *name()
+	{
+		return "bounded_queue";
+	}
+
+	rtpi::bounded_queue<long> q{ SLOTS };
+
+	void push(long v)
+	{
+		q.push(v);
+	}
+
+	long pop()
+	{
+		return q.pop();
+	}
+};
+
+template <class Queue> static void bench_throughput()
+{
+	Queue *queue = new Queue;
+	long i, loops = bench_opts.loops, sum = 0;
+	uint64_t start;
+
+	start = bench_now_ns();
+	std::thread producer([queue, loops] {
+		for (long i = 0; i < loops; i++)
+			queue->push(i);
+	});
+	for (i = 0; i < loops; i++)
+		sum += queue->pop();
+	producer.join();
+	bench_report("spsc-throughput", Queue::name(), 2, loops,
+		     bench_now_ns() - start);
+
+	if (sum != loops * (loops - 1) / 2)
+		std::fprintf(stderr, "%s: lost elements\n", Queue::name());
+	delete queue;
+}
+
+template <class Queue> static void bench_pingpong()
+{
+	Queue *ping = new Queue, *pong = new Queue;
+	long i, loops = bench_opts.loops / 10;
+	uint64_t start;
+
+	std::thread echo([ping, pong, loops] {
+		for (long i = 0; i < loops; i++)
+			pong->push(ping->pop());
+	});
+	start = bench_now_ns();
+	for (i = 0; i < loops; i++) {
+		ping->push(i);
+		pong->pop();
+	}
+	bench_report("spsc-pingpong", Queue::name(), 2, loops,
+		     bench_now_ns() - start);
+	echo.join();
+	delete ping;
+	delete pong;
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	bench_throughput<ring_queue>();
+	bench_throughput<locked_queue>();
+	bench_pingpong<ring_queue>();
+	bench_pingpong<locked_queue>();
+
+	bench_finish();
+	return 0;
+}
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+// rtpi::bounded_queue must deliver every element exactly once in FIFO order
+// per producer, hold move-only elements, block producers on a full queue
+// and consumers on an empty one, and destroy the elements left behind.
+
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "rtpi/bounded_queue.hpp"
+
+#define PRODUCERS	2
+#define CONSUMERS	2
+#define ITEMS		20000
+
+using std::chrono::milliseconds;
+
+static int live;
+
+struct counted {
+	counted()
+	{
+		live++;
+	}
+	counted(counted &&)
+	{
+		live++;
+	}
+	~counted()
+	{
+		live--;
+	}
+};
+
+static rtpi::bounded_queue<std::unique_ptr<long> > queue(8);
+static long sums[CONSUMERS];
+
+static void producer(long base)
+{
+	std::vector<std::unique_ptr<long> > batch;
+
+	for (long i = 0; i < ITEMS; i++) {
+		if (i % 4) {
+			queue.push(std::unique_ptr<long>(new long(base + i)));
+			continue;
+		}
+		// Every fourth element goes through a batch of one or more
+		batch.clear();
+		batch.emplace_back(new long(base + i));
+		queue.push(std::make_move_iterator(batch.begin()),
+			   std::make_move_iterator(batch.end()));
+	}
+}
+
+static void consumer(int id)
+{
+	std::unique_ptr<long> items[4];
+
+	for (;;) {
+		size_t n = queue.pop(items, 4);
+
+		for (size_t i = 0; i < n; i++) {
+			if (*items[i] < 0)
+				return;
+			sums[id] += *items[i];
+		}
+	}
+}
+
+int main()
+{
+	std::thread producers[PRODUCERS], consumers[CONSUMERS];
+	std::unique_ptr<long> p;
+	long sum = 0, expect = 0;
+	int i;
+
+	if (queue.try_pop(p) || queue.try_pop_for(p, milliseconds(10))) {
+		std::printf("FAIL: popped from an empty queue\n");
+		return 1;
+	}
+
+	for (i = 0; i < CONSUMERS; i++)
+		consumers[i] = std::thread(consumer, i);
+	for (i = 0; i < PRODUCERS; i++)
+		producers[i] = std::thread(producer, i * 1000000L);
+	for (i = 0; i < PRODUCERS; i++)
+		producers[i].join();
+	for (i = 0; i < CONSUMERS; i++)
+		queue.push(std::unique_ptr<long>(new long(-1)));
+	for (i = 0; i < CONSUMERS; i++)
+		consumers[i].join();
+
+	for (i = 0; i < CONSUMERS; i++)
+		sum += sums[i];
+	for (i = 0; i < PRODUCERS; i++)
+		expect += i * 1000000L * ITEMS + (long)ITEMS * (ITEMS - 1) / 2;
+	if (sum != expect || !queue.empty()) {
+		std::printf("FAIL: sum %ld expected %ld, %zu left\n", sum,
+			    expect, queue.size());
+		return 1;
+	}
+
+	{
+		rtpi::bounded_queue<counted> small(2);
+
+		small.emplace();
+		if (!small.try_emplace() || small.try_emplace() ||
+		    small.try_push_for(counted(), milliseconds(10))) {
+			std::printf("FAIL: pushed past the capacity\n");
+			return 1;
+		}
+		// counted is not move-assignable, which pop() does not need
+		counted c(small.pop());
+	}
+	if (live) {
+		std::printf("FAIL: %d elements leaked\n", live);
+		return 1;
+	}
+
+	std::printf("%ld\n", sum);
+	return 0;
+}
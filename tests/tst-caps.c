@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_get_capabilities must report the futex operations the library depends
+ * on, and only known RTPI_CAP_* bits.
+ */
+
+#include <stdio.h>
+#include "rtpi.h"
+
+#define RTPI_CAP_ALL	(RTPI_CAP_LOCK_PI | RTPI_CAP_LOCK_PI2 | \
+			 RTPI_CAP_REQUEUE_PI | RTPI_CAP_FUTEX_WAITV)
+
+int main(void)
+{
+	uint32_t caps = pi_get_capabilities();
+
+	printf("capabilities 0x%x:%s%s%s%s\n", caps,
+	       caps & RTPI_CAP_LOCK_PI ? " LOCK_PI" : "",
+	       caps & RTPI_CAP_LOCK_PI2 ? " LOCK_PI2" : "",
+	       caps & RTPI_CAP_REQUEUE_PI ? " REQUEUE_PI" : "",
+	       caps & RTPI_CAP_FUTEX_WAITV ? " FUTEX_WAITV" : "");
+
+	if (caps & ~RTPI_CAP_ALL) {
+		printf("FAIL: unknown bits 0x%x\n", caps & ~RTPI_CAP_ALL);
+		return 1;
+	}
+	if (!(caps & RTPI_CAP_LOCK_PI) || !(caps & RTPI_CAP_REQUEUE_PI)) {
+		printf("FAIL: kernel without PI futex support\n");
+		return 1;
+	}
+	if (pi_get_capabilities() != caps) {
+		printf("FAIL: capabilities changed\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * A condvar initialized with RTPI_COND_CLOCK_REALTIME must time out against
+ * a CLOCK_REALTIME deadline, pi_cond_clockwait must honour the clock it
+ * is given on either kind of condvar, and pi_cond_reltimedwait must time out
+ * after its relative timeout.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+static DEFINE_PI_MUTEX(lock, 0);
+static DEFINE_PI_COND(mono, 0);
+static DEFINE_PI_COND(real, RTPI_COND_CLOCK_REALTIME);
+
+static void deadline(clockid_t clock, struct timespec *ts)
+{
+	clock_gettime(clock, ts);
+	ts->tv_nsec += 20000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void expect(int err, int want, const char *what)
+{
+	if (err != want)
+		error(EXIT_FAILURE, err, "%s", what);
+}
+
+int main(void)
+{
+	pi_cond_t cond;
+	struct timespec ts;
+
+	/* A deadline read against the wrong clock would hang the wait */
+	alarm(10);
+
+	expect(pi_cond_init(&cond, RTPI_COND_CLOCK_REALTIME |
+					   RTPI_COND_PSHARED),
+	       0, "pi_cond_init");
+	pi_cond_destroy(&cond);
+	expect(pi_cond_init(&cond, 0x80), EINVAL, "pi_cond_init bad flag");
+
+	pi_mutex_lock(&lock);
+
+	deadline(CLOCK_REALTIME, &ts);
+	expect(pi_cond_timedwait(&real, &lock, &ts), ETIMEDOUT,
+	       "realtime timedwait");
+
+	deadline(CLOCK_MONOTONIC, &ts);
+	expect(pi_cond_timedwait(&mono, &lock, &ts), ETIMEDOUT,
+	       "monotonic timedwait");
+
+	deadline(CLOCK_REALTIME, &ts);
+	expect(pi_cond_clockwait(&mono, &lock, CLOCK_REALTIME, &ts),
+	       ETIMEDOUT, "realtime clockwait");
+
+	deadline(CLOCK_MONOTONIC, &ts);
+	expect(pi_cond_clockwait(&real, &lock, CLOCK_MONOTONIC, &ts),
+	       ETIMEDOUT, "monotonic clockwait");
+
+	expect(pi_cond_clockwait(&mono, &lock, CLOCK_PROCESS_CPUTIME_ID, &ts),
+	       EINVAL, "clockwait bad clock");
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 20000000;
+	expect(pi_cond_reltimedwait(&real, &lock, &ts), ETIMEDOUT,
+	       "reltimedwait");
+	ts.tv_sec = -1;
+	expect(pi_cond_reltimedwait(&mono, &lock, &ts), ETIMEDOUT,
+	       "reltimedwait in the past");
+	ts.tv_nsec = -1;
+	expect(pi_cond_reltimedwait(&mono, &lock, &ts), EINVAL,
+	       "reltimedwait bad reltime");
+
+	pi_mutex_unlock(&lock);
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_cond_signal and pi_cond_broadcast with no waiters must only load the
+ * condvar state: run them on a condvar in a read-only page, where a CAS would
+ * fault and a futex requeue would fail with EFAULT. Their speed is measured
+ * by the signal-idle and broadcast-idle benchmarks in tests/bench.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+static DEFINE_PI_MUTEX(lock, 0);
+
+int main(void)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	pi_cond_t *cond;
+	int ret;
+
+	cond = mmap(NULL, page, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (cond == MAP_FAILED)
+		error(EXIT_FAILURE, errno, "mmap");
+	pi_cond_init(cond, 0);
+	if (mprotect(cond, page, PROT_READ))
+		error(EXIT_FAILURE, errno, "mprotect");
+
+	pi_mutex_lock(&lock);
+	ret = pi_cond_signal(cond, &lock);
+	if (ret)
+		error(EXIT_FAILURE, ret, "idle pi_cond_signal");
+	ret = pi_cond_signal_n(cond, &lock, 4);
+	if (ret)
+		error(EXIT_FAILURE, ret, "idle pi_cond_signal_n");
+	ret = pi_cond_broadcast(cond, &lock);
+	if (ret)
+		error(EXIT_FAILURE, ret, "idle pi_cond_broadcast");
+	pi_mutex_unlock(&lock);
+
+	munmap(cond, page);
+	printf("idle notify touched nothing but the condvar state\n");
+	return 0;
+}
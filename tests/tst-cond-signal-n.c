@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_cond_signal_n must wake n waiters with one call, and clamp n to the
+ * number of waiters without leaving wakeups behind for later waiters.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define WAITERS	8
+#define FIRST	3
+
+static DEFINE_PI_MUTEX(lock, 0);
+static DEFINE_PI_COND(cond, 0);
+static int waiting, woken, tokens;
+
+static void *waiter_tf(void *p)
+{
+	pi_mutex_lock(&lock);
+	waiting++;
+	while (!tokens)
+		pi_cond_wait(&cond, &lock);
+	tokens--;
+	woken++;
+	pi_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* Wait up to five seconds for the woken count to reach n. */
+static int wait_woken(int n)
+{
+	int i, ret;
+
+	for (i = 0; i < 5000; i++) {
+		pi_mutex_lock(&lock);
+		ret = woken;
+		pi_mutex_unlock(&lock);
+		if (ret >= n)
+			return ret;
+		usleep(1000);
+	}
+	return ret;
+}
+
+int main(void)
+{
+	pthread_t threads[WAITERS];
+	struct timespec ts;
+	int i, err;
+
+	for (i = 0; i < WAITERS; i++)
+		pthread_create(&threads[i], NULL, waiter_tf, NULL);
+	do {
+		usleep(1000);
+		pi_mutex_lock(&lock);
+		i = waiting;
+		pi_mutex_unlock(&lock);
+	} while (i < WAITERS);
+
+	pi_mutex_lock(&lock);
+	tokens = FIRST;
+	err = pi_cond_signal_n(&cond, &lock, FIRST);
+	pi_mutex_unlock(&lock);
+	if (err)
+		error(EXIT_FAILURE, err, "pi_cond_signal_n");
+	if (wait_woken(FIRST) != FIRST)
+		error(EXIT_FAILURE, 0, "woke %d waiters, expected %d", woken,
+		      FIRST);
+
+	pi_mutex_lock(&lock);
+	tokens = WAITERS - FIRST;
+	err = pi_cond_signal_n(&cond, &lock, 100);
+	pi_mutex_unlock(&lock);
+	if (err)
+		error(EXIT_FAILURE, err, "pi_cond_signal_n");
+	for (i = 0; i < WAITERS; i++)
+		pthread_join(threads[i], NULL);
+
+	/* No surplus wakeup may be left for a new waiter. */
+	pi_mutex_lock(&lock);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_nsec += 20000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	err = pi_cond_timedwait(&cond, &lock, &ts);
+	pi_mutex_unlock(&lock);
+	if (err != ETIMEDOUT)
+		error(EXIT_FAILURE, err, "wait after clamped signal_n");
+
+	printf("woken %d\n", woken);
+	return 0;
+}
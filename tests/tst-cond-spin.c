@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * An RTPI_COND_SPIN condvar must neither lose nor duplicate wakeups, whether
+ * the waiter takes a signal while spinning or asleep in the kernel.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define LOOPS	20000
+#define WAITERS	4
+
+static DEFINE_PI_MUTEX(lock, 0);
+static DEFINE_PI_COND(ping, RTPI_COND_SPIN);
+static DEFINE_PI_COND(pong, RTPI_COND_SPIN);
+static int turn, tokens, waiting, done;
+
+static void *pong_tf(void *p)
+{
+	int i;
+
+	pi_mutex_lock(&lock);
+	for (i = 0; i < LOOPS; i++) {
+		while (turn != 1)
+			pi_cond_wait(&ping, &lock);
+		turn = 0;
+		pi_cond_signal(&pong, &lock);
+	}
+	pi_mutex_unlock(&lock);
+	return NULL;
+}
+
+static void *waiter_tf(void *p)
+{
+	pi_mutex_lock(&lock);
+	waiting++;
+	while (!tokens)
+		pi_cond_wait(&ping, &lock);
+	tokens--;
+	done++;
+	pi_mutex_unlock(&lock);
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t thread, threads[WAITERS];
+	int i, n;
+
+	alarm(60);
+
+	pthread_create(&thread, NULL, pong_tf, NULL);
+	pi_mutex_lock(&lock);
+	for (i = 0; i < LOOPS; i++) {
+		turn = 1;
+		pi_cond_signal(&ping, &lock);
+		while (turn != 0)
+			pi_cond_wait(&pong, &lock);
+	}
+	pi_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+
+	for (i = 0; i < WAITERS; i++)
+		pthread_create(&threads[i], NULL, waiter_tf, NULL);
+	do {
+		usleep(1000);
+		pi_mutex_lock(&lock);
+		n = waiting;
+		pi_mutex_unlock(&lock);
+	} while (n < WAITERS);
+
+	pi_mutex_lock(&lock);
+	tokens = WAITERS;
+	pi_cond_broadcast(&ping, &lock);
+	pi_mutex_unlock(&lock);
+	for (i = 0; i < WAITERS; i++)
+		pthread_join(threads[i], NULL);
+	if (done != WAITERS)
+		error(EXIT_FAILURE, 0, "woke %d of %d waiters", done, WAITERS);
+
+	printf("%d handoffs\n", LOOPS);
+	return 0;
+}
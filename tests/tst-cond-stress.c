@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * Producer/consumer stress of the condvar wakeup accounting. Every token
+ * posted with pi_cond_signal must be consumed; a lost wakeup leaves a
+ * consumer blocked forever and the alarm fails the test.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define CONSUMERS	8
+#define TOKENS		200000
+
+static DEFINE_PI_MUTEX(lock, 0);
+static DEFINE_PI_COND(cond, 0);
+
+static unsigned int tokens;
+static unsigned int consumed;
+static int exiting;
+
+static void *consumer_tf(void *p)
+{
+	long timed = (long)p;
+	struct timespec ts;
+	int err;
+
+	pi_mutex_lock(&lock);
+	while (1) {
+		while (!tokens && !exiting) {
+			if (timed) {
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				ts.tv_nsec += 10000;
+				if (ts.tv_nsec >= 1000000000) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000;
+				}
+				err = pi_cond_timedwait(&cond, &lock, &ts);
+				if (err && err != ETIMEDOUT)
+					error(EXIT_FAILURE, err, "timedwait");
+			} else {
+				err = pi_cond_wait(&cond, &lock);
+				if (err)
+					error(EXIT_FAILURE, err, "wait");
+			}
+		}
+		if (!tokens)
+			break;
+		tokens--;
+		consumed++;
+	}
+	pi_mutex_unlock(&lock);
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[CONSUMERS];
+	long i;
+	int err;
+
+	alarm(60);
+
+	for (i = 0; i < CONSUMERS; i++) {
+		err = pthread_create(&threads[i], NULL, consumer_tf,
+				     (void *)(i & 1));
+		if (err)
+			error(EXIT_FAILURE, err, "pthread_create");
+	}
+
+	for (i = 0; i < TOKENS; i++) {
+		pi_mutex_lock(&lock);
+		tokens++;
+		err = pi_cond_signal(&cond, &lock);
+		if (err)
+			error(EXIT_FAILURE, err, "signal");
+		pi_mutex_unlock(&lock);
+	}
+
+	/* Let the consumers drain the remaining tokens before exiting. */
+	pi_mutex_lock(&lock);
+	while (tokens) {
+		pi_mutex_unlock(&lock);
+		usleep(1000);
+		pi_mutex_lock(&lock);
+	}
+	exiting = 1;
+	pi_cond_broadcast(&cond, &lock);
+	pi_mutex_unlock(&lock);
+
+	for (i = 0; i < CONSUMERS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (consumed != TOKENS) {
+		printf("FAIL: consumed %u of %u tokens\n", consumed, TOKENS);
+		return 1;
+	}
+	printf("consumed %u tokens\n", consumed);
+	return 0;
+}
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_lock_table_t: threads move units between random accounts, locking both
+ * accounts' stripes with pi_lock_table_lock_n. Opposite transfers between
+ * the same stripes must not deadlock, and the total must be conserved.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "rtpi.h"
+
+#define THREADS		4
+#define ACCOUNTS	1024
+#define STRIPES		16
+#define LOOPS		50000
+#define BALANCE		100
+
+static pi_lock_table_t *table;
+static long accounts[ACCOUNTS];
+
+static void *transfer_tf(void *p)
+{
+	unsigned int seed = (uintptr_t)p;
+	uintptr_t keys[2];
+	int i, from, to, err;
+
+	for (i = 0; i < LOOPS; i++) {
+		from = rand_r(&seed) % ACCOUNTS;
+		to = rand_r(&seed) % ACCOUNTS;
+		keys[0] = (uintptr_t)&accounts[from];
+		keys[1] = (uintptr_t)&accounts[to];
+
+		err = pi_lock_table_lock_n(table, keys, 2);
+		if (err)
+			error(EXIT_FAILURE, err, "pi_lock_table_lock_n");
+		accounts[from]--;
+		accounts[to]++;
+		err = pi_lock_table_unlock_n(table, keys, 2);
+		if (err)
+			error(EXIT_FAILURE, err, "pi_lock_table_unlock_n");
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	unsigned int used[STRIPES] = { 0 };
+	uintptr_t keys[RTPI_LOCK_TABLE_MAX_KEYS + 1];
+	long total = 0;
+	int i, err;
+
+	if (pi_lock_table_alloc(STRIPES + 1, 0) || errno != EINVAL)
+		error(EXIT_FAILURE, 0, "accepted a stripe count of %d",
+		      STRIPES + 1);
+	table = pi_lock_table_alloc(STRIPES, 0);
+	if (!table)
+		error(EXIT_FAILURE, errno, "pi_lock_table_alloc");
+	if ((uintptr_t)table->stripes % 64)
+		error(EXIT_FAILURE, 0, "stripes are not cache line aligned");
+
+	/* Consecutive addresses must spread over every stripe. */
+	for (i = 0; i < ACCOUNTS; i++) {
+		accounts[i] = BALANCE;
+		used[pi_lock_table_index(table, (uintptr_t)&accounts[i])]++;
+	}
+	for (i = 0; i < STRIPES; i++)
+		if (!used[i])
+			error(EXIT_FAILURE, 0, "stripe %d never used", i);
+
+	/* Repeated keys take their stripe once. */
+	for (i = 0; i < RTPI_LOCK_TABLE_MAX_KEYS; i++)
+		keys[i] = (uintptr_t)&accounts[i % 3];
+	err = pi_lock_table_lock_n(table, keys, RTPI_LOCK_TABLE_MAX_KEYS);
+	if (err)
+		error(EXIT_FAILURE, err, "lock_n with repeated keys");
+	err = pi_lock_table_unlock_n(table, keys, RTPI_LOCK_TABLE_MAX_KEYS);
+	if (err)
+		error(EXIT_FAILURE, err, "unlock_n with repeated keys");
+	err = pi_lock_table_lock_n(table, keys, RTPI_LOCK_TABLE_MAX_KEYS + 1);
+	if (err != EINVAL)
+		error(EXIT_FAILURE, err, "lock_n with too many keys");
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, transfer_tf,
+			       (void *)(uintptr_t)(i + 1));
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < ACCOUNTS; i++)
+		total += accounts[i];
+	pi_lock_table_free(table);
+
+	if (total != (long)ACCOUNTS * BALANCE) {
+		printf("FAIL: total %ld, expected %ld\n", total,
+		       (long)ACCOUNTS * BALANCE);
+		return 1;
+	}
+	printf("total %ld\n", total);
+	return 0;
+}
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_mqueue: messages must come out highest priority first and in order
+ * within a priority, singly and in batches, and a full or empty queue must
+ * refuse the try variants. Sender processes then stream into a queue in a
+ * shared arena, which must lose nothing and keep each sender's order. With
+ * the privilege to use SCHED_FIFO, also checks that a message wakes the
+ * highest priority of the receivers waiting for it.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define SLOTS		8
+#define PROCS		3
+#define LOOPS		20000
+#define BATCH		16
+
+struct msg {
+	int	sender;
+	int	seq;
+};
+
+static void check(int err, int want, const char *what)
+{
+	if (err != want)
+		error(EXIT_FAILURE, err, "%s: expected %d, got %d", what, want,
+		      err);
+}
+
+static void expect(struct msg *m, unsigned int prio, int seq,
+		   unsigned int want_prio)
+{
+	if (!m || m->seq != seq || prio != want_prio)
+		error(EXIT_FAILURE, 0, "got seq %d prio %u, expected %d %u",
+		      m ? m->seq : -1, prio, seq, want_prio);
+}
+
+static void test_order(void)
+{
+	static const unsigned int prios[] = { 3, 1, 3, 7, 0, 31 };
+	static const int order[] = { 5, 3, 0, 2, 1, 4 };
+	void *msgs[BATCH];
+	unsigned int i, nr, got[BATCH];
+	struct msg m, *p;
+	pi_mqueue_t *mq;
+
+	if (pi_mqueue_alloc(SLOTS, 0, 0) || errno != EINVAL)
+		error(EXIT_FAILURE, errno, "zero message size");
+	if (pi_mqueue_size(UINT32_MAX - 1, sizeof(struct msg)))
+		error(EXIT_FAILURE, 0, "data offset past 32 bits");
+	mq = pi_mqueue_alloc(SLOTS, sizeof(struct msg), 0);
+	if (!mq)
+		error(EXIT_FAILURE, errno, "pi_mqueue_alloc");
+
+	m.sender = 0;
+	check(pi_mqueue_send(mq, &m, RTPI_MQUEUE_PRIO_MAX), EINVAL,
+	      "priority out of range");
+	if (pi_mqueue_tryacquire(mq, NULL) || errno != EAGAIN)
+		error(EXIT_FAILURE, errno, "tryacquire on an empty queue");
+
+	for (i = 0; i < 6; i++) {
+		m.seq = i;
+		check(pi_mqueue_send(mq, &m, prios[i]), 0, "send");
+	}
+	for (i = 0; i < 6; i++) {
+		check(pi_mqueue_receive(mq, &m, &nr), 0, "receive");
+		expect(&m, nr, order[i], prios[order[i]]);
+	}
+
+	/* Zero-copy, until the queue is full */
+	for (i = 0; i < SLOTS; i++) {
+		p = pi_mqueue_tryreserve(mq);
+		if (!p)
+			error(EXIT_FAILURE, errno, "tryreserve");
+		p->seq = i;
+		check(pi_mqueue_commit(mq, p, i % 2), 0, "commit");
+	}
+	if (pi_mqueue_tryreserve(mq) || errno != EAGAIN)
+		error(EXIT_FAILURE, errno, "tryreserve on a full queue");
+	check(pi_mqueue_commit(mq, (char *)p + 1, 0), EINVAL,
+	      "commit of a foreign pointer");
+
+	nr = BATCH;
+	check(pi_mqueue_acquire_batch(mq, msgs, got, &nr), 0, "acquire_batch");
+	if (nr != SLOTS)
+		error(EXIT_FAILURE, 0, "batch of %u, expected %d", nr, SLOTS);
+	for (i = 0; i < nr; i++)
+		expect(msgs[i], got[i], i < SLOTS / 2 ? 2 * i + 1 :
+		       2 * (i - SLOTS / 2), i < SLOTS / 2);
+	check(pi_mqueue_release_batch(mq, msgs, nr), 0, "release_batch");
+	if (!(p = pi_mqueue_tryreserve(mq)))
+		error(EXIT_FAILURE, errno, "slots not released");
+	pi_mqueue_release(mq, p);
+
+	pi_mqueue_free(mq);
+}
+
+static int sender(pi_mqueue_t *mq, int id)
+{
+	struct msg *m;
+	int i;
+
+	for (i = 0; i < LOOPS; i++) {
+		m = pi_mqueue_reserve(mq);
+		if (!m)
+			error(EXIT_FAILURE, errno, "reserve");
+		m->sender = id;
+		m->seq = i;
+		check(pi_mqueue_commit(mq, m, 0), 0, "commit");
+	}
+	return 0;
+}
+
+static void test_procs(void)
+{
+	int i, status, next[PROCS] = { 0 };
+	unsigned int n, nr, total = 0;
+	void *msgs[BATCH];
+	pi_shm_arena_t *arena;
+	pi_mqueue_t *mq;
+	struct msg *m;
+
+	arena = pi_shm_arena_open(NULL, 64 * 1024, RTPI_SHM_CREATE);
+	if (!arena)
+		error(EXIT_FAILURE, errno, "pi_shm_arena_open");
+	mq = pi_shm_arena_mqueue(arena, "mq", SLOTS, sizeof(*m), 0);
+	if (!mq)
+		error(EXIT_FAILURE, errno, "pi_shm_arena_mqueue");
+	if (pi_shm_arena_mqueue(arena, "mq", SLOTS * 2, sizeof(*m), 0) ||
+	    errno != EINVAL)
+		error(EXIT_FAILURE, errno, "lookup with another geometry");
+
+	for (i = 0; i < PROCS; i++) {
+		if (!fork())
+			exit(sender(mq, i));
+	}
+
+	while (total < PROCS * LOOPS) {
+		nr = BATCH;
+		check(pi_mqueue_acquire_batch(mq, msgs, NULL, &nr), 0,
+		      "acquire_batch");
+		for (n = 0; n < nr; n++) {
+			m = msgs[n];
+			if (m->sender < 0 || m->sender >= PROCS ||
+			    m->seq != next[m->sender]++)
+				error(EXIT_FAILURE, 0, "sender %d seq %d",
+				      m->sender, m->seq);
+		}
+		check(pi_mqueue_release_batch(mq, msgs, nr), 0,
+		      "release_batch");
+		total += nr;
+	}
+
+	for (i = 0; i < PROCS; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			error(EXIT_FAILURE, 0, "sender failed");
+	}
+	pi_shm_arena_close(arena);
+}
+
+static pi_mqueue_t *wake_mq;
+static int first_prio;
+
+static void *receiver_tf(void *p)
+{
+	struct sched_param param;
+	int policy;
+	void *msg;
+
+	msg = pi_mqueue_acquire(wake_mq, NULL);
+	if (!msg)
+		error(EXIT_FAILURE, errno, "acquire");
+	pthread_getschedparam(pthread_self(), &policy, &param);
+	if (((struct msg *)msg)->seq == 0)
+		first_prio = param.sched_priority;
+	pi_mqueue_release(wake_mq, msg);
+	return NULL;
+}
+
+static void test_wakeup(void)
+{
+	static const int prios[] = { 10, 30, 20 };
+	struct sched_param param;
+	pthread_t threads[3];
+	pthread_attr_t attr;
+	struct msg m = { 0 };
+	int i, ret;
+
+	wake_mq = pi_mqueue_alloc(SLOTS, sizeof(m), 0);
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	for (i = 0; i < 3; i++) {
+		param.sched_priority = prios[i];
+		pthread_attr_setschedparam(&attr, &param);
+		ret = pthread_create(&threads[i], &attr, receiver_tf, NULL);
+		if (ret == EPERM) {
+			printf("SCHED_FIFO not permitted, skipping\n");
+			while (i--) {
+				pi_mqueue_send(wake_mq, &m, 0);
+				pthread_join(threads[i], NULL);
+			}
+			goto out;
+		}
+		check(ret, 0, "pthread_create");
+	}
+
+	/* Let all of them block before the first message */
+	usleep(20000);
+	for (i = 0; i < 3; i++) {
+		m.seq = i;
+		check(pi_mqueue_send(wake_mq, &m, 0), 0, "send");
+	}
+	for (i = 0; i < 3; i++)
+		pthread_join(threads[i], NULL);
+	if (first_prio != 30)
+		error(EXIT_FAILURE, 0, "first message went to priority %d",
+		      first_prio);
+out:
+	pthread_attr_destroy(&attr);
+	pi_mqueue_free(wake_mq);
+}
+
+int main(void)
+{
+	test_order();
+	test_procs();
+	test_wakeup();
+	return 0;
+}
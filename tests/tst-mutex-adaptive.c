@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * Contended counting on an RTPI_MUTEX_ADAPTIVE mutex: spinning must not
+ * break mutual exclusion or the FUTEX_LOCK_PI handover.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "rtpi.h"
+
+#define THREADS	4
+#define LOOPS	200000
+
+static pi_mutex_t lock;
+static unsigned long counter;
+
+static void *count_tf(void *p)
+{
+	int i, err;
+
+	for (i = 0; i < LOOPS; i++) {
+		err = pi_mutex_lock(&lock);
+		if (err)
+			error(EXIT_FAILURE, err, "lock");
+		counter++;
+		err = pi_mutex_unlock(&lock);
+		if (err)
+			error(EXIT_FAILURE, err, "unlock");
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	int i, err;
+
+	err = pi_mutex_init(&lock, RTPI_MUTEX_ADAPTIVE);
+	if (err)
+		error(EXIT_FAILURE, err, "pi_mutex_init");
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, count_tf, NULL);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (counter != (unsigned long)THREADS * LOOPS) {
+		printf("FAIL: counter %lu, expected %lu\n", counter,
+		       (unsigned long)THREADS * LOOPS);
+		return 1;
+	}
+	printf("counter %lu\n", counter);
+	return 0;
+}
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_mutex_compact_t must stay 8 bytes, check ownership like pi_mutex_t,
+ * time out on a held mutex, and exclude under contention when packed
+ * densely into a table.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define THREADS	4
+#define SLOTS	8
+#define LOOPS	100000
+
+static pi_mutex_compact_t table[SLOTS];
+static unsigned long counters[SLOTS];
+static DEFINE_PI_MUTEX_COMPACT(lock, 0);
+static volatile int held, release;
+
+static void *count_tf(void *p)
+{
+	int i, slot, err;
+
+	for (i = 0; i < LOOPS; i++) {
+		slot = i % SLOTS;
+		err = pi_mutex_compact_lock(&table[slot]);
+		if (err)
+			error(EXIT_FAILURE, err, "lock");
+		counters[slot]++;
+		err = pi_mutex_compact_unlock(&table[slot]);
+		if (err)
+			error(EXIT_FAILURE, err, "unlock");
+	}
+	return NULL;
+}
+
+static void *owner_tf(void *p)
+{
+	pi_mutex_compact_lock(&lock);
+	held = 1;
+	while (!release)
+		usleep(1000);
+	pi_mutex_compact_unlock(&lock);
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	struct timespec ts;
+	unsigned long total = 0;
+	int i, err;
+
+	if (sizeof(pi_mutex_compact_t) != 8)
+		error(EXIT_FAILURE, 0, "pi_mutex_compact_t is %zu bytes",
+		      sizeof(pi_mutex_compact_t));
+
+	for (i = 0; i < SLOTS; i++)
+		pi_mutex_compact_init(&table[i], 0);
+	if (pi_mutex_compact_init(&table[0], RTPI_MUTEX_ADAPTIVE) != EINVAL)
+		error(EXIT_FAILURE, 0, "init accepted an unsupported flag");
+
+	err = pi_mutex_compact_lock(&lock);
+	if (err)
+		error(EXIT_FAILURE, err, "lock");
+	err = pi_mutex_compact_trylock(&lock);
+	if (err != EDEADLOCK)
+		error(EXIT_FAILURE, err, "trylock of owned mutex");
+	err = pi_mutex_compact_unlock(&lock);
+	if (err)
+		error(EXIT_FAILURE, err, "unlock");
+	err = pi_mutex_compact_unlock(&lock);
+	if (err != EPERM)
+		error(EXIT_FAILURE, err, "unlock of unlocked mutex");
+
+	pthread_create(&threads[0], NULL, owner_tf, NULL);
+	while (!held)
+		usleep(1000);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_nsec += 20000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	err = pi_mutex_compact_timedlock(&lock, &ts);
+	if (err != ETIMEDOUT)
+		error(EXIT_FAILURE, err, "timedlock of held mutex");
+	release = 1;
+	pthread_join(threads[0], NULL);
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, count_tf, NULL);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	for (i = 0; i < SLOTS; i++)
+		total += counters[i];
+
+	if (total != (unsigned long)THREADS * LOOPS) {
+		printf("FAIL: counter %lu, expected %lu\n", total,
+		       (unsigned long)THREADS * LOOPS);
+		return 1;
+	}
+	printf("counter %lu\n", total);
+	return 0;
+}
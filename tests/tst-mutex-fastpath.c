@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * Exercise the inline mutex fast paths enabled by RTPI_INLINE_FASTPATH:
+ * error checking must match the library calls, and contended locking must
+ * still exclude and hand over through FUTEX_LOCK_PI/FUTEX_UNLOCK_PI. A
+ * child of fork() must not take a shared mutex its parent holds for its own.
+ */
+
+#define RTPI_INLINE_FASTPATH
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define THREADS	4
+#define LOOPS	200000
+
+static DEFINE_PI_MUTEX(lock, 0);
+static unsigned long counter;
+
+static void *unlock_tf(void *p)
+{
+	return (void *)(long)pi_mutex_unlock(&lock);
+}
+
+static void *count_tf(void *p)
+{
+	int i, err;
+
+	for (i = 0; i < LOOPS; i++) {
+		err = pi_mutex_lock(&lock);
+		if (err)
+			error(EXIT_FAILURE, err, "lock");
+		counter++;
+		err = pi_mutex_unlock(&lock);
+		if (err)
+			error(EXIT_FAILURE, err, "unlock");
+	}
+	return NULL;
+}
+
+/* The child inherits the parent's TLS, and must not see its TID there */
+static void test_fork(void)
+{
+	pi_mutex_t *shared;
+	int status, err;
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED)
+		error(EXIT_FAILURE, errno, "mmap");
+	pi_mutex_init(shared, RTPI_MUTEX_PSHARED);
+	pi_mutex_lock(shared);
+
+	if (!fork()) {
+		err = pi_mutex_trylock(shared);
+		if (err != EBUSY)
+			error(EXIT_FAILURE, err, "child trylock");
+		exit(0);
+	}
+	if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		error(EXIT_FAILURE, 0, "child failed");
+
+	pi_mutex_unlock(shared);
+	munmap(shared, sizeof(*shared));
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	void *res;
+	int i, err;
+
+	err = pi_mutex_lock(&lock);
+	if (err)
+		error(EXIT_FAILURE, err, "lock");
+	err = pi_mutex_trylock(&lock);
+	if (err != EDEADLOCK)
+		error(EXIT_FAILURE, err, "trylock of owned mutex");
+	err = pi_mutex_lock(&lock);
+	if (err != EDEADLOCK)
+		error(EXIT_FAILURE, err, "relock of owned mutex");
+
+	pthread_create(&threads[0], NULL, unlock_tf, NULL);
+	pthread_join(threads[0], &res);
+	if ((long)res != EPERM)
+		error(EXIT_FAILURE, (long)res, "unlock by non-owner");
+
+	err = pi_mutex_unlock(&lock);
+	if (err)
+		error(EXIT_FAILURE, err, "unlock");
+	err = pi_mutex_unlock(&lock);
+	if (err != EPERM)
+		error(EXIT_FAILURE, err, "unlock of unlocked mutex");
+
+	test_fork();
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, count_tf, NULL);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (counter != (unsigned long)THREADS * LOOPS) {
+		printf("FAIL: counter %lu, expected %lu\n", counter,
+		       (unsigned long)THREADS * LOOPS);
+		return 1;
+	}
+	printf("counter %lu\n", counter);
+	return 0;
+}
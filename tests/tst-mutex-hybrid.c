@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * RTPI_MUTEX_HYBRID: SCHED_OTHER contenders must sleep without touching the
+ * PI futex, timed out sleepers must not strand the others, and a SCHED_FIFO
+ * contender must switch the mutex over to FUTEX_LOCK_PI, also after being
+ * promoted from SCHED_OTHER. The SCHED_FIFO parts are skipped without the
+ * privilege to use them.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define THREADS	4
+#define LOOPS	100000
+
+static pi_mutex_t lock;
+static pi_cond_t cond;
+static unsigned long counter;
+
+static void *count_tf(void *p)
+{
+	int i, err;
+
+	for (i = 0; i < LOOPS; i++) {
+		err = pi_mutex_lock(&lock);
+		if (err)
+			error(EXIT_FAILURE, err, "lock");
+		counter++;
+		err = pi_mutex_unlock(&lock);
+		if (err)
+			error(EXIT_FAILURE, err, "unlock");
+	}
+	return NULL;
+}
+
+static void *lock_tf(void *p)
+{
+	int err;
+
+	err = pi_mutex_lock(&lock);
+	if (err)
+		error(EXIT_FAILURE, err, "lock");
+	pi_mutex_unlock(&lock);
+	return NULL;
+}
+
+static void *timedlock_tf(void *p)
+{
+	struct timespec rel = { 0, 20 * 1000000 };
+	int err;
+
+	err = pi_mutex_reltimedlock(&lock, &rel);
+	if (err != ETIMEDOUT)
+		error(EXIT_FAILURE, err, "reltimedlock: expected ETIMEDOUT");
+	return NULL;
+}
+
+/* Wait until n threads sleep on the hybrid word */
+static void wait_sleepers(unsigned int n)
+{
+	while ((__atomic_load_n(&lock.hwait, __ATOMIC_RELAXED) & 0xffff) != n)
+		usleep(1000);
+}
+
+static void test_count(void)
+{
+	pthread_t threads[THREADS];
+	int i;
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, count_tf, NULL);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	if (counter != (unsigned long)THREADS * LOOPS)
+		error(EXIT_FAILURE, 0, "counter %lu, expected %lu", counter,
+		      (unsigned long)THREADS * LOOPS);
+}
+
+static void test_sleepers(void)
+{
+	pthread_t sleeper, timed;
+
+	pi_mutex_lock(&lock);
+	pthread_create(&sleeper, NULL, lock_tf, NULL);
+	wait_sleepers(1);
+	if (lock.futex & FUTEX_WAITERS)
+		error(EXIT_FAILURE, 0, "SCHED_OTHER contender used the PI futex");
+
+	/* A sleeper timing out meanwhile must leave the other one asleep */
+	pthread_create(&timed, NULL, timedlock_tf, NULL);
+	pthread_join(timed, NULL);
+	wait_sleepers(1);
+
+	pi_mutex_unlock(&lock);
+	pthread_join(sleeper, NULL);
+	wait_sleepers(0);
+}
+
+static void *cond_tf(void *p)
+{
+	int *go = p;
+
+	pi_mutex_lock(&lock);
+	while (!*go)
+		pi_cond_wait(&cond, &lock);
+	pi_mutex_unlock(&lock);
+	return NULL;
+}
+
+static void test_cond(void)
+{
+	pthread_t thread;
+	int go = 0;
+
+	pthread_create(&thread, NULL, cond_tf, &go);
+	usleep(10000);
+	pi_mutex_lock(&lock);
+	go = 1;
+	pi_cond_signal(&cond, &lock);
+	pi_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+}
+
+static void test_rt(void)
+{
+	struct sched_param param = { .sched_priority = 1 };
+	pthread_attr_t attr;
+	pthread_t other, rt;
+	int err;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	pi_mutex_lock(&lock);
+	pthread_create(&other, NULL, lock_tf, NULL);
+	wait_sleepers(1);
+	err = pthread_create(&rt, &attr, lock_tf, NULL);
+	pthread_attr_destroy(&attr);
+	if (err == EPERM) {
+		printf("SCHED_FIFO not permitted, skipping the RT contender\n");
+		pi_mutex_unlock(&lock);
+		pthread_join(other, NULL);
+		return;
+	}
+	if (err)
+		error(EXIT_FAILURE, err, "pthread_create SCHED_FIFO");
+
+	/* The RT contender blocks in FUTEX_LOCK_PI */
+	while (!(__atomic_load_n(&lock.futex, __ATOMIC_RELAXED) &
+		 FUTEX_WAITERS))
+		usleep(1000);
+
+	pi_mutex_unlock(&lock);
+	pthread_join(rt, NULL);
+	pthread_join(other, NULL);
+}
+
+static int promoted, held;
+
+static void *promote_tf(void *p)
+{
+	struct sched_param param = { .sched_priority = 1 };
+
+	/* Contended as SCHED_OTHER first */
+	lock_tf(p);
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) {
+		__atomic_store_n(&promoted, -1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+	__atomic_store_n(&promoted, 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&held, __ATOMIC_ACQUIRE))
+		usleep(1000);
+	lock_tf(p);
+	return NULL;
+}
+
+/* A thread promoted to SCHED_FIFO must contend with PI from then on */
+static void test_promote(void)
+{
+	pthread_t thread;
+	int i;
+
+	pi_mutex_lock(&lock);
+	pthread_create(&thread, NULL, promote_tf, NULL);
+	wait_sleepers(1);
+	pi_mutex_unlock(&lock);
+	while (!__atomic_load_n(&promoted, __ATOMIC_ACQUIRE))
+		usleep(1000);
+	if (promoted < 0) {
+		printf("SCHED_FIFO not permitted, skipping the promotion\n");
+		pthread_join(thread, NULL);
+		return;
+	}
+
+	pi_mutex_lock(&lock);
+	__atomic_store_n(&held, 1, __ATOMIC_RELEASE);
+	for (i = 0; !(__atomic_load_n(&lock.futex, __ATOMIC_RELAXED) &
+		      FUTEX_WAITERS); i++) {
+		if (i == 1000)
+			error(EXIT_FAILURE, 0,
+			      "promoted contender did not use the PI futex");
+		usleep(1000);
+	}
+	pi_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+}
+
+int main(void)
+{
+	int err;
+
+	err = pi_mutex_init(&lock, RTPI_MUTEX_HYBRID);
+	if (err)
+		error(EXIT_FAILURE, err, "pi_mutex_init");
+	pi_cond_init(&cond, 0);
+
+	test_count();
+	test_sleepers();
+	test_cond();
+	test_rt();
+	test_promote();
+
+	if (lock.futex || lock.hwait & 0xffff)
+		error(EXIT_FAILURE, 0, "mutex left in state %#x/%#x",
+		      lock.futex, lock.hwait);
+	printf("counter %lu\n", counter);
+	return 0;
+}
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * RTPI_MUTEX_PROTECT: a thread holding a PROTECT mutex must run at its
+ * ceiling, and at the highest ceiling of the PROTECT mutexes it holds
+ * whatever order it releases them in, and a thread above the ceiling must
+ * be refused, unless it has lowered itself below since. A thread lowered
+ * from the ceiling itself must be raised once it calls pi_sched_changed().
+ * Also checks that a condvar waiter gets the ceiling back with the mutex and
+ * that contended locking stays mutually exclusive. Skipped without the
+ * privilege to use SCHED_FIFO.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define THREADS	4
+#define LOOPS	20000
+
+static pi_mutex_t low, high;
+static pi_cond_t cond;
+static unsigned long counter;
+static int go;
+
+static void check(int err, int want, const char *what)
+{
+	if (err != want)
+		error(EXIT_FAILURE, err, "%s: expected %d, got %d", what, want,
+		      err);
+}
+
+/*
+ * Checks the caller's policy and SCHED_FIFO priority, 0 for SCHED_OTHER.
+ * pthread_getschedparam may return what glibc cached, so ask the kernel.
+ */
+static void check_prio(int prio, const char *what)
+{
+	struct sched_param param;
+	int policy;
+
+	policy = sched_getscheduler(0);
+	sched_getparam(0, &param);
+	if (policy != (prio ? SCHED_FIFO : SCHED_OTHER) ||
+	    param.sched_priority != prio)
+		error(EXIT_FAILURE, 0, "%s: policy %d priority %d, expected %d",
+		      what, policy, param.sched_priority, prio);
+}
+
+static void test_init(void)
+{
+	pi_mutex_t m;
+
+	check(pi_mutex_init(&m, RTPI_MUTEX_PROTECT), EINVAL, "no ceiling");
+	check(pi_mutex_init(&m, RTPI_MUTEX_CEILING(10)), EINVAL,
+	      "ceiling without PROTECT");
+	check(pi_mutex_init(&m, RTPI_MUTEX_PROTECT | RTPI_MUTEX_CEILING(100)),
+	      EINVAL, "ceiling above SCHED_FIFO");
+	check(pi_mutex_init(&low, RTPI_MUTEX_PROTECT | RTPI_MUTEX_CEILING(10)),
+	      0, "init low");
+	check(pi_mutex_init(&high, RTPI_MUTEX_PROTECT | RTPI_MUTEX_CEILING(20)),
+	      0, "init high");
+}
+
+static void test_nesting(void)
+{
+	check_prio(0, "base");
+	check(pi_mutex_lock(&low), 0, "lock low");
+	check_prio(10, "holding low");
+	check(pi_mutex_trylock(&high), 0, "trylock high");
+	check_prio(20, "holding both");
+	check(pi_mutex_trylock(&low), EDEADLOCK, "relock low");
+	check_prio(20, "relock low");
+	check(pi_mutex_unlock(&high), 0, "unlock high");
+	check_prio(10, "high released");
+	check(pi_mutex_unlock(&low), 0, "unlock low");
+	check_prio(0, "both released");
+
+	/* Out of order release keeps the highest ceiling still held */
+	pi_mutex_lock(&low);
+	pi_mutex_lock(&high);
+	pi_mutex_unlock(&low);
+	check_prio(20, "low released first");
+	pi_mutex_unlock(&high);
+	check_prio(0, "released out of order");
+}
+
+static void *above_tf(void *p)
+{
+	struct sched_param param = { .sched_priority = 5 };
+
+	check(pi_mutex_lock(&low), EINVAL, "lock above the ceiling");
+	check(pi_mutex_lock(&high), 0, "lock at the ceiling");
+	check_prio(20, "already at the ceiling");
+	pi_mutex_unlock(&high);
+	check_prio(20, "base FIFO");
+
+	/* Lowered behind the library's back, it must be raised again */
+	check(sched_setscheduler(0, SCHED_FIFO, &param), 0, "lower to 5");
+	check(pi_mutex_lock(&low), 0, "lock after lowering");
+	check_prio(10, "raised from the lowered priority");
+	pi_mutex_unlock(&low);
+	check_prio(5, "back to the lowered priority");
+
+	/* At the ceiling, the parameters come from the cache */
+	param.sched_priority = 10;
+	check(sched_setscheduler(0, SCHED_FIFO, &param), 0, "raise to 10");
+	check(pi_mutex_lock(&low), 0, "lock at the raised priority");
+	pi_mutex_unlock(&low);
+	check_prio(10, "raised base kept");
+	param.sched_priority = 5;
+	check(sched_setscheduler(0, SCHED_FIFO, &param), 0, "lower to 5");
+	pi_sched_changed();
+	check(pi_mutex_lock(&low), 0, "lock after pi_sched_changed");
+	check_prio(10, "raised after pi_sched_changed");
+	pi_mutex_unlock(&low);
+	check_prio(5, "lowered base restored");
+	return NULL;
+}
+
+static void test_above(void)
+{
+	struct sched_param param = { .sched_priority = 20 };
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+	check(pthread_create(&thread, &attr, above_tf, NULL), 0,
+	      "pthread_create SCHED_FIFO");
+	pthread_attr_destroy(&attr);
+	pthread_join(thread, NULL);
+}
+
+static void *cond_tf(void *p)
+{
+	pi_mutex_lock(&low);
+	while (!go)
+		pi_cond_wait(&cond, &low);
+	check_prio(10, "woken from the condvar");
+	pi_mutex_unlock(&low);
+	check_prio(0, "condvar waiter done");
+	return NULL;
+}
+
+static void test_cond(void)
+{
+	pthread_t thread;
+
+	pthread_create(&thread, NULL, cond_tf, NULL);
+	usleep(10000);
+	pi_mutex_lock(&low);
+	go = 1;
+	pi_cond_signal(&cond, &low);
+	pi_mutex_unlock(&low);
+	pthread_join(thread, NULL);
+}
+
+static void *count_tf(void *p)
+{
+	int i;
+
+	for (i = 0; i < LOOPS; i++) {
+		check(pi_mutex_lock(&low), 0, "lock");
+		counter++;
+		if (!(i % 64))
+			sched_yield();
+		check(pi_mutex_unlock(&low), 0, "unlock");
+	}
+	check_prio(0, "counting done");
+	return NULL;
+}
+
+static void test_count(void)
+{
+	pthread_t threads[THREADS];
+	int i;
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, count_tf, NULL);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	if (counter != (unsigned long)THREADS * LOOPS)
+		error(EXIT_FAILURE, 0, "counter %lu, expected %lu", counter,
+		      (unsigned long)THREADS * LOOPS);
+}
+
+int main(void)
+{
+	int err;
+
+	test_init();
+
+	err = pi_mutex_lock(&low);
+	if (err == EPERM) {
+		printf("SCHED_FIFO not permitted, skipping\n");
+		return 77;
+	}
+	check(err, 0, "lock");
+	pi_mutex_unlock(&low);
+
+	pi_cond_init(&cond, 0);
+	test_nesting();
+	test_above();
+	test_cond();
+	test_count();
+	printf("counter %lu\n", counter);
+	return 0;
+}
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * Check the RTPI_MUTEX_STATS counters: uncontended acquisitions count as
+ * fast, a holder sleeping HOLD_MS forces a FUTEX_LOCK_PI acquisition whose
+ * wait and hold times are both recorded, and mutexes without the flag
+ * refuse pi_mutex_get_stats.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define LOOPS	10
+#define HOLD_MS	20
+
+static pi_mutex_t lock;
+static DEFINE_PI_MUTEX(plain, 0);
+static volatile int held;
+
+static void *hold_tf(void *p)
+{
+	pi_mutex_lock(&lock);
+	held = 1;
+	usleep(HOLD_MS * 1000);
+	pi_mutex_unlock(&lock);
+	return NULL;
+}
+
+int main(void)
+{
+	struct pi_mutex_stats st;
+	pthread_t thread;
+	int i, err;
+
+	err = pi_mutex_init(&lock, RTPI_MUTEX_STATS);
+	if (err)
+		error(EXIT_FAILURE, err, "pi_mutex_init");
+
+	for (i = 0; i < LOOPS; i++) {
+		pi_mutex_lock(&lock);
+		pi_mutex_unlock(&lock);
+	}
+	if (pi_mutex_trylock(&lock))
+		error(EXIT_FAILURE, 0, "trylock failed");
+	pi_mutex_unlock(&lock);
+
+	pi_mutex_get_stats(&lock, &st);
+	if (st.fast != LOOPS + 1 || st.slow || st.wait_ns || st.max_wait_ns)
+		error(EXIT_FAILURE, 0,
+		      "uncontended: fast %llu slow %llu wait %llu",
+		      (unsigned long long)st.fast, (unsigned long long)st.slow,
+		      (unsigned long long)st.wait_ns);
+
+	pthread_create(&thread, NULL, hold_tf, NULL);
+	while (!held)
+		usleep(100);
+	pi_mutex_lock(&lock);
+	pi_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+
+	pi_mutex_get_stats(&lock, &st);
+	printf("fast %llu slow %llu wait %llu ns max wait %llu ns max hold %llu ns\n",
+	       (unsigned long long)st.fast, (unsigned long long)st.slow,
+	       (unsigned long long)st.wait_ns,
+	       (unsigned long long)st.max_wait_ns,
+	       (unsigned long long)st.max_hold_ns);
+
+	if (st.fast != LOOPS + 2 || st.slow != 1)
+		error(EXIT_FAILURE, 0, "contended: wrong acquisition counts");
+	if (st.max_wait_ns < HOLD_MS * 1000000ULL / 2 ||
+	    st.wait_ns < st.max_wait_ns)
+		error(EXIT_FAILURE, 0, "contended: wait time not recorded");
+	if (st.max_hold_ns < HOLD_MS * 1000000ULL)
+		error(EXIT_FAILURE, 0, "contended: hold time not recorded");
+
+	err = pi_mutex_get_stats(&plain, &st);
+	if (err != EINVAL)
+		error(EXIT_FAILURE, err, "stats of a plain mutex");
+	return 0;
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_mutex_timedlock must give up on a held mutex at the CLOCK_MONOTONIC
+ * deadline, pi_mutex_reltimedlock after its relative timeout, and both must
+ * take the mutex once the owner releases it.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define TIMEOUT_NS	50000000LL
+#define SLACK_NS	1000000000LL
+
+static DEFINE_PI_MUTEX(lock, 0);
+static volatile int release;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void to_timespec(long long ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000LL;
+	ts->tv_nsec = ns % 1000000000LL;
+}
+
+static void *owner_tf(void *p)
+{
+	pi_mutex_lock(&lock);
+	/*
+	 * Blocking on a PI mutex owned by main would be a PI chain deadlock,
+	 * so poll for the release instead.
+	 */
+	while (!release)
+		usleep(1000);
+	pi_mutex_unlock(&lock);
+	return NULL;
+}
+
+int main(void)
+{
+	struct timespec ts;
+	pthread_t owner;
+	long long start, elapsed;
+	int err;
+
+	pthread_create(&owner, NULL, owner_tf, NULL);
+	while (!pi_mutex_trylock(&lock))
+		pi_mutex_unlock(&lock);
+
+	start = now_ns();
+	to_timespec(start + TIMEOUT_NS, &ts);
+	err = pi_mutex_timedlock(&lock, &ts);
+	elapsed = now_ns() - start;
+	if (err != ETIMEDOUT)
+		error(EXIT_FAILURE, err, "timedlock of held mutex");
+	if (elapsed < TIMEOUT_NS || elapsed > TIMEOUT_NS + SLACK_NS) {
+		printf("FAIL: timed out after %lld ns\n", elapsed);
+		return 1;
+	}
+	printf("timed out after %lld ns\n", elapsed);
+
+	start = now_ns();
+	to_timespec(TIMEOUT_NS, &ts);
+	err = pi_mutex_reltimedlock(&lock, &ts);
+	elapsed = now_ns() - start;
+	if (err != ETIMEDOUT)
+		error(EXIT_FAILURE, err, "reltimedlock of held mutex");
+	if (elapsed < TIMEOUT_NS || elapsed > TIMEOUT_NS + SLACK_NS) {
+		printf("FAIL: relative timeout after %lld ns\n", elapsed);
+		return 1;
+	}
+
+	ts.tv_nsec = 1000000000;
+	err = pi_mutex_reltimedlock(&lock, &ts);
+	if (err != EINVAL)
+		error(EXIT_FAILURE, err, "reltimedlock with invalid reltime");
+	err = pi_mutex_timedlock(&lock, &ts);
+	if (err != EINVAL)
+		error(EXIT_FAILURE, err, "timedlock with invalid abstime");
+
+	/* Release the owner, the timed lock must now succeed. */
+	release = 1;
+	to_timespec(now_ns() + SLACK_NS * 10, &ts);
+	err = pi_mutex_timedlock(&lock, &ts);
+	if (err)
+		error(EXIT_FAILURE, err, "timedlock after release");
+	err = pi_mutex_timedlock(&lock, &ts);
+	if (err != EDEADLOCK)
+		error(EXIT_FAILURE, err, "timedlock of owned mutex");
+	pi_mutex_unlock(&lock);
+
+	/* Uncontended, with no time left */
+	ts.tv_sec = 0;
+	ts.tv_nsec = 0;
+	err = pi_mutex_reltimedlock(&lock, &ts);
+	if (err)
+		error(EXIT_FAILURE, err, "reltimedlock of free mutex");
+	pi_mutex_unlock(&lock);
+	pthread_join(owner, NULL);
+	return 0;
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * Target for tst-prof.sh: a holder thread keeps the mutex for HOLD_MS at a
+ * time while main contends for it from contend_site(), which the
+ * librtpi-prof.so report must name. Also waits on a condvar so the
+ * interposed pi_cond_timedwait path is exercised.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define ROUNDS	5
+#define HOLD_MS	2
+
+static DEFINE_PI_MUTEX(lock, 0);
+static DEFINE_PI_COND(cond, 0);
+static volatile int held;
+
+static void *hold_tf(void *p)
+{
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		pi_mutex_lock(&lock);
+		held = 1;
+		usleep(HOLD_MS * 1000);
+		pi_mutex_unlock(&lock);
+		while (held)
+			usleep(100);
+	}
+	return NULL;
+}
+
+__attribute__((noinline)) void contend_site(void)
+{
+	int err;
+
+	err = pi_mutex_lock(&lock);
+	if (err)
+		error(EXIT_FAILURE, err, "lock");
+	pi_mutex_unlock(&lock);
+}
+
+int main(void)
+{
+	struct timespec ts;
+	pthread_t thread;
+	int i;
+
+	pthread_create(&thread, NULL, hold_tf, NULL);
+	for (i = 0; i < ROUNDS; i++) {
+		while (!held)
+			usleep(100);
+		contend_site();
+		held = 0;
+	}
+	pthread_join(thread, NULL);
+
+	pi_mutex_lock(&lock);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_nsec += 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	if (pi_cond_timedwait(&cond, &lock, &ts) != ETIMEDOUT)
+		error(EXIT_FAILURE, 0, "pi_cond_timedwait did not time out");
+	pi_mutex_unlock(&lock);
+	return 0;
+}
@@ -0,0 +1,8 @@
+#!/bin/sh
+# Run tst-prof under librtpi-prof.so and check that the report names the
+# contended call site.
+prof=../src/.libs/librtpi-prof.so
+test -f $prof || exit 77
+LD_PRELOAD=$prof ./tst-prof 2>tst-prof.log || exit 1
+cat tst-prof.log
+grep -q "contend_site+" tst-prof.log
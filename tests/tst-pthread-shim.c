@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * Target for tst-pthread-shim.sh: a plain pthread program, run with
+ * librtpi-pthread.so preloaded. Checks that a locked mutex holds the owner
+ * TID in its first word, as a PI futex does and a glibc mutex does not, and
+ * then exercises the mutex types, signal, broadcast, timed waits on both
+ * clocks and destroying a condvar its waiters are leaving through the shim.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NR_WAITERS	3
+#define TIMEOUT_MS	20
+#define DESTROY_ROUNDS	100
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t rlock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int woken, ready;
+static bool go;
+
+static void check(int err, int want, const char *what)
+{
+	if (err != want)
+		error(EXIT_FAILURE, err, "%s: expected %d, got %d", what, want,
+		      err);
+}
+
+static void deadline(clockid_t clock, struct timespec *ts)
+{
+	clock_gettime(clock, ts);
+	ts->tv_nsec += TIMEOUT_MS * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void *timedlock_tf(void *p __attribute__ ((unused)))
+{
+	struct timespec ts;
+
+	check(pthread_mutex_trylock(&lock), EBUSY, "trylock held");
+	deadline(CLOCK_REALTIME, &ts);
+	check(pthread_mutex_timedlock(&lock, &ts), ETIMEDOUT, "timedlock");
+	return NULL;
+}
+
+static void test_mutex_types(void)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutex_t m;
+	pthread_t thread;
+
+	check(pthread_mutex_lock(&lock), 0, "lock");
+	if (*(unsigned int *)&lock != (unsigned int)syscall(SYS_gettid))
+		error(EXIT_FAILURE, 0, "mutex word is not the owner TID");
+	pthread_create(&thread, NULL, timedlock_tf, NULL);
+	pthread_join(thread, NULL);
+	check(pthread_mutex_unlock(&lock), 0, "unlock");
+
+	check(pthread_mutex_lock(&rlock), 0, "recursive lock");
+	check(pthread_mutex_lock(&rlock), 0, "recursive relock");
+	check(pthread_mutex_trylock(&rlock), 0, "recursive trylock");
+	check(pthread_mutex_unlock(&rlock), 0, "recursive unlock 3");
+	check(pthread_mutex_unlock(&rlock), 0, "recursive unlock 2");
+	check(pthread_mutex_unlock(&rlock), 0, "recursive unlock 1");
+	check(pthread_mutex_unlock(&rlock), EPERM, "recursive unlock 0");
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+	check(pthread_mutex_init(&m, &attr), 0, "errorcheck init");
+	check(pthread_mutex_lock(&m), 0, "errorcheck lock");
+	check(pthread_mutex_lock(&m), EDEADLOCK, "errorcheck relock");
+	check(pthread_mutex_destroy(&m), EBUSY, "destroy held");
+	check(pthread_mutex_unlock(&m), 0, "errorcheck unlock");
+	check(pthread_mutex_destroy(&m), 0, "destroy");
+
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	check(pthread_mutex_init(&m, &attr), ENOTSUP, "robust init");
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void *waiter_tf(void *p)
+{
+	pthread_mutex_t *m = p;
+
+	pthread_mutex_lock(m);
+	/* Waits on a recursive mutex must get it back with the same count */
+	if (m == &rlock)
+		pthread_mutex_lock(m);
+	ready++;
+	while (!go)
+		check(pthread_cond_wait(&cond, m), 0, "cond_wait");
+	woken++;
+	if (m == &rlock) {
+		check(pthread_mutex_unlock(m), 0, "recursive unlock");
+		pthread_mutex_unlock(m);
+		check(pthread_mutex_unlock(m), EPERM, "recursive over-unlock");
+	} else {
+		pthread_mutex_unlock(m);
+	}
+	return NULL;
+}
+
+static void test_cond_wake(pthread_mutex_t *m, bool broadcast)
+{
+	pthread_t threads[NR_WAITERS];
+	int i;
+
+	ready = woken = 0;
+	go = false;
+	for (i = 0; i < NR_WAITERS; i++)
+		pthread_create(&threads[i], NULL, waiter_tf, m);
+	for (;;) {
+		pthread_mutex_lock(m);
+		if (ready == NR_WAITERS)
+			break;
+		pthread_mutex_unlock(m);
+		usleep(1000);
+	}
+	go = true;
+	if (broadcast) {
+		check(pthread_cond_broadcast(&cond), 0, "broadcast");
+	} else {
+		for (i = 0; i < NR_WAITERS; i++)
+			check(pthread_cond_signal(&cond), 0, "signal");
+	}
+	pthread_mutex_unlock(m);
+	for (i = 0; i < NR_WAITERS; i++)
+		pthread_join(threads[i], NULL);
+	if (woken != NR_WAITERS)
+		error(EXIT_FAILURE, 0, "%d of %d waiters woken", woken,
+		      NR_WAITERS);
+}
+
+static void test_cond_timeout(void)
+{
+	pthread_condattr_t attr;
+	pthread_cond_t mcond;
+	struct timespec ts;
+
+	pthread_mutex_lock(&lock);
+	deadline(CLOCK_REALTIME, &ts);
+	check(pthread_cond_timedwait(&cond, &lock, &ts), ETIMEDOUT,
+	      "timedwait realtime");
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	check(pthread_cond_init(&mcond, &attr), 0, "cond_init");
+	pthread_condattr_destroy(&attr);
+	deadline(CLOCK_MONOTONIC, &ts);
+	check(pthread_cond_timedwait(&mcond, &lock, &ts), ETIMEDOUT,
+	      "timedwait monotonic");
+	deadline(CLOCK_MONOTONIC, &ts);
+	check(pthread_cond_clockwait(&cond, &lock, CLOCK_MONOTONIC, &ts),
+	      ETIMEDOUT, "clockwait");
+	check(pthread_cond_destroy(&mcond), 0, "cond_destroy");
+	pthread_mutex_unlock(&lock);
+
+	check(pthread_cond_wait(&cond, &lock), EPERM, "wait unlocked");
+}
+
+struct destroy_arg {
+	pthread_cond_t	*cond;
+	bool		go;
+};
+
+static void *destroy_waiter_tf(void *p)
+{
+	struct destroy_arg *arg = p;
+
+	pthread_mutex_lock(&lock);
+	ready++;
+	while (!arg->go)
+		check(pthread_cond_wait(arg->cond, &lock), 0, "cond_wait");
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/*
+ * Destroy a condvar right after waking its waiters, as POSIX allows, and
+ * scribble over it: the waiters must be gone from it by then. Given the
+ * privilege, the destroyer runs SCHED_FIFO for that, so that the woken
+ * waiters cannot leave before it even on a single CPU.
+ */
+static void test_cond_destroy(void)
+{
+	struct sched_param fifo = { .sched_priority = 1 }, other = { 0 };
+	struct destroy_arg arg;
+	pthread_t threads[NR_WAITERS];
+	unsigned char *mem;
+	size_t i;
+	int round;
+
+	for (round = 0; round < DESTROY_ROUNDS; round++) {
+		mem = malloc(sizeof(pthread_cond_t));
+		if (!mem)
+			error(EXIT_FAILURE, ENOMEM, "malloc");
+		arg.cond = (pthread_cond_t *)mem;
+		arg.go = false;
+		check(pthread_cond_init(arg.cond, NULL), 0, "cond_init");
+		ready = 0;
+		for (i = 0; i < NR_WAITERS; i++)
+			pthread_create(&threads[i], NULL, destroy_waiter_tf,
+				       &arg);
+		for (;;) {
+			pthread_mutex_lock(&lock);
+			if (ready == NR_WAITERS)
+				break;
+			pthread_mutex_unlock(&lock);
+			usleep(1000);
+		}
+		pthread_setschedparam(pthread_self(), SCHED_FIFO, &fifo);
+		arg.go = true;
+		check(pthread_cond_broadcast(arg.cond), 0, "broadcast");
+		/* The woken waiters need the mutex to leave */
+		check(pthread_cond_destroy(arg.cond), EBUSY, "destroy locked");
+		pthread_mutex_unlock(&lock);
+		check(pthread_cond_destroy(arg.cond), 0, "destroy woken");
+		memset(mem, 0xa5, sizeof(pthread_cond_t));
+		pthread_setschedparam(pthread_self(), SCHED_OTHER, &other);
+
+		for (i = 0; i < NR_WAITERS; i++)
+			pthread_join(threads[i], NULL);
+		for (i = 0; i < sizeof(pthread_cond_t); i++)
+			if (mem[i] != 0xa5)
+				error(EXIT_FAILURE, 0,
+				      "destroyed condvar written to");
+		free(mem);
+	}
+}
+
+int main(void)
+{
+	test_mutex_types();
+	test_cond_wake(&lock, false);
+	test_cond_wake(&lock, true);
+	test_cond_wake(&rlock, true);
+	test_cond_timeout();
+	test_cond_destroy();
+	return 0;
+}
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Run the plain pthread program tst-pthread-shim with librtpi-pthread.so
+# preloaded.
+shim=../src/.libs/librtpi-pthread.so
+test -f $shim || exit 77
+LD_PRELOAD=$shim ./tst-pthread-shim
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_rwlock_t: readers must share the lock, writers must exclude readers
+ * and each other under a mixed load, and the timed and try variants must
+ * give up without leaving the lock blocked.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include "rtpi.h"
+
+#define READERS	4
+#define WRITERS	2
+#define LOOPS	20000
+
+static DEFINE_PI_RWLOCK(rwlock, 0);
+static volatile unsigned long a, b;
+static int inside, stop;
+
+static void deadline(struct timespec *ts, long ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/* Every reader must get in before any of them leaves. */
+static void *share_tf(void *p)
+{
+	int err;
+
+	err = pi_rwlock_rdlock(&rwlock);
+	if (err)
+		error(EXIT_FAILURE, err, "rdlock");
+	__atomic_add_fetch(&inside, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&inside, __ATOMIC_SEQ_CST) < READERS)
+		;
+	pi_rwlock_unlock(&rwlock);
+	return NULL;
+}
+
+static void *reader_tf(void *p)
+{
+	unsigned long x, y;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		pi_rwlock_rdlock(&rwlock);
+		x = a;
+		y = b;
+		pi_rwlock_unlock(&rwlock);
+		if (x != y)
+			error(EXIT_FAILURE, 0, "reader saw a torn update");
+	}
+	return NULL;
+}
+
+static void *writer_tf(void *p)
+{
+	int i;
+
+	for (i = 0; i < LOOPS; i++) {
+		pi_rwlock_wrlock(&rwlock);
+		a++;
+		b++;
+		pi_rwlock_unlock(&rwlock);
+	}
+	return NULL;
+}
+
+static void *timedwr_tf(void *p)
+{
+	struct timespec ts;
+
+	deadline(&ts, 20);
+	return (void *)(long)pi_rwlock_timedwrlock(&rwlock, &ts);
+}
+
+static void *timedrd_tf(void *p)
+{
+	struct timespec ts;
+
+	deadline(&ts, 20);
+	return (void *)(long)pi_rwlock_timedrdlock(&rwlock, &ts);
+}
+
+static long run(void *(*fn)(void *))
+{
+	pthread_t thread;
+	void *res;
+
+	pthread_create(&thread, NULL, fn, NULL);
+	pthread_join(thread, &res);
+	return (long)res;
+}
+
+int main(void)
+{
+	pthread_t readers[READERS], writers[WRITERS];
+	long err;
+	int i;
+
+	for (i = 0; i < READERS; i++)
+		pthread_create(&readers[i], NULL, share_tf, NULL);
+	for (i = 0; i < READERS; i++)
+		pthread_join(readers[i], NULL);
+
+	for (i = 0; i < READERS; i++)
+		pthread_create(&readers[i], NULL, reader_tf, NULL);
+	for (i = 0; i < WRITERS; i++)
+		pthread_create(&writers[i], NULL, writer_tf, NULL);
+	for (i = 0; i < WRITERS; i++)
+		pthread_join(writers[i], NULL);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < READERS; i++)
+		pthread_join(readers[i], NULL);
+	if (a != (unsigned long)WRITERS * LOOPS)
+		error(EXIT_FAILURE, 0, "counter %lu, expected %lu", a,
+		      (unsigned long)WRITERS * LOOPS);
+
+	/* A writer times out on a reader, and lets readers back in. */
+	pi_rwlock_rdlock(&rwlock);
+	err = pi_rwlock_trywrlock(&rwlock);
+	if (err != EBUSY)
+		error(EXIT_FAILURE, err, "trywrlock with a reader");
+	err = run(timedwr_tf);
+	if (err != ETIMEDOUT)
+		error(EXIT_FAILURE, err, "timedwrlock with a reader");
+	err = pi_rwlock_tryrdlock(&rwlock);
+	if (err)
+		error(EXIT_FAILURE, err, "tryrdlock after writer timeout");
+	pi_rwlock_unlock(&rwlock);
+	pi_rwlock_unlock(&rwlock);
+
+	/* A reader times out on a writer. */
+	pi_rwlock_wrlock(&rwlock);
+	err = pi_rwlock_tryrdlock(&rwlock);
+	if (err != EBUSY)
+		error(EXIT_FAILURE, err, "tryrdlock with a writer");
+	err = run(timedrd_tf);
+	if (err != ETIMEDOUT)
+		error(EXIT_FAILURE, err, "timedrdlock with a writer");
+	pi_rwlock_unlock(&rwlock);
+
+	err = pi_rwlock_unlock(&rwlock);
+	if (err != EPERM)
+		error(EXIT_FAILURE, err, "unlock of an unlocked rwlock");
+
+	printf("counter %lu\n", a);
+	return 0;
+}
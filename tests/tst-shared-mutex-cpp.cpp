@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+// rtpi::shared_timed_mutex must work with std::shared_lock and
+// std::unique_lock, let readers share it, and time out in both modes.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+#include "rtpi/shared_mutex.hpp"
+
+static rtpi::shared_timed_mutex lock;
+
+int main()
+{
+	using namespace std::chrono;
+	std::atomic<bool> locked(false), release(false);
+
+	std::thread reader([&] {
+		std::shared_lock<rtpi::shared_timed_mutex> guard(lock);
+		locked = true;
+		while (!release)
+			std::this_thread::yield();
+	});
+	while (!locked)
+		std::this_thread::yield();
+
+	{
+		std::shared_lock<rtpi::shared_timed_mutex> sl(lock,
+							      std::try_to_lock);
+		if (!sl.owns_lock()) {
+			std::printf("FAIL: readers do not share the lock\n");
+			return 1;
+		}
+	}
+	if (lock.try_lock_for(milliseconds(20))) {
+		std::printf("FAIL: try_lock_for took a read-locked mutex\n");
+		return 1;
+	}
+	release = true;
+	reader.join();
+
+	std::unique_lock<rtpi::shared_timed_mutex> ul(lock, seconds(10));
+	if (!ul.owns_lock()) {
+		std::printf("FAIL: unique_lock timed out on a free mutex\n");
+		return 1;
+	}
+	std::thread timed([] {
+		if (lock.try_lock_shared_until(system_clock::now() +
+					       milliseconds(20))) {
+			std::printf("FAIL: try_lock_shared_until took a "
+				    "write-locked mutex\n");
+			std::exit(1);
+		}
+	});
+	timed.join();
+	ul.unlock();
+	return 0;
+}
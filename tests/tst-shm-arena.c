@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_shm_arena: processes opening the same named arena at once must agree on
+ * one initialization of the region and of each named object, and the
+ * mutexes and condvars found by name must work across them. Also covers a
+ * memfd arena attached through its file descriptor, the lookup errors, and
+ * an arena and entries left half set up by a process that died.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define PROCS		4
+#define LOOPS		10000
+#define ARENA_SIZE	(64 * 1024)
+
+struct shared {
+	unsigned long	counter;
+	int		ready;
+	int		go;
+};
+
+static char name[64];
+
+/* Everything a process needs, looked up by name from a fresh mapping */
+static void lookup(pi_shm_arena_t *arena, pi_mutex_t **mutex,
+		   pi_cond_t **cond, struct shared **shared)
+{
+	*mutex = pi_shm_arena_mutex(arena, "lock", 0);
+	*cond = pi_shm_arena_cond(arena, "cond", 0);
+	*shared = pi_shm_arena_object(arena, "shared", sizeof(**shared));
+	if (!*mutex || !*cond || !*shared)
+		error(EXIT_FAILURE, errno, "lookup");
+}
+
+static int child(void)
+{
+	struct shared *shared;
+	pi_shm_arena_t *arena;
+	pi_mutex_t *mutex;
+	pi_cond_t *cond;
+	int i;
+
+	arena = pi_shm_arena_open(name, ARENA_SIZE, RTPI_SHM_CREATE);
+	if (!arena)
+		error(EXIT_FAILURE, errno, "child: pi_shm_arena_open");
+	lookup(arena, &mutex, &cond, &shared);
+
+	for (i = 0; i < LOOPS; i++) {
+		pi_mutex_lock(mutex);
+		shared->counter++;
+		pi_mutex_unlock(mutex);
+	}
+
+	/* Wait for the parent to release everyone at once */
+	pi_mutex_lock(mutex);
+	shared->ready++;
+	pi_cond_broadcast(cond, mutex);
+	while (!shared->go)
+		pi_cond_wait(cond, mutex);
+	pi_mutex_unlock(mutex);
+
+	pi_shm_arena_close(arena);
+	return 0;
+}
+
+static void wait_children(int n)
+{
+	int status;
+
+	while (n--) {
+		if (wait(&status) < 0)
+			error(EXIT_FAILURE, errno, "wait");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			error(EXIT_FAILURE, 0, "child failed");
+	}
+}
+
+static void test_named(void)
+{
+	struct shared *shared;
+	pi_shm_arena_t *arena;
+	pi_mutex_t *mutex;
+	pi_cond_t *cond;
+	int i;
+
+	snprintf(name, sizeof(name), "/rtpi-tst-shm-arena-%d", getpid());
+	for (i = 0; i < PROCS; i++) {
+		if (!fork())
+			exit(child());
+	}
+
+	arena = pi_shm_arena_open(name, ARENA_SIZE, RTPI_SHM_CREATE);
+	if (!arena)
+		error(EXIT_FAILURE, errno, "pi_shm_arena_open");
+	lookup(arena, &mutex, &cond, &shared);
+
+	pi_mutex_lock(mutex);
+	while (shared->ready < PROCS)
+		pi_cond_wait(cond, mutex);
+	shared->go = 1;
+	pi_cond_broadcast(cond, mutex);
+	pi_mutex_unlock(mutex);
+	wait_children(PROCS);
+
+	if (shared->counter != (unsigned long)PROCS * LOOPS)
+		error(EXIT_FAILURE, 0, "counter %lu, expected %lu",
+		      shared->counter, (unsigned long)PROCS * LOOPS);
+
+	/* Same objects on a second mapping */
+	if (pi_shm_arena_open(name, ARENA_SIZE,
+			      RTPI_SHM_CREATE | RTPI_SHM_EXCL) ||
+	    errno != EEXIST)
+		error(EXIT_FAILURE, errno, "exclusive create of an arena");
+	if (pi_shm_arena_open(name, 2 * ARENA_SIZE, RTPI_SHM_CREATE) ||
+	    errno != EINVAL)
+		error(EXIT_FAILURE, errno, "open with a larger size");
+	pi_shm_arena_close(arena);
+	arena = pi_shm_arena_open(name, 0, 0);
+	if (!arena)
+		error(EXIT_FAILURE, errno, "attach");
+	lookup(arena, &mutex, &cond, &shared);
+	if (shared->counter != (unsigned long)PROCS * LOOPS)
+		error(EXIT_FAILURE, 0, "attached counter %lu", shared->counter);
+
+	pi_shm_arena_close(arena);
+	if (pi_shm_arena_unlink(name))
+		error(EXIT_FAILURE, errno, "pi_shm_arena_unlink");
+}
+
+static void test_memfd(void)
+{
+	pi_shm_arena_t *arena, *attached;
+	char long_name[RTPI_SHM_NAME_MAX + 2];
+	unsigned int i;
+	int *obj;
+
+	arena = pi_shm_arena_open(NULL, ARENA_SIZE, RTPI_SHM_CREATE);
+	if (!arena)
+		error(EXIT_FAILURE, errno, "memfd arena");
+	attached = pi_shm_arena_open_fd(pi_shm_arena_fd(arena), 0);
+	if (!attached)
+		error(EXIT_FAILURE, errno, "pi_shm_arena_open_fd");
+
+	obj = pi_shm_arena_object(arena, "obj", sizeof(*obj));
+	*obj = 42;
+	obj = pi_shm_arena_object(attached, "obj", sizeof(*obj));
+	if (!obj || *obj != 42)
+		error(EXIT_FAILURE, errno, "object through the attached fd");
+
+	if (pi_shm_arena_cond(attached, "obj", 0) || errno != EINVAL)
+		error(EXIT_FAILURE, errno, "lookup as another kind");
+	memset(long_name, 'x', sizeof(long_name) - 1);
+	long_name[sizeof(long_name) - 1] = '\0';
+	if (pi_shm_arena_mutex(arena, long_name, 0) || errno != ENAMETOOLONG)
+		error(EXIT_FAILURE, errno, "long name");
+
+	/* One entry per KiB: the directory fills before the arena does */
+	for (i = 0;; i++) {
+		char n[16];
+
+		snprintf(n, sizeof(n), "m%u", i);
+		if (!pi_shm_arena_mutex(arena, n, 0))
+			break;
+	}
+	if (errno != ENOSPC && errno != ENOMEM)
+		error(EXIT_FAILURE, errno, "filling the arena");
+
+	pi_shm_arena_close(attached);
+	pi_shm_arena_close(arena);
+}
+
+/*
+ * Internal layout, from pi_shm_arena.c: a word being set up holds the PID of
+ * its owner, and an arena this small has 16 directory entries after a one
+ * cache line header.
+ */
+#define DEAD_SIZE	4096
+#define DEAD_ENTRIES	16
+#define DEAD_BUSY	0x80000000
+
+static pid_t dead_pid(void)
+{
+	pid_t pid = fork();
+
+	if (!pid)
+		_exit(0);
+	if (pid < 0 || waitpid(pid, NULL, 0) != pid)
+		error(EXIT_FAILURE, errno, "fork");
+	return pid;
+}
+
+/* A process that dies halfway through a setup must not block the others */
+static void test_dead_owner(void)
+{
+	pi_shm_arena_t *arena;
+	__u32 *words, busy;
+	int fd, i;
+
+	busy = DEAD_BUSY | dead_pid();
+	fd = memfd_create("tst-shm-arena", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, DEAD_SIZE))
+		error(EXIT_FAILURE, errno, "memfd");
+	words = mmap(NULL, DEAD_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		     0);
+	if (words == MAP_FAILED)
+		error(EXIT_FAILURE, errno, "mmap");
+
+	/* Header */
+	words[0] = busy;
+	arena = pi_shm_arena_open_fd(fd, 0);
+	if (!arena)
+		error(EXIT_FAILURE, errno, "arena left busy by a dead process");
+	if (!pi_shm_arena_object(arena, "obj", sizeof(int)))
+		error(EXIT_FAILURE, errno, "object in a recovered arena");
+
+	/* Every directory entry, so a lookup must get past all of them */
+	for (i = 1; i <= DEAD_ENTRIES; i++)
+		words[i * 64 / sizeof(*words)] = busy;
+	if (pi_shm_arena_object(arena, "new", sizeof(int)) ||
+	    errno != ENOSPC)
+		error(EXIT_FAILURE, errno, "entries left busy by a dead process");
+
+	pi_shm_arena_close(arena);
+	munmap(words, DEAD_SIZE);
+	close(fd);
+}
+
+int main(void)
+{
+	test_named();
+	test_memfd();
+	test_dead_owner();
+	return 0;
+}
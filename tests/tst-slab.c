@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_mutex_alloc and pi_cond_alloc must hand out distinct, cache line
+ * aligned objects, in bulk and from several threads at once, and reuse
+ * freed ones.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "rtpi.h"
+
+#define THREADS	4
+#define BULK	1000
+#define LOOPS	20000
+
+static void check_aligned(void *obj)
+{
+	if (!obj)
+		error(EXIT_FAILURE, ENOMEM, "alloc");
+	if ((uintptr_t)obj % 64)
+		error(EXIT_FAILURE, 0, "%p is not cache line aligned", obj);
+}
+
+/* Each thread stamps its objects and checks nobody else got them. */
+static void *alloc_tf(void *p)
+{
+	uintptr_t id = (uintptr_t)p;
+	pi_mutex_t *mutex;
+	pi_cond_t *cond;
+	int i;
+
+	for (i = 0; i < LOOPS; i++) {
+		mutex = pi_mutex_alloc();
+		cond = pi_cond_alloc();
+		check_aligned(mutex);
+		check_aligned(cond);
+		mutex->flags = id;
+		cond->flags = id;
+		sched_yield();
+		if (mutex->flags != id || cond->flags != id)
+			error(EXIT_FAILURE, 0, "object handed out twice");
+		pi_cond_free(cond);
+		pi_mutex_free(mutex);
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	static pi_mutex_t *mutexes[BULK];
+	static pi_cond_t *conds[BULK];
+	pthread_t threads[THREADS];
+	pi_mutex_t *reused;
+	int i, j, err;
+
+	err = pi_mutex_alloc_bulk(mutexes, BULK);
+	if (err)
+		error(EXIT_FAILURE, err, "pi_mutex_alloc_bulk");
+	err = pi_cond_alloc_bulk(conds, BULK);
+	if (err)
+		error(EXIT_FAILURE, err, "pi_cond_alloc_bulk");
+
+	for (i = 0; i < BULK; i++) {
+		check_aligned(mutexes[i]);
+		check_aligned(conds[i]);
+		pi_mutex_init(mutexes[i], 0);
+		pi_cond_init(conds[i], 0);
+		for (j = 0; j < i; j++)
+			if (mutexes[j] == mutexes[i] || conds[j] == conds[i])
+				error(EXIT_FAILURE, 0, "duplicate object");
+	}
+
+	/* Every mutex must be usable on its own. */
+	for (i = 0; i < BULK; i++)
+		pi_mutex_lock(mutexes[i]);
+	for (i = 0; i < BULK; i++)
+		pi_mutex_unlock(mutexes[i]);
+
+	pi_mutex_free(mutexes[BULK / 2]);
+	reused = pi_mutex_alloc();
+	if (reused != mutexes[BULK / 2])
+		error(EXIT_FAILURE, 0, "freed mutex was not reused");
+	pi_mutex_free(reused);
+
+	pi_mutex_free(NULL);
+
+	for (i = 0; i < BULK; i++) {
+		if (i != BULK / 2)
+			pi_mutex_free(mutexes[i]);
+		pi_cond_free(conds[i]);
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, alloc_tf,
+			       (void *)(uintptr_t)(i + 1));
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	return 0;
+}
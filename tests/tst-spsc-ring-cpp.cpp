@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+// rtpi::spsc_ring must pass move-only elements from the producer to the
+// consumer in order, and destroy the elements left behind.
+
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+#include "rtpi/spsc_ring.hpp"
+
+#define LOOPS	100000
+
+static rtpi::spsc_ring<std::unique_ptr<long>, 8> ring;
+
+static void producer()
+{
+	for (long i = 0; i < LOOPS; i++)
+		ring.push(std::unique_ptr<long>(new long(i)));
+}
+
+int main()
+{
+	std::unique_ptr<long> p;
+
+	if (ring.try_pop(p)) {
+		std::printf("FAIL: popped from an empty ring\n");
+		return 1;
+	}
+
+	std::thread t(producer);
+	for (long i = 0; i < LOOPS; i++) {
+		p = ring.pop();
+		if (*p != i) {
+			std::printf("FAIL: got %ld, expected %ld\n", *p, i);
+			return 1;
+		}
+	}
+	t.join();
+
+	std::shared_ptr<int> ref = std::make_shared<int>(0);
+	{
+		rtpi::spsc_ring<std::shared_ptr<int>, 2> small;
+
+		if (!small.try_push(ref) || !small.try_push(ref) ||
+		    small.try_push(ref)) {
+			std::printf("FAIL: pushed past the capacity\n");
+			return 1;
+		}
+	}
+	if (ref.use_count() != 1) {
+		std::printf("FAIL: elements leaked\n");
+		return 1;
+	}
+
+	std::printf("%d elements\n", LOOPS);
+	return 0;
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+/*
+ * pi_spsc_ring must pass every element from the producer to the consumer in
+ * order, with both sides blocking on a full and an empty ring, and report a
+ * full or empty ring to the try variants.
+ */
+
+#define _GNU_SOURCE
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "rtpi.h"
+
+#define LOOPS	100000
+#define SLOTS	4
+
+struct item {
+	long seq;
+	long val;
+};
+
+static pi_spsc_ring_t *ring;
+
+static void *producer_tf(void *p)
+{
+	struct item it;
+	long i;
+	int err;
+
+	for (i = 0; i < LOOPS; i++) {
+		it.seq = i;
+		it.val = i * 3;
+		err = pi_spsc_ring_push(ring, &it);
+		if (err)
+			error(EXIT_FAILURE, err, "pi_spsc_ring_push");
+		/* Let the consumer drain the ring and block now and then */
+		if (!(i % 10000))
+			usleep(1000);
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pi_spsc_ring_t local;
+	struct item it, buf[SLOTS];
+	pthread_t producer;
+	long i;
+	int err;
+
+	if (pi_spsc_ring_init(&local, buf, 3, sizeof(it), 0) != EINVAL ||
+	    pi_spsc_ring_init(&local, buf, SLOTS, sizeof(it), 0x80) != EINVAL)
+		error(EXIT_FAILURE, 0, "pi_spsc_ring_init accepted bad args");
+
+	err = pi_spsc_ring_init(&local, buf, SLOTS, sizeof(it), 0);
+	if (err)
+		error(EXIT_FAILURE, err, "pi_spsc_ring_init");
+	if (pi_spsc_ring_trypop(&local, &it) != EAGAIN)
+		error(EXIT_FAILURE, 0, "trypop of an empty ring");
+	for (i = 0; i < SLOTS; i++) {
+		it.seq = i;
+		err = pi_spsc_ring_trypush(&local, &it);
+		if (err)
+			error(EXIT_FAILURE, err, "trypush");
+	}
+	if (pi_spsc_ring_trypush(&local, &it) != EAGAIN)
+		error(EXIT_FAILURE, 0, "trypush of a full ring");
+	for (i = 0; i < SLOTS; i++) {
+		if (pi_spsc_ring_trypop(&local, &it) || it.seq != i)
+			error(EXIT_FAILURE, 0, "trypop %ld", i);
+	}
+	pi_spsc_ring_destroy(&local);
+
+	ring = pi_spsc_ring_alloc(SLOTS, sizeof(it), 0);
+	if (!ring)
+		error(EXIT_FAILURE, errno, "pi_spsc_ring_alloc");
+	pthread_create(&producer, NULL, producer_tf, NULL);
+	for (i = 0; i < LOOPS; i++) {
+		err = pi_spsc_ring_pop(ring, &it);
+		if (err)
+			error(EXIT_FAILURE, err, "pi_spsc_ring_pop");
+		if (it.seq != i || it.val != i * 3)
+			error(EXIT_FAILURE, 0, "got %ld/%ld, expected %ld", it.seq,
+			      it.val, i);
+		if (!(i % 25000))
+			usleep(1000);
+	}
+	pthread_join(producer, NULL);
+	pi_spsc_ring_free(ring);
+
+	printf("%d elements\n", LOOPS);
+	return 0;
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+// rtpi::striped_mutex must hand out the same stripe for the same key, work
+// with std::unique_lock, and lock several keys without deadlocking when
+// threads pass them in opposite orders.
+
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "rtpi/striped_mutex.hpp"
+
+static rtpi::striped_mutex<8> stripes;
+static long a[2], b[2];
+
+static void transfer(long *from, long *to, int loops)
+{
+	for (int i = 0; i < loops; i++) {
+		stripes.lock_keys(from, to);
+		(*from)--;
+		(*to)++;
+		stripes.unlock_keys(from, to);
+	}
+}
+
+int main()
+{
+	if (&stripes[&a[0]] != &stripes[&a[0]] || &stripes[42] != &stripes[42]) {
+		std::printf("FAIL: key mapped to different stripes\n");
+		return 1;
+	}
+	{
+		std::unique_lock<rtpi::mutex> lock(stripes[&a[0]]);
+		if (stripes.try_lock(&a[0])) {
+			std::printf("FAIL: try_lock took a held stripe\n");
+			return 1;
+		}
+	}
+
+	std::thread t1(transfer, &a[0], &b[1], 100000);
+	std::thread t2(transfer, &b[1], &a[0], 100000);
+	t1.join();
+	t2.join();
+
+	if (a[0] || b[1]) {
+		std::printf("FAIL: a %ld b %ld\n", a[0], b[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+
+// rtpi::timed_mutex must time out on a held mutex with both steady_clock
+// and system_clock deadlines, and be usable with std::unique_lock.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "rtpi/timed_mutex.hpp"
+
+static rtpi::timed_mutex lock;
+
+int main()
+{
+	using namespace std::chrono;
+	std::atomic<bool> locked(false), release(false);
+
+	std::thread owner([&] {
+		std::lock_guard<rtpi::timed_mutex> guard(lock);
+		locked = true;
+		while (!release)
+			std::this_thread::yield();
+	});
+	while (!locked)
+		std::this_thread::yield();
+
+	auto start = steady_clock::now();
+	if (lock.try_lock_for(milliseconds(20))) {
+		std::printf("FAIL: try_lock_for took a held mutex\n");
+		return 1;
+	}
+	if (steady_clock::now() - start < milliseconds(20)) {
+		std::printf("FAIL: try_lock_for returned early\n");
+		return 1;
+	}
+	if (lock.try_lock_until(system_clock::now() + milliseconds(20))) {
+		std::printf("FAIL: try_lock_until took a held mutex\n");
+		return 1;
+	}
+
+	release = true;
+	std::unique_lock<rtpi::timed_mutex> ul(lock, seconds(10));
+	if (!ul.owns_lock()) {
+		std::printf("FAIL: unique_lock timed out on a released mutex\n");
+		return 1;
+	}
+	ul.unlock();
+	owner.join();
+	return 0;
+}